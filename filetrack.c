@@ -26,6 +26,10 @@
  * distribution.
  */
 
+#if (defined (FILETRACK_ENABLE_COOKIE_ENGINE) || defined (FILETRACK_ENABLE_MEMFD_TMPFILE) || defined (FILETRACK_ENABLE_GROUP_COMMIT) || defined (FILETRACK_ENABLE_FADVISE) || defined (FILETRACK_ENABLE_PREFETCH) || defined (FILETRACK_ENABLE_BACKTRACE)) && !defined (_GNU_SOURCE)
+	#define _GNU_SOURCE  /* fopencookie, memfd_create, syncfs, readahead, dladdr */
+#endif
+
 #include "ft_llapi.h"
 
 
@@ -50,6 +54,247 @@
 	#include <unistd.h>
 #endif
 
+#ifdef FILETRACK_ENABLE_SHM_REGISTRY
+	#if !defined (__unix__) && !defined (__linux__) && !defined (__APPLE__)
+		#error "FILETRACK_ENABLE_SHM_REGISTRY requires a POSIX environment."
+	#endif
+
+	#include "ft_shm.h"
+	#include <fcntl.h>
+	#include <pthread.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <time.h>
+#endif
+
+#ifdef FILETRACK_ENABLE_IO_STATS
+	#if !defined (__unix__) && !defined (__linux__) && !defined (__APPLE__)
+		#error "FILETRACK_ENABLE_IO_STATS requires a POSIX environment."
+	#endif
+
+	#if !defined (THREAD_LOCAL) || defined (__STDC_NO_ATOMICS__)
+		#error "FILETRACK_ENABLE_IO_STATS requires thread-local storage and C11 atomics."
+	#endif
+
+	#include <stdarg.h>
+	#include <stdatomic.h>
+	#include <pthread.h>
+#endif
+
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	#if !defined (__GLIBC__)
+		#error "FILETRACK_ENABLE_COOKIE_ENGINE requires glibc (fopencookie)."
+	#endif
+
+	#if !defined (THREAD_LOCAL)
+		#error "FILETRACK_ENABLE_COOKIE_ENGINE requires thread-local storage."
+	#endif
+#endif
+
+#if defined (FILETRACK_ENABLE_VIRTUAL_HANDLES) && !defined (FILETRACK_ENABLE_COOKIE_ENGINE)
+	#error "FILETRACK_ENABLE_VIRTUAL_HANDLES requires FILETRACK_ENABLE_COOKIE_ENGINE."
+#endif
+
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+	#include <sys/stat.h>
+#endif
+
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+
+	#include <sys/types.h>
+#endif
+
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+	#if !defined (__unix__) && !defined (__linux__) && !defined (__APPLE__)
+		#error "FILETRACK_ENABLE_LATENCY_STATS requires a POSIX environment."
+	#endif
+
+	#include <time.h>
+#endif
+
+#ifdef FILETRACK_ENABLE_LIFETIME_STATS
+	#if !defined (__unix__) && !defined (__linux__) && !defined (__APPLE__)
+		#error "FILETRACK_ENABLE_LIFETIME_STATS requires a POSIX environment."
+	#endif
+
+	#include <time.h>
+#endif
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	#if !defined (__unix__) && !defined (__linux__) && !defined (__APPLE__)
+		#error "FILETRACK_ENABLE_FD_TRACKING requires a POSIX environment."
+	#endif
+#endif
+
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+	#if !defined (__unix__) && !defined (__linux__) && !defined (__APPLE__)
+		#error "FILETRACK_ENABLE_DIR_TRACKING requires a POSIX environment."
+	#endif
+#endif
+
+#ifdef FILETRACK_ENABLE_STREAM_CACHE
+	#if !defined (__unix__) && !defined (__linux__) && !defined (__APPLE__)
+		#error "FILETRACK_ENABLE_STREAM_CACHE requires a POSIX environment."
+	#endif
+
+	#include <sys/stat.h>
+
+	#ifdef __APPLE__
+		#define FT_STAT_MTIM(st) ((st).st_mtimespec)
+	#else
+		#define FT_STAT_MTIM(st) ((st).st_mtim)
+	#endif
+#endif
+
+#ifdef FILETRACK_ENABLE_NEGATIVE_CACHE
+	#if !defined (__unix__) && !defined (__linux__) && !defined (__APPLE__)
+		#error "FILETRACK_ENABLE_NEGATIVE_CACHE requires a POSIX environment."
+	#endif
+#endif
+
+#ifdef FILETRACK_ENABLE_TMPFILE_POOL
+	#if !defined (__unix__) && !defined (__linux__) && !defined (__APPLE__)
+		#error "FILETRACK_ENABLE_TMPFILE_POOL requires a POSIX environment."
+	#endif
+
+	#include <fcntl.h>
+	#include <pthread.h>
+	#include <sys/stat.h>
+	#include <time.h>
+#endif
+
+#ifdef FILETRACK_ENABLE_MEMFD_TMPFILE
+	#if !defined (__linux__)
+		#error "FILETRACK_ENABLE_MEMFD_TMPFILE requires Linux (memfd_create)."
+	#endif
+
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+#ifdef FILETRACK_ENABLE_ASYNC_CLOSE
+	#if !defined (__unix__) && !defined (__linux__) && !defined (__APPLE__)
+		#error "FILETRACK_ENABLE_ASYNC_CLOSE requires a POSIX environment."
+	#endif
+
+	#include <pthread.h>
+	#include <time.h>
+#endif
+
+#ifdef FILETRACK_ENABLE_IO_URING
+	#if !defined (__linux__)
+		#error "FILETRACK_ENABLE_IO_URING requires Linux."
+	#endif
+
+	#if defined (__STDC_NO_ATOMICS__)
+		#error "FILETRACK_ENABLE_IO_URING requires C11 atomics."
+	#endif
+
+	/* 枠はストリームごとに待つため、まとめて確保するとバッチが予算より大きい時に待ち続けてしまう */
+	#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+		#warning "FILETRACK_ENABLE_IO_URING is not used with FILETRACK_ENABLE_ADMISSION_CONTROL; fopen_batch opens files one by one."
+	#endif
+
+	#include <fcntl.h>
+	#include <stdatomic.h>
+	#include <linux/io_uring.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+#endif
+
+#ifdef FILETRACK_ENABLE_GROUP_COMMIT
+	#if !defined (__unix__) && !defined (__linux__) && !defined (__APPLE__)
+		#error "FILETRACK_ENABLE_GROUP_COMMIT requires a POSIX environment."
+	#endif
+
+	#include <fcntl.h>
+	#include <pthread.h>
+	#include <sys/stat.h>
+	#include <time.h>
+#endif
+
+#if defined (FILETRACK_ENABLE_BUFFER_POOL) && defined (__linux__)
+	#include <sys/mman.h>  /* ヒュージページ */
+#endif
+
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+	#if !defined (__unix__) && !defined (__linux__) && !defined (__APPLE__)
+		#error "FILETRACK_ENABLE_ADMISSION_CONTROL requires a POSIX environment."
+	#endif
+
+	#include <pthread.h>
+	#include <time.h>
+#endif
+
+#ifdef FILETRACK_ENABLE_NOFILE_ALARM
+	#if !defined (__unix__) && !defined (__linux__) && !defined (__APPLE__)
+		#error "FILETRACK_ENABLE_NOFILE_ALARM requires a POSIX environment."
+	#endif
+
+	#include <sys/resource.h>
+#endif
+
+#if defined (FILETRACK_ENABLE_READDIR_STATS) && !defined (FILETRACK_ENABLE_DIR_TRACKING)
+	#error "FILETRACK_ENABLE_READDIR_STATS requires FILETRACK_ENABLE_DIR_TRACKING."
+#endif
+
+#if defined (FILETRACK_ENABLE_WRITE_ADVISOR) && !defined (FILETRACK_ENABLE_IO_STATS)
+	#error "FILETRACK_ENABLE_WRITE_ADVISOR requires FILETRACK_ENABLE_IO_STATS."
+#endif
+
+#ifdef FILETRACK_ENABLE_FADVISE
+	#if !defined (__unix__) && !defined (__linux__)
+		#error "FILETRACK_ENABLE_FADVISE requires posix_fadvise."
+	#endif
+
+	#ifndef FILETRACK_ENABLE_IO_STATS
+		#error "FILETRACK_ENABLE_FADVISE requires FILETRACK_ENABLE_IO_STATS."
+	#endif
+
+	#include <fcntl.h>
+	#include <sys/stat.h>
+	#ifdef __linux__
+		#include <sys/syscall.h>  /* cachestat */
+	#endif
+#endif
+
+#if defined (FILETRACK_ENABLE_SAMPLING) && defined (DEBUG)
+	#error "FILETRACK_ENABLE_SAMPLING cannot be used in debug mode, which needs every stream to detect double closes."
+#endif
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+	#include <time.h>
+#endif
+
+#ifdef FILETRACK_ENABLE_PREFETCH
+	#if !defined (__unix__) && !defined (__linux__) && !defined (__APPLE__)
+		#error "FILETRACK_ENABLE_PREFETCH requires a POSIX environment."
+	#endif
+
+	#include <fcntl.h>
+	#include <pthread.h>
+	#include <sys/stat.h>
+#endif
+
+#ifdef FILETRACK_ENABLE_BACKTRACE
+	#if !defined (__GLIBC__) && !defined (__APPLE__)
+		#error "FILETRACK_ENABLE_BACKTRACE requires backtrace and dladdr (glibc or macOS)."
+	#endif
+
+	/* スタックの範囲を確かめながらフレームポインタを辿れる環境では backtrace を使わない */
+	#if defined (__GNUC__) && (defined (__x86_64__) || defined (__aarch64__)) && defined (__GLIBC__) && defined (THREAD_LOCAL)
+		#define FT_BACKTRACE_FRAME_WALK
+		#include <pthread.h>
+	#endif
+
+	#include <dlfcn.h>
+	#include <execinfo.h>
+#endif
+
+#ifdef FT_POPEN_SUPPORTED
+	#include <time.h>
+#endif
+
 #if (defined (__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)) || defined (_POSIX_VERSION) || defined (__linux__) || defined (__FreeBSD__) || defined (__NetBSD__) || defined (__OpenBSD__) || defined (__DragonFly__)
 	#define MAYBE_ERRNO_THREAD_LOCAL
 #endif
@@ -60,18 +305,218 @@
 #undef tmpfile
 #undef fclose
 
+#if defined (DEBUG) || defined (FILETRACK_ENABLE_STREAM_CACHE)
+	#undef remove
+#endif
+
+#ifdef FT_POPEN_SUPPORTED
+	#undef popen
+	#undef pclose
+#endif
+
+#ifdef FT_FDOPEN_SUPPORTED
+	#undef fdopen
+#endif
+
+#ifdef FT_MEMSTREAM_SUPPORTED
+	#undef fmemopen
+	#undef open_memstream
+#endif
+
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+	#undef opendir
+	#undef fdopendir
+	#undef closedir
+	#undef readdir
+#endif
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	#undef open
+	#undef openat
+	#undef close
+	#undef dup
+	#undef dup2
+	#undef pipe
+	#undef socket
+	#undef mkstemp
+#endif
+
+#ifdef FILETRACK_ENABLE_IO_STATS
+	#undef fread
+	#undef fwrite
+	#undef fputs
+	#undef fprintf
+	#undef fgets
+	#undef fflush
+	#undef fseek
+#endif
+
 
 #define FILETRACK_ENTRIES_COUNT 64
 #define FILETRACK_ENTRIES_TRIAL 4
 
 #define FT_MODE_LEN_MAX 16
 
+#ifdef FILETRACK_ENABLE_SHM_REGISTRY
+	#ifndef FT_SHM_RECORDS_MAX
+		#define FT_SHM_RECORDS_MAX 1024
+	#endif
+
+	#define FT_SHM_NO_SLOT UINT32_MAX
+#endif
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	#define FT_FD_ENTRIES_MIN 64
+#endif
+
+#ifdef FILETRACK_ENABLE_IO_STATS
+	#ifndef FT_IO_STATS_SLOTS
+		#define FT_IO_STATS_SLOTS 64  /* 2 の累乗 */
+	#endif
+#endif
+
+#if defined (FILETRACK_ENABLE_LATENCY_STATS) || defined (FILETRACK_ENABLE_LIFETIME_STATS) || defined (FILETRACK_ENABLE_ADMISSION_CONTROL) || defined (FILETRACK_ENABLE_ASYNC_CLOSE) || defined (FILETRACK_ENABLE_GROUP_COMMIT)
+	/* 2 の累乗ごとの区間を 2^FT_HIST_SUB_BITS 個に分割する (相対誤差は最大 12.5%) */
+	#define FT_HIST_SUB_BITS 3
+	#define FT_HIST_SUB_COUNT (1u << FT_HIST_SUB_BITS)
+	#define FT_HIST_MAX_BITS 40  /* これ以上 (ns なら約 18 分、us なら約 12 日) は最後の区間にまとめる */
+	#define FT_HIST_BUCKETS ((FT_HIST_MAX_BITS - FT_HIST_SUB_BITS + 1) * FT_HIST_SUB_COUNT)
+#endif
+
+#ifdef FILETRACK_ENABLE_STREAM_CACHE
+	#ifndef FT_STREAM_CACHE_MAX
+		#define FT_STREAM_CACHE_MAX 16  /* 探索は線形なので大きくしすぎない */
+	#endif
+#endif
+
+#ifdef FILETRACK_ENABLE_TMPFILE_POOL
+	#ifndef FT_TMPFILE_POOL_MAX
+		#define FT_TMPFILE_POOL_MAX 64
+	#endif
+	#define FT_TMPFILE_POOL_RETRY_MS 100  /* 作成に失敗した後、再び試すまでの時間 */
+#endif
+
+#ifdef FILETRACK_ENABLE_MEMFD_TMPFILE
+	#ifndef FT_MEMFD_RAM_MAX
+		#define FT_MEMFD_RAM_MAX (64u * 1024u * 1024u)  /* memfd の一時ファイル全体で使ってよいメモリ (バイト) */
+	#endif
+	#define FT_MEMFD_ENTRIES_MIN 16
+#endif
+
+#ifdef FILETRACK_ENABLE_ASYNC_CLOSE
+	#ifndef FT_ASYNC_CLOSE_WORKERS
+		#define FT_ASYNC_CLOSE_WORKERS 2
+	#endif
+#endif
+
+#if defined (FILETRACK_ENABLE_IO_URING) && !defined (FILETRACK_ENABLE_ADMISSION_CONTROL)
+	#ifndef FT_IO_URING_ENTRIES
+		#define FT_IO_URING_ENTRIES 64  /* 一度に提出する数、これより多いものは分けて提出する */
+	#endif
+#endif
+
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+	#define FT_SIZE_BUCKETS 32  /* 2 の累乗ごと、最後の区間は 2 GiB 以上をまとめる */
+	#ifndef FT_WRITE_ADVISOR_MIN_SAVED
+		#define FT_WRITE_ADVISOR_MIN_SAVED 64  /* これより少ない削減は報告しない */
+	#endif
+	#if defined (FILETRACK_ENABLE_BUFFER_POOL) && !defined (FT_WRITE_ADVISOR_AUTOTUNE_MIN)
+		#define FT_WRITE_ADVISOR_AUTOTUNE_MIN 4  /* 自動調整の前に閉じられている必要があるストリームの数 */
+	#endif
+	#define FT_WRITE_ADVISOR_BUFFER_MIN 4096u
+	#define FT_WRITE_ADVISOR_BUFFER_MAX (1024u * 1024u)
+#endif
+
+#ifdef FILETRACK_ENABLE_FADVISE
+	#ifndef FT_FADVISE_LEARN_MIN
+		#define FT_FADVISE_LEARN_MIN 3  /* ヒントを与える前に閉じられている必要があるストリームの数 */
+	#endif
+	#ifndef FT_FADVISE_READAHEAD_MAX
+		#define FT_FADVISE_READAHEAD_MAX (8u * 1024u * 1024u)  /* 開いた時に先読みさせる最大のバイト数 */
+	#endif
+	#define FT_FADVISE_NEAR_SEEK 65536  /* これより近くへのシークは連続した読み込みとみなす */
+	#define FT_FADVISE_RANDOM_SEEKS 4   /* ランダムとみなすのに必要な遠くへのシークの数 */
+#endif
+
+#ifdef FILETRACK_ENABLE_PREFETCH
+	#ifndef FT_PREFETCH_WORKERS
+		#define FT_PREFETCH_WORKERS 1
+	#endif
+	#define FT_PREFETCH_CHUNK (1024u * 1024u)  /* この単位ごとに取り消されていないか確認する */
+#endif
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+	#ifndef FT_SAMPLING_PERIOD
+		#define FT_SAMPLING_PERIOD 64  /* 平均して何回に 1 回追跡するか、1 なら全て追跡する */
+	#endif
+	#ifndef FT_SAMPLING_FULL_OPENS
+		#define FT_SAMPLING_FULL_OPENS 64  /* 適応的な場合、呼び出し元ごとにこの回数までは全て追跡する */
+	#endif
+	#define FT_SAMPLING_FILTER_BITS 12  /* 追跡中のストリームを表す計数ブルームフィルタの大きさ */
+	#define FT_SAMPLING_FILTER_SIZE (1u << FT_SAMPLING_FILTER_BITS)
+#endif
+
+#ifdef FILETRACK_ENABLE_BACKTRACE
+	#ifndef FT_BACKTRACE_DEPTH
+		#define FT_BACKTRACE_DEPTH 16  /* 記録するリターンアドレスの数の既定値、filetrack 自身のものを含む */
+	#endif
+	#define FT_BACKTRACE_DEPTH_MAX 64
+	#if FT_BACKTRACE_DEPTH > FT_BACKTRACE_DEPTH_MAX
+		#error "FT_BACKTRACE_DEPTH must not exceed 64."
+	#endif
+#endif
+
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	#ifndef FT_BUFFER_POOL_DEFAULT_SIZE
+		#define FT_BUFFER_POOL_DEFAULT_SIZE (64u * 1024u)  /* 呼び出し元ごとに設定されていない場合、0 なら stdio に任せる */
+	#endif
+	#ifndef FT_BUFFER_POOL_KEEP
+		#define FT_BUFFER_POOL_KEEP 16  /* 区分ごとに手元に残す空きバッファの数 */
+	#endif
+	#define FT_BUFFER_CLASS_MIN_BITS 12  /* 4 KiB */
+	#define FT_BUFFER_CLASS_MAX_BITS 24  /* 16 MiB */
+	#define FT_BUFFER_CLASSES (FT_BUFFER_CLASS_MAX_BITS - FT_BUFFER_CLASS_MIN_BITS + 1)
+	#define FT_HUGE_PAGE_SIZE ((size_t)2u * 1024u * 1024u)
+#endif
+
+#ifdef FILETRACK_ENABLE_NEGATIVE_CACHE
+	#ifndef FT_NEGATIVE_CACHE_TTL_MS
+		#define FT_NEGATIVE_CACHE_TTL_MS 1000
+	#endif
+	#ifndef FT_NEGATIVE_CACHE_MAX
+		#define FT_NEGATIVE_CACHE_MAX 1024  /* これを超えたら期限切れのものや古いものを捨てる */
+	#endif
+#endif
+
+#ifdef FILETRACK_ENABLE_NOFILE_ALARM
+	#ifndef FT_NOFILE_HYSTERESIS_PERCENT
+		#define FT_NOFILE_HYSTERESIS_PERCENT 5  /* 閾値のすぐ上下を行き来しても何度も呼び出さない */
+	#endif
+#endif
+
+#ifdef FILETRACK_ENABLE_LIFETIME_STATS
+	#ifndef FT_LIFETIME_MIN_SAMPLES
+		#define FT_LIFETIME_MIN_SAMPLES 20  /* これより少ない呼び出し元では長寿命の判定をしない */
+	#endif
+
+	#define FT_LIFETIME_SLACK_US 10000  /* 粗い時計の分解能 (数ミリ秒) より小さい差は無視する */
+
+	/* マイクロ秒を "秒.ミリ秒 s" で出力する */
+	#define FT_DURATION_FMT "%llu.%03llu s"
+	#define FT_DURATION_ARGS(us) (unsigned long long)((us) / 1000000u), (unsigned long long)((us) / 1000u % 1000u)
+#endif
+
 
 static const char* FileOpenTypeNames[] = {
 	"not_open",
 	"fopen",
 	"tmpfile",
 	"freopen",
+	"popen",
+	"fdopen",
+	"mkstemp",
+	"fmemopen",
+	"open_memstream",
 	"unknown"
 };
 
@@ -80,12 +525,288 @@ static const char* FileClosedTypeNames[] = {
 	"not_closed",
 	"fclose",
 	"freopen",
+	"pclose",
 	"unknown"
 };
 
 
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+static const char* FileTrackLatencyOpNames[] = {
+	"fopen",
+	"tmpfile",
+	"freopen",
+	"fclose",
+	"popen",
+	"pclose"
+};
+#endif
+
+
+#if defined (FILETRACK_ENABLE_LATENCY_STATS) || defined (FILETRACK_ENABLE_LIFETIME_STATS) || defined (FILETRACK_ENABLE_ADMISSION_CONTROL) || defined (FILETRACK_ENABLE_ASYNC_CLOSE) || defined (FILETRACK_ENABLE_GROUP_COMMIT)
+/* 対数線形 (HDR 形式) のヒストグラム */
+typedef struct {
+	uint64_t count;
+	uint64_t max;
+	uint64_t buckets[FT_HIST_BUCKETS];
+} FileTrackHist;
+#endif
+
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+typedef enum {
+	FT_FD_NONE,
+	FT_FD_STREAM,  /* 追跡中のストリームが使っている記述子 */
+	FT_FD_OPEN,
+	FT_FD_OPENAT,
+	FT_FD_DUP,
+	FT_FD_DUP2,
+	FT_FD_PIPE,
+	FT_FD_SOCKET,
+	FT_FD_MKSTEMP
+} FileTrackFdType;
+
+
+static const char* FileTrackFdTypeNames[] = {
+	"none",
+	"stream",
+	"open",
+	"openat",
+	"dup",
+	"dup2",
+	"pipe",
+	"socket",
+	"mkstemp"
+};
+#endif
+
+
+/* 呼び出し元（ファイル名と行番号の組）ごとの統計 */
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+/* 2 の累乗ごとの区間で数える (区間 i は 2^i 以上 2^(i+1) 未満、区間 0 は 1 以下) */
+typedef struct {
+	uint64_t write_sizes[FT_SIZE_BUCKETS];  /* fwrite などの一回の呼び出しで書かれたバイト数 */
+	uint64_t flush_sizes[FT_SIZE_BUCKETS];  /* fflush や fseek、閉じる時に書き出されたバイト数 */
+	uint64_t pending;  /* スロットから回収した、まだ書き出されていないバイト数 */
+} FileTrackWriteProfile;
+
+
+/* レポートと自動調整で使う見積もり */
+typedef struct {
+	uint64_t current_size;
+	uint64_t current_calls;
+	uint64_t buffer_size;       /* 勧めるバッファの大きさ */
+	uint64_t buffer_calls;
+	uint64_t flush_interval;    /* 書き出しの間隔の中央値 (バイト) */
+	uint64_t explicit_flushes;  /* 閉じる時以外の書き出し */
+	uint64_t noflush_calls;     /* 勧める大きさで、閉じる時だけ書き出した場合 */
+} FileTrackWriteAdvice;
+#endif
+
+
+#ifdef FILETRACK_ENABLE_FADVISE
+typedef enum {
+	FT_PATTERN_UNKNOWN,
+	FT_PATTERN_SEQUENTIAL,
+	FT_PATTERN_RANDOM,
+	FT_PATTERN_WRITE_ONCE
+} FileTrackAccessPattern;
+#endif
+
+
+#ifdef FILETRACK_ENABLE_PREFETCH
+enum {
+	FT_PREFETCH_QUEUED,
+	FT_PREFETCH_RUNNING,
+	FT_PREFETCH_FINISHED
+};
+
+
+/* 先読みの依頼、prefetch_mutex で保護する */
+typedef struct FileTrackPrefetchJob {
+	struct FileTrackPrefetchJob* prev;  /* 全ての依頼の一覧 (先頭が古いもの) */
+	struct FileTrackPrefetchJob* next;
+	uint64_t length;  /* 先読みするバイト数 */
+	uint64_t done;    /* 先読みが終わったバイト数 */
+	int fd;           /* 複製した記述子、先読みが終わったら閉じる */
+	uint8_t state;
+	bool cancel;
+	bool orphan;      /* ストリームが先に閉じられた、ワーカーが解放する */
+} FileTrackPrefetchJob;
+#endif
+
+
+typedef struct FileTrackSite {
+	const char* file;                 /* __FILE__ を指すだけで複製はしない */
+	struct FileTrackSite* hash_next;  /* ハッシュ値が衝突した呼び出し元 */
+	struct FileTrackSite* next;       /* 全呼び出し元の一覧 */
+	uint64_t open_cnt;
+	uint64_t live_cnt;
+#ifdef FILETRACK_ENABLE_IO_STATS
+	FileTrackIoStats io;       /* 閉じられたストリームの合計 */
+	FileTrackIoStats io_live;  /* レポート作成時に開いているストリームから集計する */
+#endif
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	FileTrackIoStats sys_io;       /* cookie のコールバックで数えた実ファイルへの入出力 */
+	FileTrackIoStats sys_io_live;
+#endif
+#ifdef FILETRACK_ENABLE_STREAM_CACHE
+	uint64_t cache_hit_cnt;
+	uint64_t cache_miss_cnt;
+#endif
+#ifdef FILETRACK_ENABLE_NEGATIVE_CACHE
+	uint64_t negative_hit_cnt;  /* 存在しないことが記録済みで fopen を呼ばなかった回数 */
+#endif
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	size_t buffer_size;    /* buffer_size_set が false なら既定の大きさを使う */
+	bool buffer_size_set;
+	uint64_t buffer_hit_cnt;
+	uint64_t buffer_miss_cnt;
+	uint64_t buffer_autotune_cnt;  /* 書き込みの分析によってバッファの大きさを変えた回数 */
+#endif
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+	FileTrackWriteProfile* write_profile;  /* 書き込んだストリームが最初に閉じられた時に作る */
+	uint64_t write_closed_cnt;
+#endif
+#ifdef FILETRACK_ENABLE_FADVISE
+	uint64_t pattern_observed_cnt;    /* 読み書きしてから閉じられたストリーム */
+	uint64_t pattern_seq_cnt;
+	uint64_t pattern_full_read_cnt;   /* 連続した読み込みのうち、ファイルの半分以上を読んだもの */
+	uint64_t pattern_random_cnt;
+	uint64_t pattern_write_once_cnt;  /* 書き込むだけで読み込まなかったもの */
+	uint64_t fadvise_hint_cnt;
+#endif
+#ifdef FILETRACK_ENABLE_PREFETCH
+	size_t prefetch_size;    /* prefetch_size_set が false なら学習した使われ方に任せる */
+	bool prefetch_size_set;
+	uint64_t prefetch_cnt;
+	uint64_t prefetch_bytes;       /* 閉じられたストリームの分 */
+	uint64_t prefetch_used_bytes;  /* そのうちストリームが読み進めた分 */
+#endif
+#ifdef FILETRACK_ENABLE_SAMPLING
+	uint64_t sample_seen_cnt;   /* 適応的な場合のみ、追跡しなかったものを含む */
+	uint64_t sample_countdown;  /* 次に追跡するまでの回数 */
+	uint64_t sample_open_est;   /* 追跡したストリームの重みの合計 */
+	uint64_t sample_live_est;
+#endif
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+	uint64_t virtual_park_cnt;    /* 使われていない間に実ファイルを閉じた回数 */
+	uint64_t virtual_reopen_cnt;
+#endif
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+	FileTrackHist* latency[FT_LATENCY_OP_COUNT];  /* この呼び出し元で初めて計測した時に確保する */
+#endif
+#ifdef FILETRACK_ENABLE_ASYNC_CLOSE
+	FileTrackHist* async_close;  /* ワーカーが書き出して閉じるまでの時間 (ns)、最初に閉じた時に確保する */
+	uint64_t async_close_fail_cnt;
+#endif
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+	FileTrackHist* admission_wait;   /* 枠を待った時間 (ns)、最初に待った時に確保する */
+	uint64_t admission_timeout_cnt;
+#endif
+#ifdef FILETRACK_ENABLE_LIFETIME_STATS
+	FileTrackHist* lifetime;  /* 閉じられたストリームの寿命 (us)、最初に閉じられた時に確保する */
+	uint64_t oldest_open_ns;  /* レポート作成時に開いているストリームから集計する */
+#endif
+#ifdef FT_POPEN_SUPPORTED
+	uint64_t child_cnt;           /* popen で起動した子プロセス */
+	uint64_t child_closed_cnt;
+	uint64_t child_wall_ns;       /* popen から pclose までの合計 */
+	uint64_t child_wall_max_ns;
+#endif
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	uint64_t fd_open_cnt;  /* ストリームのものを除いた記述子 */
+	uint64_t fd_live_cnt;
+#endif
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+	uint64_t dir_open_cnt;
+	uint64_t dir_live_cnt;
+#endif
+#ifdef FILETRACK_ENABLE_READDIR_STATS
+	uint64_t dir_read_cnt;       /* 閉じられたディレクトリから読んだエントリの合計 */
+	uint64_t dir_read_live_cnt;  /* レポート作成時に開いているディレクトリから集計する */
+	uint64_t dir_read_max;       /* 1 つのディレクトリから読んだエントリの最大 */
+#endif
+	int line;
+} FileTrackSite;
+
+
+#ifdef FILETRACK_ENABLE_BACKTRACE
+/* 呼び出し元と呼び出し履歴の組ごとに 1 つだけ作り、ストリームは ID で参照する */
+typedef struct FileTrackStack {
+	struct FileTrackStack* hash_next;  /* 同じハッシュ値の別の呼び出し履歴 */
+	const FileTrackSite* site;
+	char** symbols;      /* 初めて出力する時に backtrace_symbols で作る */
+	uint64_t open_cnt;
+	uint64_t live_cnt;
+	uint32_t id;         /* backtrace_stacks の添字 + 1 */
+	uint32_t depth;
+	uint32_t own_depth;  /* 先頭から続く filetrack 自身のフレームの数、出力する時に省く */
+	bool symbolized;
+	void* frames[];
+} FileTrackStack;
+#endif
+
+
+#ifdef FILETRACK_ENABLE_STREAM_CACHE
+/* fopen_cached で開いたストリームを再利用してよいか判断するための情報 */
+typedef struct {
+	char* path;
+	char mode[FT_MODE_LEN_MAX + 1];
+	struct timespec mtime;
+	off_t size;
+	dev_t dev;
+	ino_t ino;
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	void* buffer;  /* キャッシュ中もストリームが使い続けるプールのバッファ、閉じた後にプールへ戻す */
+	uint8_t buffer_class;
+	uint8_t buffer_origin;
+#endif
+} FileTrackCacheInfo;
+
+
+typedef struct {
+	FILE* stream;
+	FileTrackCacheInfo* info;
+	uint64_t last_used;
+} FileTrackCacheSlot;
+#endif
+
+
 typedef struct {
 	FILE* stream;
+	FileTrackSite* open_site;
+#ifdef FILETRACK_ENABLE_STREAM_CACHE
+	FileTrackCacheInfo* cache_info;  /* fopen_cached で開いた場合のみ、閉じる時にキャッシュへ移す */
+#endif
+#ifdef FT_POPEN_SUPPORTED
+	uint64_t popen_ns;  /* popen の場合のみ、pclose までの時間を測る */
+#endif
+#ifdef FILETRACK_ENABLE_LIFETIME_STATS
+	uint64_t open_ns;         /* coarse_clock_ns の値 */
+	uint64_t mode_change_ns;  /* モードを変更していなければ 0 */
+#ifdef DEBUG
+	uint64_t close_ns;
+#endif
+#endif
+#ifdef FILETRACK_ENABLE_IO_STATS
+	FileTrackIoStats io;
+#endif
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+	FileTrackWriteProfile* write_profile;  /* 書き込みを回収した時に作る */
+#endif
+#ifdef FILETRACK_ENABLE_FADVISE
+	uint64_t far_seek_cnt;
+#endif
+#ifdef FILETRACK_ENABLE_PREFETCH
+	FileTrackPrefetchJob* prefetch;
+#endif
+#ifdef FILETRACK_ENABLE_SAMPLING
+	uint64_t sample_weight;  /* このストリームが代表するストリームの数 */
+#endif
+#ifdef FT_MEMSTREAM_SUPPORTED
+	size_t* memstream_sizeloc;  /* open_memstream の場合のみ、利用者の変数を指す */
+	size_t fmemopen_size;       /* fmemopen の場合のみ */
+#endif
 #ifdef DEBUG
 	char* filename;
 	char* mode;
@@ -95,9 +816,35 @@ typedef struct {
 	int open_line;
 	int last_change_mode_line;
 	int close_line;
-	FileOpenType open_type;
 	FileClosedType closed_type;
 	bool is_closed;
+#endif
+	FileOpenType open_type;  /* popen のストリームを fclose で閉じないように常に記録する */
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+	bool admitted;  /* 閉じた時に返す枠を持っている */
+#endif
+#ifdef FILETRACK_ENABLE_ASYNC_CLOSE
+	bool closing;   /* ワーカーに閉じるのを任せた */
+#endif
+#ifdef FILETRACK_ENABLE_FADVISE
+	bool fadvise_write_only;  /* 読み込めないモードで開いた */
+#endif
+#ifdef FILETRACK_ENABLE_SHM_REGISTRY
+	uint32_t shm_slot;
+#endif
+#ifdef FILETRACK_ENABLE_BACKTRACE
+	uint32_t stack_id;  /* 記録していなければ 0 */
+#endif
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	int fd;  /* 閉じた後は fileno を使えないので開いた時に記録する */
+#endif
+#ifdef FILETRACK_ENABLE_MEMFD_TMPFILE
+	int memfd;  /* memfd で作った一時ファイルの記述子、それ以外は -1 */
+#endif
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	void* buffer;  /* プールから割り当てた stdio のバッファ、閉じた後にプールへ戻す */
+	uint8_t buffer_class;
+	uint8_t buffer_origin;
 #endif
 } FileTrackEntry;  /* パディングの削減のため順序がわかりにくくなっているので注意 */
 
@@ -110,6 +857,32 @@ typedef struct {
 #endif
 
 
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+typedef struct {
+	DIR* dir;
+	FileTrackSite* open_site;
+#ifdef FILETRACK_ENABLE_READDIR_STATS
+	uint64_t read_cnt;  /* readdir が返したエントリの数 */
+#endif
+#ifdef DEBUG
+	char* path;
+#endif
+} FileTrackDirEntry;
+#endif
+
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+typedef struct {
+	FileTrackSite* open_site;
+	FILE* stream;  /* FT_FD_STREAM の場合のみ */
+#ifdef DEBUG
+	char* path;
+#endif
+	FileTrackFdType type;  /* FT_FD_NONE なら未使用 */
+} FileTrackFdEntry;
+#endif
+
+
 /* errno 記録時に関数名を記録する */
 #ifdef THREAD_LOCAL
 	THREAD_LOCAL const char* filetrack_errfunc = NULL;
@@ -120,641 +893,7884 @@ typedef struct {
 
 static MHashTable* filetrack_entries = NULL;
 
+static MHashTable* filetrack_sites = NULL;
+static FileTrackSite* filetrack_sites_list = NULL;
+
 #ifdef DEBUG
 	static MHashTable* filename_stream_entries = NULL;
 #endif
 
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+	static MHashTable* filetrack_dirs = NULL;
+#endif
 
-#define GLOBAL_LOCK_FUNC_NAME filetrack_lock
-#define GLOBAL_UNLOCK_FUNC_NAME filetrack_unlock
-#define GLOBAL_LOCK_FUNC_SCOPE 
+static uint64_t stream_live_cnt = 0;  /* 追跡中で開いているストリーム */
+static uint64_t stream_peak_cnt = 0;
+static uint64_t stream_interval_peak_cnt = 0;  /* filetrack_watermark でリセットされる */
 
-#include "global_lock.h"
+#ifdef FT_POPEN_SUPPORTED
+	static uint64_t popen_live_cnt = 0;  /* 開いている子プロセスへのパイプ */
+	static uint64_t popen_peak_cnt = 0;
+#endif
 
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	static FileTrackFdEntry* fd_entries = NULL;  /* 記述子の番号で引く */
+	static size_t fd_entries_cnt = 0;
+	static uint64_t fd_live_total = 0;  /* ストリームのものを除いた記述子 */
+#endif
 
-static void quit (void);
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+	static uint64_t dir_live_total = 0;
+#endif
 
-/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
-static void init (void) {
-	for (size_t i = 0; i < FILETRACK_ENTRIES_TRIAL; i++) {
-		filetrack_entries = mht_uint_create(FILETRACK_ENTRIES_COUNT);
-		if (LIKELY(filetrack_entries != NULL)) break;
-	}
-	if (UNLIKELY(filetrack_entries == NULL)) {
-		fprintf(stderr, "Failed to initialize file tracking.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
-		filetrack_unlock();
-		global_lock_quit();
-		exit(EXIT_FAILURE);
-	}
+#ifdef FILETRACK_ENABLE_STREAM_CACHE
+	static FileTrackCacheSlot stream_cache[FT_STREAM_CACHE_MAX];
+	static size_t stream_cache_cnt = 0;
+	static uint64_t stream_cache_tick = 0;
+	static FileTrackStreamCacheStats stream_cache_stats = { 0 };
+	static bool stream_cache_opening = false;  /* fopen_cached で開いている間は cookie で包まない */
+#endif
 
-	atexit(quit);
+#ifdef FILETRACK_ENABLE_ASYNC_CLOSE
+	typedef struct FileTrackAsyncCloseJob {
+		struct FileTrackAsyncCloseJob* next;
+		FILE* stream;
+		const char* file;
+		int line;
+		uint64_t queued_ns;
+	} FileTrackAsyncCloseJob;
+
+	/* ワーカーはこの mutex で待ち行列を扱い、ストリームを閉じる時だけグローバルロックを取る */
+	static pthread_mutex_t async_close_mutex = PTHREAD_MUTEX_INITIALIZER;
+	static pthread_cond_t async_close_work_cond = PTHREAD_COND_INITIALIZER;
+	static pthread_cond_t async_close_idle_cond = PTHREAD_COND_INITIALIZER;
+	static pthread_t async_close_workers[FT_ASYNC_CLOSE_WORKERS];
+	static size_t async_close_workers_cnt = 0;
+	static bool async_close_stopping = false;
+	static FileTrackAsyncCloseJob* async_close_head = NULL;
+	static FileTrackAsyncCloseJob* async_close_tail = NULL;
+	static size_t async_close_pending = 0;  /* 閉じている途中のものを含む */
+
+	/* 失敗の記録、一杯になったら古いものから捨てる */
+	static FileTrackAsyncCloseResult async_close_errors[FT_ASYNC_CLOSE_ERRORS_MAX];
+	static size_t async_close_errors_head = 0;
+	static size_t async_close_errors_cnt = 0;
+	static uint64_t async_close_errors_lost = 0;
+
+	static FileTrackAsyncCloseCallback async_close_callback = NULL;  /* グローバルロックで保護する */
+	static void* async_close_callback_arg = NULL;
+#endif
 
-#ifdef DEBUG
-	filename_stream_entries = mht_str_create(FILETRACK_ENTRIES_COUNT);
-	if (UNLIKELY(filename_stream_entries == NULL)) {
-		filetrack_errfunc = "init";
-	}
+#ifdef FILETRACK_ENABLE_IO_URING
+	/* liburing には依存せず、システムコールで直接使う */
+	typedef struct {
+		void* sq_ptr;
+		void* cq_ptr;  /* IORING_FEAT_SINGLE_MMAP なら sq_ptr と同じ */
+		struct io_uring_sqe* sqes;
+		struct io_uring_cqe* cqes;
+		_Atomic unsigned* sq_tail;
+		_Atomic unsigned* cq_head;
+		_Atomic unsigned* cq_tail;
+		unsigned* sq_array;
+		size_t sq_size;
+		size_t cq_size;
+		size_t sqes_size;
+		unsigned sq_mask;
+		unsigned cq_mask;
+		unsigned entries;
+		int fd;
+	} FileTrackUring;
+
+	static FileTrackUring uring = { .fd = -1 };  /* グローバルロックで保護する */
+	#ifndef FILETRACK_ENABLE_ADMISSION_CONTROL
+		static bool uring_unavailable = false;
+	#endif
+	static FileTrackBatchStats batch_stats = { 0 };
 #endif
-}
 
+#if defined (FILETRACK_ENABLE_WRITE_ADVISOR) && defined (FILETRACK_ENABLE_BUFFER_POOL)
+	static bool write_advisor_autotune = false;  /* グローバルロックで保護する */
+#endif
 
-void filetrack_entry_add (FILE* stream, FileOpenType open_type, const char* filename, const char* mode, size_t filename_len_max, const char* file, int line) {
-	if (stream == NULL) {
-		fprintf(stderr, "stream is null! File cannot be tracked!\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_entry_add";
-		return;
-	}
+#ifdef FILETRACK_ENABLE_FADVISE
+	/* グローバルロックで保護する */
+	static bool fadvise_readahead = true;
+	static FileTrackFadviseStats fadvise_stats = { 0 };
+#endif
 
-	if (UNLIKELY(filetrack_entries == NULL)) init();
+#ifdef FILETRACK_ENABLE_PREFETCH
+	/* ワーカーはグローバルロックを使わない */
+	static pthread_mutex_t prefetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+	static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+	static pthread_t prefetch_workers[FT_PREFETCH_WORKERS];
+	static size_t prefetch_workers_cnt = 0;
+	static bool prefetch_stopping = false;
+	static FileTrackPrefetchJob* prefetch_head = NULL;
+	static FileTrackPrefetchJob* prefetch_tail = NULL;
+
+	static FileTrackPrefetchStats prefetch_stats = { 0 };  /* グローバルロックで保護する */
+#endif
 
-#ifdef DEBUG
-	if (filename_len_max < 1) {
-		fprintf(stderr, "filename_len_max must be at least 1.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_entry_add";
-		return;
-	}
+#ifdef FILETRACK_ENABLE_SAMPLING
+	/* 以下はグローバルロックで保護する */
+	static uint32_t sampling_period = FT_SAMPLING_PERIOD;
+	static bool sampling_adaptive = true;
+	static uint64_t sampling_countdown = 0;  /* 適応的でない場合に使う */
+	static uint64_t sampling_random = 0;     /* 0 なら未初期化 */
+	static uint64_t sampling_weight = 1;     /* 次に作るエントリに渡す重み */
+	static uint8_t sampling_filter[FT_SAMPLING_FILTER_SIZE];  /* 255 で飽和させ、以降は減らさない */
+	static FileTrackSamplingStats sampling_stats = { 0 };
+#endif
 
-	char* filename_cpy = mutils_strndup(filename, filename_len_max);
-	if (UNLIKELY(filename_cpy == NULL)) {
-		fprintf(stderr, "Failed to duplicate filename string.\nFile: %s   Line: %d\n", file, line);
-		filetrack_errfunc = "filetrack_entry_add";
-	}
+#ifdef FILETRACK_ENABLE_BACKTRACE
+	/* 以下はグローバルロックで保護する */
+	static size_t backtrace_depth = FT_BACKTRACE_DEPTH;
+	static MHashTable* backtrace_table = NULL;         /* 呼び出し履歴のハッシュ値で引く */
+	static FileTrackStack** backtrace_stacks = NULL;  /* ID - 1 で引く */
+	static size_t backtrace_stacks_cnt = 0;
+	static size_t backtrace_stacks_cap = 0;
+	static FileTrackBacktraceStats backtrace_stats = { 0 };
+
+	#ifdef FT_BACKTRACE_FRAME_WALK
+		static THREAD_LOCAL uintptr_t backtrace_stack_top = 0;  /* スレッドのスタックの上端、0 なら未取得で 1 なら取得できない */
+	#endif
+#endif
 
-	char* mode_cpy = mutils_strndup(mode, FT_MODE_LEN_MAX);
-	if (UNLIKELY(mode_cpy == NULL)) {
-		fprintf(stderr, "Failed to duplicate mode string.\nFile: %s   Line: %d\n", file, line);
-		filetrack_errfunc = "filetrack_entry_add";
-	}
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	/* 空きバッファの先頭に書き込んで繋ぐ */
+	typedef struct FileTrackBufferNode {
+		struct FileTrackBufferNode* next;
+		uint8_t origin;
+	} FileTrackBufferNode;
+
+	enum {
+		FT_BUFFER_MALLOC,
+		FT_BUFFER_MMAP,  /* ヒュージページの大きさ以上のため個別に確保した */
+		FT_BUFFER_SLAB   /* ヒュージページの領域から切り出した、個別には解放できない */
+	};
+
+	/* 以下はグローバルロックで保護する */
+	static FileTrackBufferNode* buffer_free[FT_BUFFER_CLASSES] = { NULL };
+	static size_t buffer_free_cnt[FT_BUFFER_CLASSES] = { 0 };
+	static size_t buffer_default_size = FT_BUFFER_POOL_DEFAULT_SIZE;
+	static FileTrackBufferPoolStats buffer_pool_stats = { 0 };
+
+	#ifdef __linux__
+		typedef struct FileTrackBufferSlab {
+			struct FileTrackBufferSlab* next;
+			void* addr;
+		} FileTrackBufferSlab;
+
+		static bool buffer_hugepages = false;
+		static FileTrackBufferSlab* buffer_slabs = NULL;  /* 先頭の領域から切り出している */
+		static size_t buffer_slab_used = 0;
+	#endif
 #endif
 
-	FileTrackEntry entry = {
-		.stream = stream
-#ifdef DEBUG
-		, 
-		.filename = filename_cpy,
-		.mode = mode_cpy,
-		.open_type = open_type,
-		.open_file = file,
-		.open_line = line,
-		.last_change_mode_file = NULL,
-		.last_change_mode_line = 0,
-		.is_closed = false,
-		.closed_type = FILE_NOT_CLOSED,
-		.close_file = NULL,
-		.close_line = 0
+#ifdef FILETRACK_ENABLE_GROUP_COMMIT
+	/* 呼び出し元のスタックに置かれ、まとめて同期されるのを待つ */
+	typedef struct FileTrackDurableJob {
+		struct FileTrackDurableJob* next;
+		FILE* stream;
+		const char* file;
+		int line;
+		int fd;  /* 同期に使う複製した記述子、同期するものがなければ -1 */
+		dev_t dev;
+		bool synced;
+		int sync_result;
+		int sync_errno;
+		int result;
+		int error;
+		bool done;  /* durable_mutex で保護する */
+	} FileTrackDurableJob;
+
+	static pthread_mutex_t durable_mutex = PTHREAD_MUTEX_INITIALIZER;
+	static pthread_cond_t durable_cond = PTHREAD_COND_INITIALIZER;
+	static FileTrackDurableJob* durable_head = NULL;
+	static FileTrackDurableJob* durable_tail = NULL;
+	static bool durable_committing = false;  /* あるスレッドが待ち行列をまとめて同期している */
+	static size_t durable_syncfs_min = 0;     /* 0 なら syncfs を使わない */
+
+	/* グローバルロックで保護する */
+	static FileTrackHist durable_hist;
+	static uint64_t durable_batches_cnt = 0;
+	static uint64_t durable_files_cnt = 0;
+	static uint64_t durable_sync_cnt = 0;
+	static uint64_t durable_largest_batch = 0;
 #endif
-	};
 
-	if (UNLIKELY(!mht_uint_set(filetrack_entries, (uint_keyt)stream, &entry, sizeof(FileTrackEntry)))) {
-		fprintf(stderr, "Failed to add entry to file tracking.\nFile: %s   Line: %d\n", file, line);
-		filetrack_errfunc = "filetrack_entry_add";
-#ifdef DEBUG
-		free(filename_cpy);
-		free(mode_cpy);
+#ifdef FILETRACK_ENABLE_MEMFD_TMPFILE
+	/* 開いている memfd の一時ファイル、レポート作成時に使用メモリを集計する */
+	typedef struct {
+		FileTrackSite* site;
+		int fd;
+	} FileTrackMemfd;
+
+	static FileTrackMemfd* memfds = NULL;
+	static size_t memfds_cnt = 0;
+	static size_t memfds_cap = 0;
+	static uint64_t memfd_ram_max = FT_MEMFD_RAM_MAX;
+	static uint64_t memfd_created_cnt = 0;
+	static uint64_t memfd_fallback_cnt = 0;  /* 上限を超えていたなどでディスクに作った回数 */
+	static int memfd_pending = -1;           /* 次に作るエントリに渡す記述子 */
 #endif
-		return;
-	}
 
-#ifdef DEBUG
-	/* tmpfile はファイル名不明なので記録しない */
-	if (strncmp(mode_cpy, "(tmpfile)", 10) == 0) return;
+#ifdef FILETRACK_ENABLE_TMPFILE_POOL
+	/* 補充用スレッドはグローバルロックを取らないので、この mutex だけで保護する */
+	static pthread_mutex_t tmpfile_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+	static pthread_cond_t tmpfile_pool_cond = PTHREAD_COND_INITIALIZER;
+	static pthread_t tmpfile_pool_thread;
+	static bool tmpfile_pool_running = false;
+	static bool tmpfile_pool_stopping = false;
+	static bool tmpfile_pool_recycle = false;
+	static size_t tmpfile_pool_target = 0;
+	static FILE* tmpfile_pool[FT_TMPFILE_POOL_MAX];
+	static size_t tmpfile_pool_cnt = 0;
+	static char* tmpfile_pool_dir = NULL;
+	static FileTrackTmpfilePoolStats tmpfile_pool_stats = { 0 };
+#endif
 
-	FilenameStreamEntry filename_stream_entry = {
-		.filename = filename_cpy,
-		.stream = stream
-	};
+#ifdef FILETRACK_ENABLE_NEGATIVE_CACHE
+	/* fopen が ENOENT で失敗したファイル名、キーは FileTrackNegativeEntry の path */
+	typedef struct {
+		char* path;
+		uint64_t expire_ns;  /* 0 なら無効化済み */
+	} FileTrackNegativeEntry;
 
-	if (UNLIKELY(!mht_str_set(filename_stream_entries, filename_cpy, &filename_stream_entry, sizeof(FilenameStreamEntry)))) {
-		filetrack_errfunc = "filetrack_entry_add";
-	}
+	static MHashTable* negative_entries = NULL;
+	static size_t negative_entries_cnt = 0;
+	static uint64_t negative_ttl_ns = (uint64_t)FT_NEGATIVE_CACHE_TTL_MS * 1000000u;
 #endif
-}
 
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+	/* 待ち行列の要素、待っているスレッドのスタックに置く */
+	typedef struct FileTrackAdmissionWaiter {
+		pthread_cond_t cond;
+		struct FileTrackAdmissionWaiter* next;
+	} FileTrackAdmissionWaiter;
+
+	/* 待っている間はグローバルロックを持たないので別のロックで守る (これを持ったままグローバルロックを取らない) */
+	static pthread_mutex_t admission_mutex = PTHREAD_MUTEX_INITIALIZER;
+	static FileTrackAdmissionWaiter* admission_head = NULL;
+	static FileTrackAdmissionWaiter* admission_tail = NULL;
+	static uint64_t admission_budget = 0;  /* 0 なら無効 */
+	static int64_t admission_timeout_ms = -1;
+	static uint64_t admission_used = 0;
+
+	/* 以下はグローバルロックで守る */
+	static bool admission_granted = false;  /* 次に作るエントリに枠を渡す */
+	static bool admission_keep = false;     /* freopen で閉じるエントリの枠を次のエントリに引き継ぐ */
+#endif
 
-/* 注意: filename == NULL で freopen を使った場合にのみ呼び出す */
-void filetrack_entry_update (FILE* stream, const char* filename, const char* mode, const char* file, int line) {
-	if (filename != NULL) {
-		fprintf(stderr, "filename must be NULL when updating mode with freopen!\nFile: %s   Line: %d\n", file, line);
-		filetrack_unlock();
-		exit(EXIT_FAILURE);
-	}
+#ifdef FILETRACK_ENABLE_NOFILE_ALARM
+	static FileTrackNofileAlarmFunc nofile_func = NULL;
+	static void* nofile_arg = NULL;
+	static unsigned int nofile_percents[FT_NOFILE_THRESHOLDS_MAX];  /* 昇順 */
+	static bool nofile_fired[FT_NOFILE_THRESHOLDS_MAX];
+	static size_t nofile_percents_cnt = 0;
+	static uint64_t nofile_trigger_cnt = UINT64_MAX;  /* これ以上になったら確認する */
+	static uint64_t nofile_rearm_cnt = 0;             /* これ未満になったら確認する */
+	static bool nofile_pending = false;               /* ロックを外した時に呼び出す通知がある */
+	static FileTrackNofileAlarm nofile_pending_alarm;
+#endif
 
-	if (stream == NULL) {
-		fprintf(stderr, "stream is null! File cannot be closed!\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_entry_update";
-		return;
-	}
 
-	if (UNLIKELY(filetrack_entries == NULL)) {
-		init();
+#define GLOBAL_LOCK_FUNC_NAME filetrack_lock
+#ifdef FILETRACK_ENABLE_NOFILE_ALARM
+	#define GLOBAL_UNLOCK_FUNC_NAME filetrack_unlock_raw  /* 通知はロックを外した後に呼び出す */
+	void filetrack_unlock_raw (void);
+#else
+	#define GLOBAL_UNLOCK_FUNC_NAME filetrack_unlock
+#endif
+#define GLOBAL_LOCK_FUNC_SCOPE 
 
-		fprintf(stderr, "No entry found to close! The file might not be tracked.\nFile: %s   Line: %d\n", file, line);
-		errno = EPERM;
-		filetrack_errfunc = "filetrack_entry_update";
+#include "global_lock.h"
 
-		filetrack_entry_add(stream, FILE_OPEN_UNKNOWN, "unknown", mode, 8, file, line);
+
+#ifdef FILETRACK_ENABLE_NOFILE_ALARM
+/* コールバックから filetrack の関数を呼べるように、ロックを外してから通知する */
+void filetrack_unlock (void) {
+	if (LIKELY(!nofile_pending)) {
+		filetrack_unlock_raw();
 		return;
 	}
 
-	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
-	if (entry == NULL) {
-		fprintf(stderr, "No entry found to close! The file might not be tracked.\nFile: %s   Line: %d\n", file, line);
-		filetrack_errfunc = "filetrack_entry_update";
+	FileTrackNofileAlarm alarm = nofile_pending_alarm;
+	FileTrackNofileAlarmFunc func = nofile_func;
+	void* arg = nofile_arg;
+	nofile_pending = false;
 
-		filetrack_entry_add(stream, FILE_OPEN_UNKNOWN, "unknown", mode, 8, file, line);
-		return;
-	}
+	filetrack_unlock_raw();
 
-#ifdef DEBUG
-	free(entry->mode);
+	if (func != NULL) func(&alarm, arg);
+}
+#endif
 
-	char* mode_cpy = mutils_strndup(mode, FT_MODE_LEN_MAX);
-	if (UNLIKELY(mode_cpy == NULL)) {
-		fprintf(stderr, "Failed to duplicate mode string.\nFile: %s   Line: %d\n", file, line);
-		filetrack_errfunc = "filetrack_entry_update";
-	}
 
-	entry->mode = mode_cpy;
-	entry->last_change_mode_file = file;
-	entry->last_change_mode_line = line;
+#if defined (FILETRACK_ENABLE_SHM_REGISTRY) || defined (FILETRACK_ENABLE_LATENCY_STATS) || defined (FT_POPEN_SUPPORTED) || defined (FILETRACK_ENABLE_ADMISSION_CONTROL) || defined (FILETRACK_ENABLE_ASYNC_CLOSE) || defined (FILETRACK_ENABLE_GROUP_COMMIT)
+/* Linux では vDSO 経由になるためシステムコールは発生しない */
+static uint64_t clock_ns (void) {
+	struct timespec ts;
+	if (UNLIKELY(clock_gettime(CLOCK_MONOTONIC, &ts) != 0)) return 0;
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+
+#if defined (FILETRACK_ENABLE_LIFETIME_STATS) || defined (FILETRACK_ENABLE_NEGATIVE_CACHE)
+/* 寿命や有効期限にはティック単位 (数ミリ秒) の分解能で十分なので、より安価な時計を使う */
+static uint64_t coarse_clock_ns (void) {
+	struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+	if (UNLIKELY(clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) != 0)) return 0;
+#else
+	if (UNLIKELY(clock_gettime(CLOCK_MONOTONIC, &ts) != 0)) return 0;
 #endif
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
 }
+#endif
 
 
-void filetrack_entry_close (FILE* stream, FileClosedType closed_type, const char* file, int line) {
-	if (stream == NULL) {
-		fprintf(stderr, "stream is null! File cannot be closed!\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_entry_close";
-		return;
-	}
+#ifdef FILETRACK_ENABLE_LIFETIME_STATS
+/* 開かれてからの経過時間 (us) */
+static uint64_t lifetime_us (uint64_t open_ns, uint64_t now_ns) {
+	return (now_ns > open_ns) ? (now_ns - open_ns) / 1000u : 0;
+}
+#endif
 
-	if (UNLIKELY(filetrack_entries == NULL)) {
-		init();
 
-		fprintf(stderr, "No entry found to close! The file might not be tracked.\nFile: %s   Line: %d\n", file, line);
-		errno = EPERM;
-		filetrack_errfunc = "filetrack_entry_close";
-		return;
-	}
+#ifdef FILETRACK_ENABLE_SHM_REGISTRY
+static FileTrackShmHeader* shm_header = NULL;
+static size_t shm_size = 0;
 
-	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
-	if (entry == NULL) {
-		fprintf(stderr, "No entry found to close! The file might not be tracked.\nFile: %s   Line: %d\n", file, line);
-		filetrack_errfunc = "filetrack_entry_close";
-		return;
-	}
+static uint32_t* shm_free_slots = NULL;
+static uint32_t shm_free_cnt = 0;
 
-#ifndef DEBUG
-	if (!mht_uint_delete(filetrack_entries, (uint_keyt)stream))
-		filetrack_errfunc = "filetrack_entry_close";
-#else
-	entry->is_closed = true;
-	entry->closed_type = closed_type;
-	entry->close_file = file;
-	entry->close_line = line;
-#endif
+static char shm_name[FT_SHM_NAME_LEN_MAX];
+static pid_t shm_owner_pid = 0;  /* 領域を作成したプロセス、これ以外は削除しない */
+static bool shm_forked = false;  /* fork した子プロセスでは親の領域に書き込まない */
+
+
+/* 切り詰めてでも必ずヌル終端させるコピー */
+static void shm_strcpy (char* dst, const char* src, size_t dst_size) {
+	if (src == NULL) src = "";
+	size_t len = mutils_strnlen(src, dst_size - 1);
+	memcpy(dst, src, len);
+	dst[len] = '\0';
 }
 
 
-static FILE* filetrack_fopen_without_lock (const char* filename, const char* mode, size_t filename_len_max, const char* file, int line) {
-	if (filename == NULL) {
-		fprintf(stderr, "No processing was done because the filename is NULL!\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_fopen";
-		return NULL;
-	}
+static void shm_atfork_child (void) {
+	shm_forked = true;  /* ロックの状態がわからないのでここでは印を付けるだけ */
+}
 
-	if (filename[0] == '\0') {
-		fprintf(stderr, "No processing was done because the filename is empty.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_fopen";
-		return NULL;
+
+/* 領域の解放のみを行い、削除はしない */
+static void shm_detach (void) {
+	munmap(shm_header, shm_size);
+	shm_header = NULL;
+
+	free(shm_free_slots);
+	shm_free_slots = NULL;
+	shm_free_cnt = 0;
+}
+
+
+/*
+ * fork した子プロセスであれば親の領域から切り離し、ミラーできるなら true を返す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static bool shm_attached (void) {
+	if (shm_header == NULL) return false;
+
+	if (UNLIKELY(shm_forked)) {
+		shm_detach();
+		return false;
 	}
+	return true;
+}
 
-	if (mode == NULL) {
-		fprintf(stderr, "No processing was done because the mode is NULL!\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_fopen";
-		return NULL;
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void shm_init (void) {
+	int name_len = snprintf(shm_name, sizeof(shm_name), FT_SHM_NAME_PREFIX "%ld", (long)getpid());
+	if (UNLIKELY(name_len < 0 || (size_t)name_len >= sizeof(shm_name))) {
+		fprintf(stderr, "Failed to build the shared-memory registry name.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+		filetrack_errfunc = "init";
+		return;
 	}
 
-	if (mode[0] == '\0') {
-		fprintf(stderr, "No processing was done because the mode is empty.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_fopen";
-		return NULL;
+	shm_size = sizeof(FileTrackShmHeader) + (size_t)FT_SHM_RECORDS_MAX * sizeof(FileTrackShmRecord);
+
+	int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0 && errno == EEXIST) {  /* 同じ pid で異常終了したプロセスの残骸 */
+		shm_unlink(shm_name);
+		fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	}
+	if (UNLIKELY(fd < 0)) {
+		fprintf(stderr, "Failed to create the shared-memory registry '%s'.\nFile: %s   Line: %d\n", shm_name, __FILE__, __LINE__);
+		filetrack_errfunc = "init";
+		return;
 	}
 
-	if (filename_len_max < 1) {
-		fprintf(stderr, "filename_len_max must be at least 1.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_fopen";
+	if (UNLIKELY(ftruncate(fd, (off_t)shm_size) != 0)) {
+		fprintf(stderr, "Failed to resize the shared-memory registry '%s'.\nFile: %s   Line: %d\n", shm_name, __FILE__, __LINE__);
+		filetrack_errfunc = "init";
+		close(fd);
+		shm_unlink(shm_name);
 		return;
 	}
 
-	char* filename_tmp = mutils_strndup(filename, filename_len_max);
-	if (filename_tmp == NULL) {
-		filetrack_errfunc = "filetrack_fopen";
-		return NULL;
+	void* addr = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);  /* マッピングが残るので記述子は不要 */
+	if (UNLIKELY(addr == MAP_FAILED)) {
+		fprintf(stderr, "Failed to map the shared-memory registry '%s'.\nFile: %s   Line: %d\n", shm_name, __FILE__, __LINE__);
+		filetrack_errfunc = "init";
+		shm_unlink(shm_name);
+		return;
 	}
 
-	char* mode_tmp = mutils_strndup(mode, FT_MODE_LEN_MAX);
-	if (mode_tmp == NULL) {
-		free(filename_tmp);
-		filetrack_errfunc = "filetrack_fopen";
-		return NULL;
+	shm_free_slots = malloc(sizeof(uint32_t) * FT_SHM_RECORDS_MAX);
+	if (UNLIKELY(shm_free_slots == NULL)) {
+		fprintf(stderr, "Failed to allocate the shared-memory registry slots.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+		filetrack_errfunc = "init";
+		munmap(addr, shm_size);
+		shm_unlink(shm_name);
+		return;
 	}
 
-	FILE* stream = fopen(filename_tmp, mode_tmp);
+	/* 小さい番号のスロットから使われるように逆順に積む */
+	for (uint32_t i = 0; i < FT_SHM_RECORDS_MAX; i++)
+		shm_free_slots[i] = FT_SHM_RECORDS_MAX - 1 - i;
+	shm_free_cnt = FT_SHM_RECORDS_MAX;
 
-	free(filename_tmp);  /* ヌル終端を保証するためだけなのですぐに解放 */
-	free(mode_tmp);
+	shm_header = (FileTrackShmHeader*)addr;  /* ftruncate により 0 で初期化済み */
+	shm_header->version = FT_SHM_VERSION;
+	shm_header->record_size = (uint32_t)sizeof(FileTrackShmRecord);
+	shm_header->capacity = FT_SHM_RECORDS_MAX;
+	shm_header->pid = (int64_t)getpid();
+	shm_owner_pid = getpid();
 
-	if (UNLIKELY(stream == NULL)) {
-		fprintf(stderr, "Failed to open file '%s' with mode '%s'.\nFile: %s   Line: %d\n", filename, mode, file, line);
-		filetrack_errfunc = "filetrack_fopen";
-	} else {
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		int tmp_errno = errno;
-#endif
-		errno = 0;
+	if (UNLIKELY(pthread_atfork(NULL, NULL, shm_atfork_child) != 0))
+		filetrack_errfunc = "init";  /* 終了時の pid の比較で削除だけは防げる */
 
-		filetrack_entry_add(stream, FILE_OPEN_FOPEN, filename, mode, filename_len_max, file, line);
+	atomic_store_explicit(&shm_header->magic, FT_SHM_MAGIC, memory_order_release);
+}
 
-		if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_fopen";
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		else errno = tmp_errno;
-#endif
-	}
-	return stream;
+
+static void shm_write_begin (FileTrackShmRecord* record) {
+	uint32_t seq = atomic_load_explicit(&record->seq, memory_order_relaxed);
+	atomic_store_explicit(&record->seq, seq + 1, memory_order_relaxed);  /* 奇数: 書き込み中 */
+	atomic_thread_fence(memory_order_release);
 }
 
 
-FILE* filetrack_fopen (const char* filename, const char* mode, size_t filename_len_max, const char* file, int line) {
-	filetrack_lock();
-	FILE* stream = filetrack_fopen_without_lock(filename, mode, filename_len_max, file, line);
-	filetrack_unlock();
-	return stream;
+static void shm_write_end (FileTrackShmRecord* record) {
+	uint32_t seq = atomic_load_explicit(&record->seq, memory_order_relaxed);
+	atomic_store_explicit(&record->seq, seq + 1, memory_order_release);
 }
 
 
-static FILE* filetrack_tmpfile_without_lock (const char* file, int line) {
-	FILE* stream = tmpfile();
-	if (UNLIKELY(stream == NULL)) {
-		fprintf(stderr, "Failed to create a temporary file.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_tmpfile";
-	} else {
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		int tmp_errno = errno;
-#endif
-		errno = 0;
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static uint32_t shm_record_open (FILE* stream, FileOpenType open_type, const char* filename, const char* mode, const char* file, int line) {
+	if (!shm_attached()) return FT_SHM_NO_SLOT;
 
-		filetrack_entry_add(stream, FILE_OPEN_TMPFILE, "unknown", "(tmpfile)", 8, file, line);
+	atomic_fetch_add_explicit(&shm_header->total_count, 1, memory_order_relaxed);
 
-		if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_tmpfile";
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		else errno = tmp_errno;
-#endif
+	if (UNLIKELY(shm_free_cnt == 0)) {  /* 満杯の場合はミラーを諦める */
+		atomic_fetch_add_explicit(&shm_header->dropped_count, 1, memory_order_relaxed);
+		return FT_SHM_NO_SLOT;
 	}
-	return stream;
+
+	uint32_t slot = shm_free_slots[--shm_free_cnt];
+	FileTrackShmRecord* record = &shm_header->records[slot];
+
+	shm_write_begin(record);
+	record->data.stream = (uint64_t)(uintptr_t)stream;
+	record->data.open_ns = clock_ns();
+	record->data.open_line = (int32_t)line;
+	record->data.in_use = 1;
+	shm_strcpy(record->data.open_type, ((unsigned int)open_type <= FILE_OPEN_UNKNOWN) ? FileOpenTypeNames[open_type] : "unknown", FT_SHM_TYPE_LEN);
+	shm_strcpy(record->data.mode, mode, FT_SHM_MODE_LEN);
+	shm_strcpy(record->data.open_file, file, FT_SHM_SITE_LEN);
+	shm_strcpy(record->data.filename, filename, FT_SHM_FILENAME_LEN);
+	shm_write_end(record);
+
+	uint64_t live = atomic_fetch_add_explicit(&shm_header->live_count, 1, memory_order_relaxed) + 1;
+	if (live > atomic_load_explicit(&shm_header->peak_count, memory_order_relaxed))
+		atomic_store_explicit(&shm_header->peak_count, live, memory_order_relaxed);
+
+	return slot;
 }
 
 
-FILE* filetrack_tmpfile (const char* file, int line) {
-	filetrack_lock();
-	FILE* stream = filetrack_tmpfile_without_lock(file, line);
-	filetrack_unlock();
-	return stream;
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void shm_record_update_mode (uint32_t slot, const char* mode) {
+	if (slot == FT_SHM_NO_SLOT || !shm_attached()) return;
+
+	FileTrackShmRecord* record = &shm_header->records[slot];
+
+	shm_write_begin(record);
+	shm_strcpy(record->data.mode, mode, FT_SHM_MODE_LEN);
+	shm_write_end(record);
 }
 
 
-static FILE* filetrack_freopen_without_lock (const char* filename, const char* mode, FILE* stream, size_t filename_len_max, const char* file, int line) {
-	if (filename != NULL && filename[0] == '\0') {
-		fprintf(stderr, "No processing was done because the filename is empty.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_freopen";
-		return NULL;
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void shm_record_close (uint32_t slot) {
+	if (slot == FT_SHM_NO_SLOT || !shm_attached()) return;
+
+	FileTrackShmRecord* record = &shm_header->records[slot];
+
+	shm_write_begin(record);
+	record->data.in_use = 0;
+	shm_write_end(record);
+
+	atomic_fetch_sub_explicit(&shm_header->live_count, 1, memory_order_relaxed);
+	shm_free_slots[shm_free_cnt++] = slot;
+}
+
+
+static void shm_quit (void) {
+	if (!shm_attached()) return;
+
+	shm_detach();
+	if (UNLIKELY(getpid() != shm_owner_pid)) return;  /* pthread_atfork を通らずに作られた子プロセスも親の領域を削除しない */
+
+	if (UNLIKELY(shm_unlink(shm_name) != 0))
+		filetrack_errfunc = "quit";
+}
+#endif
+
+
+static void quit (void);
+
+#if defined (FILETRACK_ENABLE_IO_STATS) && defined (FILETRACK_ENABLE_COOKIE_ENGINE)
+	static FileTrackEntry* cookie_entry_find (const FILE* stream);
+#endif
+
+
+static uint_keyt site_hash (const char* file, int line) {
+	uint64_t hash = 14695981039346656037u;  /* FNV-1a */
+	for (const char* p = file; *p != '\0'; p++) {
+		hash ^= (unsigned char)*p;
+		hash *= 1099511628211u;
 	}
+	hash ^= (uint64_t)(unsigned int)line;
+	hash *= 1099511628211u;
+	return (uint_keyt)hash;
+}
 
-	if (mode == NULL) {
-		fprintf(stderr, "No processing was done because the mode is NULL!\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_freopen";
-		return NULL;
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static FileTrackSite* site_find (FileTrackSite* const* head, const char* file, int line) {
+	if (head == NULL) return NULL;
+
+	for (FileTrackSite* site = *head; site != NULL; site = site->hash_next) {
+		if (site->line == line && (site->file == file || strcmp(site->file, file) == 0))
+			return site;
 	}
+	return NULL;
+}
 
-	if (mode[0] == '\0') {
-		fprintf(stderr, "No processing was done because the mode is empty.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_freopen";
+
+/*
+ * 呼び出し元の統計を取得し、なければ作成する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static FileTrackSite* site_get (const char* file, int line) {
+	if (UNLIKELY(file == NULL || filetrack_sites == NULL)) return NULL;
+
+	uint_keyt key = site_hash(file, line);
+
+	FileTrackSite** head = mht_uint_get(filetrack_sites, key);
+	FileTrackSite* found = site_find(head, file, line);
+	if (found != NULL) return found;
+
+	FileTrackSite* site = calloc(1, sizeof(FileTrackSite));
+	if (UNLIKELY(site == NULL)) return NULL;
+
+	site->file = file;
+	site->line = line;
+
+	if (head != NULL) {  /* ハッシュ値の衝突 */
+		site->hash_next = *head;
+		*head = site;
+	} else if (UNLIKELY(!mht_uint_set(filetrack_sites, key, &site, sizeof(FileTrackSite*)))) {
+		free(site);
 		return NULL;
 	}
 
-	if (stream == NULL) {
-		fprintf(stderr, "No processing was done because the stream is NULL!\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_freopen";
-		return NULL;
+	site->next = filetrack_sites_list;
+	filetrack_sites_list = site;
+	return site;
+}
+
+
+static void sites_quit (void) {
+	FileTrackSite* site = filetrack_sites_list;
+	while (site != NULL) {
+		FileTrackSite* next = site->next;
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+		for (size_t i = 0; i < FT_LATENCY_OP_COUNT; i++)
+			free(site->latency[i]);
+#endif
+#ifdef FILETRACK_ENABLE_LIFETIME_STATS
+		free(site->lifetime);
+#endif
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+		free(site->admission_wait);
+#endif
+#ifdef FILETRACK_ENABLE_ASYNC_CLOSE
+		free(site->async_close);
+#endif
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+		free(site->write_profile);
+#endif
+		free(site);
+		site = next;
 	}
+	filetrack_sites_list = NULL;
 
-	if (filename_len_max < 1) {
-		fprintf(stderr, "filename_len_max must be at least 1.\nFile: %s   Line: %d\n", file, line);
+	if (filetrack_sites != NULL) {
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		int tmp_errno = errno;
+#endif
+		errno = 0;
+
+		mht_destroy(filetrack_sites);
+
+		if (UNLIKELY(errno != 0)) filetrack_errfunc = "quit";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		else errno = tmp_errno;
+#endif
+		filetrack_sites = NULL;
+	}
+}
+
+
+
+#ifdef FILETRACK_ENABLE_NOFILE_ALARM
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static uint64_t site_handles_live (const FileTrackSite* site) {
+	uint64_t cnt = site->live_cnt;
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	cnt += site->fd_live_cnt;
+#endif
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+	cnt += site->dir_live_cnt;
+#endif
+	return cnt;
+}
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static uint64_t handles_live (void) {
+	uint64_t cnt = stream_live_cnt;
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	cnt += fd_live_total;
+#endif
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+	cnt += dir_live_total;
+#endif
+	return cnt;
+}
+
+
+/*
+ * 開いたままのものが多い呼び出し元を上位 FT_NOFILE_TOP_SITES 個まで集める
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void nofile_top_sites_get (FileTrackNofileAlarm* alarm) {
+	alarm->top_sites_cnt = 0;
+
+	for (const FileTrackSite* site = filetrack_sites_list; site != NULL; site = site->next) {
+		uint64_t cnt = site_handles_live(site);
+		if (cnt == 0) continue;
+
+		size_t i = alarm->top_sites_cnt;
+		if (i == FT_NOFILE_TOP_SITES) {
+			if (cnt <= alarm->top_sites[i - 1].open_cnt) continue;
+			i--;  /* 最下位を押し出す */
+		} else {
+			alarm->top_sites_cnt++;
+		}
+
+		for (; i > 0 && alarm->top_sites[i - 1].open_cnt < cnt; i--)
+			alarm->top_sites[i] = alarm->top_sites[i - 1];
+
+		alarm->top_sites[i] = (FileTrackSiteUsage){
+			.file = site->file,
+			.line = site->line,
+			.open_cnt = cnt
+		};
+	}
+}
+
+
+/*
+ * 上限を読み直して閾値を越えたか確かめ、次に確認する開いている数を決め直す
+ * 越えていれば通知を溜めておき、filetrack_unlock でロックを外した後に呼び出す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void nofile_update (uint64_t open_cnt) {
+	nofile_trigger_cnt = UINT64_MAX;
+	nofile_rearm_cnt = 0;
+	if (nofile_func == NULL) return;
+
+	int tmp_errno = errno;
+	struct rlimit rlim;
+	bool has_limit = (getrlimit(RLIMIT_NOFILE, &rlim) == 0 && rlim.rlim_cur != RLIM_INFINITY);
+	errno = tmp_errno;
+	if (!has_limit) return;
+
+	uint64_t limit = (uint64_t)rlim.rlim_cur;
+	size_t crossed = SIZE_MAX;
+
+	for (size_t i = 0; i < nofile_percents_cnt; i++) {
+		uint64_t threshold_cnt = limit * nofile_percents[i] / 100u;
+		uint64_t hysteresis_cnt = limit * FT_NOFILE_HYSTERESIS_PERCENT / 100u;
+		uint64_t rearm_cnt = (threshold_cnt > hysteresis_cnt) ? threshold_cnt - hysteresis_cnt : 0;
+
+		if (nofile_fired[i] && open_cnt < rearm_cnt)
+			nofile_fired[i] = false;
+
+		if (!nofile_fired[i] && open_cnt >= threshold_cnt) {
+			nofile_fired[i] = true;
+			crossed = i;
+		}
+
+		if (nofile_fired[i]) {
+			if (rearm_cnt > nofile_rearm_cnt) nofile_rearm_cnt = rearm_cnt;
+		} else {
+			if (threshold_cnt < nofile_trigger_cnt) nofile_trigger_cnt = threshold_cnt;
+		}
+	}
+
+	if (crossed == SIZE_MAX) return;
+
+	FileTrackNofileAlarm alarm = {
+		.open_cnt = open_cnt,
+		.limit = limit,
+		.threshold_percent = nofile_percents[crossed]
+	};
+	nofile_top_sites_get(&alarm);
+
+	/* ロックを外す前に再び越えた場合は、より高い閾値の通知で上書きする */
+	if (!nofile_pending || alarm.threshold_percent >= nofile_pending_alarm.threshold_percent)
+		nofile_pending_alarm = alarm;
+	nofile_pending = true;
+}
+
+
+/*
+ * 何かを開いた後に呼び出す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static inline void nofile_check (void) {
+	uint64_t open_cnt = handles_live();
+	if (UNLIKELY(open_cnt >= nofile_trigger_cnt || open_cnt < nofile_rearm_cnt))
+		nofile_update(open_cnt);
+}
+
+
+bool filetrack_nofile_alarm_set (FileTrackNofileAlarmFunc func, void* arg, const unsigned int* percents, size_t percents_cnt) {
+	static const unsigned int default_percents[] = { 80, 95 };
+	if (percents == NULL) {
+		percents = default_percents;
+		percents_cnt = sizeof(default_percents) / sizeof(default_percents[0]);
+	}
+
+	if (percents_cnt > FT_NOFILE_THRESHOLDS_MAX) {
 		errno = EINVAL;
-		filetrack_errfunc = "filetrack_freopen";
-		return;
+		filetrack_errfunc = "filetrack_nofile_alarm_set";
+		return false;
 	}
 
-	char* filename_tmp = mutils_strndup(filename, filename_len_max);
-	if (filename_tmp == NULL) {
-		filetrack_errfunc = "filetrack_freopen";
-		return NULL;
+	for (size_t i = 0; i < percents_cnt; i++) {
+		if (percents[i] < 1 || percents[i] > 100) {
+			errno = EINVAL;
+			filetrack_errfunc = "filetrack_nofile_alarm_set";
+			return false;
+		}
 	}
 
-	char* mode_tmp = mutils_strndup(mode, FT_MODE_LEN_MAX);
-	if (mode_tmp == NULL) {
-		free(filename_tmp);
-		filetrack_errfunc = "filetrack_freopen";
-		return NULL;
+	filetrack_lock();
+
+	nofile_func = func;
+	nofile_arg = arg;
+	nofile_percents_cnt = percents_cnt;
+
+	/* 挿入ソートで昇順に並べる */
+	for (size_t i = 0; i < percents_cnt; i++) {
+		size_t j = i;
+		for (; j > 0 && nofile_percents[j - 1] > percents[i]; j--)
+			nofile_percents[j] = nofile_percents[j - 1];
+		nofile_percents[j] = percents[i];
 	}
+	memset(nofile_fired, 0, sizeof(nofile_fired));
+	nofile_pending = false;  /* 前の設定で溜まった通知は呼び出さない */
 
-	FILE* new_stream = freopen(filename_tmp, mode_tmp, stream);
+	nofile_update(handles_live());  /* 既に越えている閾値はここで通知する */
 
-	free(filename_tmp);  /* ヌル終端を保証するためだけなのですぐに解放 */
-	free(mode_tmp);
+	filetrack_unlock();
+	return true;
+}
+#endif
 
-	if (UNLIKELY(new_stream == NULL)) {
-		fprintf(stderr, "Failed to reopen file '%s' with mode '%s'.\nFile: %s   Line: %d\n", filename, mode, file, line);
-		filetrack_errfunc = "filetrack_freopen";
-		filetrack_entry_close(stream, FILE_CLOSED_FREOPEN, file, line);
-		return NULL;
+
+#if defined (FILETRACK_ENABLE_LATENCY_STATS) || defined (FILETRACK_ENABLE_LIFETIME_STATS) || defined (FILETRACK_ENABLE_ADMISSION_CONTROL) || defined (FILETRACK_ENABLE_ASYNC_CLOSE) || defined (FILETRACK_ENABLE_GROUP_COMMIT)
+static size_t hist_index (uint64_t value) {
+	if (value < FT_HIST_SUB_COUNT) return (size_t)value;
+	if (value >= ((uint64_t)1 << FT_HIST_MAX_BITS)) value = ((uint64_t)1 << FT_HIST_MAX_BITS) - 1;
+
+	unsigned int msb = 0;
+#if defined (__GNUC__) || defined (__clang__)
+	msb = 63u - (unsigned int)__builtin_clzll((unsigned long long)value);
+#else
+	for (uint64_t tmp = value >> 1; tmp != 0; tmp >>= 1) msb++;
+#endif
+
+	unsigned int shift = msb - FT_HIST_SUB_BITS;
+	return (size_t)shift * FT_HIST_SUB_COUNT + (size_t)(value >> shift);  /* value >> shift は [SUB_COUNT, 2 * SUB_COUNT) */
+}
+
+
+/* 区間に入る最大の値 */
+static uint64_t hist_bucket_max (size_t index) {
+	if (index < FT_HIST_SUB_COUNT) return (uint64_t)index;
+
+	unsigned int shift = (unsigned int)(index / FT_HIST_SUB_COUNT) - 1;
+	uint64_t mantissa = (uint64_t)(index - (size_t)shift * FT_HIST_SUB_COUNT);
+	return ((mantissa + 1) << shift) - 1;
+}
+
+
+static void hist_record (FileTrackHist* hist, uint64_t value) {
+	hist->buckets[hist_index(value)]++;
+	hist->count++;
+	if (value > hist->max) hist->max = value;
+}
+
+
+/* permille は 0 から 1000 まで (p99 なら 990) */
+static uint64_t hist_percentile (const FileTrackHist* hist, unsigned int permille) {
+	if (hist->count == 0) return 0;
+
+	uint64_t rank = (hist->count * permille + 999u) / 1000u;
+	if (rank < 1) rank = 1;
+	if (rank > hist->count) rank = hist->count;
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < FT_HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank) {
+			uint64_t value = hist_bucket_max(i);
+			return (value < hist->max) ? value : hist->max;
+		}
 	}
+	return hist->max;
+}
+#endif
 
-	if (stream == stdin || stream == stdout || stream == stderr)
-		return new_stream;   /* 標準ストリームは管理対象外 */
 
-	if (filename == NULL) {  /* モード変更の場合 */
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		int tmp_errno = errno;
+#if defined (FILETRACK_ENABLE_IO_STATS) || defined (FILETRACK_ENABLE_COOKIE_ENGINE)
+static void io_stats_add (FileTrackIoStats* dst, const FileTrackIoStats* src) {
+	dst->bytes_read += src->bytes_read;
+	dst->bytes_written += src->bytes_written;
+	dst->read_calls += src->read_calls;
+	dst->write_calls += src->write_calls;
+	dst->flush_calls += src->flush_calls;
+	dst->seek_calls += src->seek_calls;
+}
 #endif
-		errno = 0;
 
-		filetrack_entry_update(new_stream, filename, mode, file, line);
 
-		if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_freopen";
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		else errno = tmp_errno;
+#ifdef FILETRACK_ENABLE_IO_STATS
+typedef enum {
+	FT_IO_READ,
+	FT_IO_WRITE,
+	FT_IO_FLUSH,
+	FT_IO_SEEK,
+	FT_IO_KIND_COUNT
+} FileTrackIoKind;
+
+
+/*
+ * スレッドごとのカウンタ
+ * 所有スレッドはロックせずに加算し、他のスレッドはロック中に交換で回収する
+ * 所有スレッドが別のストリームにスロットを譲る時は、カウンタを FileTrackIoSpill に移して手放す
+ */
+typedef struct {
+	_Atomic(FILE*) stream;
+	_Atomic uint64_t calls[FT_IO_KIND_COUNT];
+	_Atomic uint64_t bytes[2];  /* FT_IO_READ と FT_IO_WRITE のみ */
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+	_Atomic uint64_t unflushed;  /* 最後に書き出してから書かれたバイト数 */
+	_Atomic uint64_t write_sizes[FT_SIZE_BUCKETS];
+	_Atomic uint64_t flush_sizes[FT_SIZE_BUCKETS];
+#endif
+#ifdef FILETRACK_ENABLE_FADVISE
+	_Atomic uint64_t far_seeks;
+#endif
+} FileTrackIoSlot;
+
+
+typedef struct FileTrackIoThread {
+	FileTrackIoSlot slots[FT_IO_STATS_SLOTS];
+	struct FileTrackIoThread* next;
+	bool in_use;
+} FileTrackIoThread;
+
+
+/* 追い出されたスロットの中身、次に回収する時にエントリへ加える */
+typedef struct FileTrackIoSpill {
+	struct FileTrackIoSpill* next;
+	FileTrackIoSlot slot;
+} FileTrackIoSpill;
+
+
+/* 終了したスレッドの分も再利用のため残し、終了処理の後も書き込まれうるので解放しない */
+static FileTrackIoThread* io_threads = NULL;
+
+static _Atomic(FileTrackIoSpill*) io_spills = NULL;  /* ロックせずに積み、ロック中にまとめて取り出す */
+static _Atomic bool io_stopped = false;  /* 終了処理の後は数えない */
+
+static THREAD_LOCAL FileTrackIoThread* io_thread = NULL;
+
+static pthread_key_t io_thread_key;
+static pthread_once_t io_thread_key_once = PTHREAD_ONCE_INIT;
+static bool io_thread_key_created = false;
+
+
+static size_t io_slot_index (const FILE* stream) {
+	uintptr_t addr = (uintptr_t)stream;
+	return (size_t)((addr >> 4) ^ (addr >> 12)) & (FT_IO_STATS_SLOTS - 1);
+}
+
+
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+static size_t size_bucket (uint64_t value) {
+	if (value <= 1) return 0;
+
+	unsigned int msb = 0;
+#if defined (__GNUC__) || defined (__clang__)
+	msb = 63u - (unsigned int)__builtin_clzll((unsigned long long)value);
+#else
+	for (uint64_t tmp = value >> 1; tmp != 0; tmp >>= 1) msb++;
+#endif
+	return (msb < FT_SIZE_BUCKETS) ? (size_t)msb : FT_SIZE_BUCKETS - 1;
+}
+#endif
+
+
+#if defined (FILETRACK_ENABLE_WRITE_ADVISOR) || defined (FILETRACK_ENABLE_FADVISE)
+/*
+ * スロットの分布などを 0 にしながらエントリに加算する
+ * release なら、まだ書き出されていない分もエントリに移す (スロットを明け渡す、または閉じる場合)
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void io_slot_drain_entry (FileTrackIoSlot* slot, FileTrackEntry* entry, bool release) {
+#ifdef FILETRACK_ENABLE_FADVISE
+	uint64_t far_seeks = atomic_exchange_explicit(&slot->far_seeks, 0, memory_order_relaxed);
+	if (entry != NULL) entry->far_seek_cnt += far_seeks;
+#endif
+
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+	uint64_t write_sizes[FT_SIZE_BUCKETS];
+	uint64_t flush_sizes[FT_SIZE_BUCKETS];
+	bool any = false;
+	for (size_t i = 0; i < FT_SIZE_BUCKETS; i++) {
+		write_sizes[i] = atomic_exchange_explicit(&slot->write_sizes[i], 0, memory_order_relaxed);
+		flush_sizes[i] = atomic_exchange_explicit(&slot->flush_sizes[i], 0, memory_order_relaxed);
+		if (write_sizes[i] != 0 || flush_sizes[i] != 0) any = true;
+	}
+	uint64_t unflushed = release ? atomic_exchange_explicit(&slot->unflushed, 0, memory_order_relaxed) : 0;
+	if (unflushed != 0) any = true;
+
+	if (entry == NULL || !any) return;
+
+	if (entry->write_profile == NULL) {
+		entry->write_profile = calloc(1, sizeof(FileTrackWriteProfile));
+		if (UNLIKELY(entry->write_profile == NULL)) return;  /* 分析に加えられないだけ */
+	}
+
+	FileTrackWriteProfile* profile = entry->write_profile;
+	for (size_t i = 0; i < FT_SIZE_BUCKETS; i++) {
+		profile->write_sizes[i] += write_sizes[i];
+		profile->flush_sizes[i] += flush_sizes[i];
+	}
+	profile->pending += unflushed;
+#else
+	(void)release;
+#endif
+}
+#endif
+
+
+/* スロットのカウンタを 0 にしながら stats に加算する */
+static void io_slot_drain (FileTrackIoSlot* slot, FileTrackIoStats* stats) {
+	uint64_t read_calls = atomic_exchange_explicit(&slot->calls[FT_IO_READ], 0, memory_order_relaxed);
+	uint64_t write_calls = atomic_exchange_explicit(&slot->calls[FT_IO_WRITE], 0, memory_order_relaxed);
+	uint64_t flush_calls = atomic_exchange_explicit(&slot->calls[FT_IO_FLUSH], 0, memory_order_relaxed);
+	uint64_t seek_calls = atomic_exchange_explicit(&slot->calls[FT_IO_SEEK], 0, memory_order_relaxed);
+	uint64_t bytes_read = atomic_exchange_explicit(&slot->bytes[FT_IO_READ], 0, memory_order_relaxed);
+	uint64_t bytes_written = atomic_exchange_explicit(&slot->bytes[FT_IO_WRITE], 0, memory_order_relaxed);
+
+	if (stats == NULL) return;
+
+	stats->read_calls += read_calls;
+	stats->write_calls += write_calls;
+	stats->flush_calls += flush_calls;
+	stats->seek_calls += seek_calls;
+	stats->bytes_read += bytes_read;
+	stats->bytes_written += bytes_written;
+}
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void io_slot_flush (FileTrackIoSlot* slot) {
+	FILE* stream = atomic_load_explicit(&slot->stream, memory_order_relaxed);
+
+	FileTrackEntry* entry = NULL;
+	if (stream != NULL && filetrack_entries != NULL)
+		entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+#ifdef DEBUG
+	if (entry != NULL && entry->is_closed) entry = NULL;
+#endif
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	if (entry == NULL && stream != NULL)
+		entry = cookie_entry_find(stream);  /* cookie のストリームのエントリは表に置かれていない */
+#endif
+
+	io_slot_drain(slot, (entry != NULL) ? &entry->io : NULL);
+#if defined (FILETRACK_ENABLE_WRITE_ADVISOR) || defined (FILETRACK_ENABLE_FADVISE)
+	io_slot_drain_entry(slot, entry, true);
+#endif
+	atomic_store_explicit(&slot->stream, NULL, memory_order_relaxed);
+}
+
+
+/*
+ * 追い出されたスロットの中身をそれぞれのエントリに加える
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void io_spills_drain (void) {
+	FileTrackIoSpill* spill = atomic_exchange_explicit(&io_spills, NULL, memory_order_acquire);
+	while (spill != NULL) {
+		FileTrackIoSpill* next = spill->next;
+		io_slot_flush(&spill->slot);
+		free(spill);
+		spill = next;
+	}
+}
+
+
+/*
+ * 全スレッドのスロットに残っている stream の分を entry に回収する、entry が NULL なら捨てる
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void io_collect (FILE* stream, FileTrackEntry* entry, bool release) {
+	io_spills_drain();
+
+	size_t index = io_slot_index(stream);
+	for (FileTrackIoThread* thread = io_threads; thread != NULL; thread = thread->next) {
+		FileTrackIoSlot* slot = &thread->slots[index];
+		if (atomic_load_explicit(&slot->stream, memory_order_relaxed) != stream) continue;
+
+		io_slot_drain(slot, (entry != NULL) ? &entry->io : NULL);
+#if defined (FILETRACK_ENABLE_WRITE_ADVISOR) || defined (FILETRACK_ENABLE_FADVISE)
+		io_slot_drain_entry(slot, entry, release);
+#endif
+		if (release) atomic_store_explicit(&slot->stream, NULL, memory_order_relaxed);
+	}
+}
+
+
+/* スレッド終了時に呼ばれ、カウンタを回収してスロットを再利用可能にする */
+static void io_thread_detach (void* arg) {
+	FileTrackIoThread* thread = (FileTrackIoThread*)arg;
+
+	filetrack_lock();
+	for (size_t i = 0; i < FT_IO_STATS_SLOTS; i++)
+		io_slot_flush(&thread->slots[i]);
+	thread->in_use = false;
+	filetrack_unlock();
+}
+
+
+static void io_thread_key_create (void) {
+	io_thread_key_created = (pthread_key_create(&io_thread_key, io_thread_detach) == 0);
+}
+
+
+static FileTrackIoThread* io_thread_attach (void) {
+	if (UNLIKELY(pthread_once(&io_thread_key_once, io_thread_key_create) != 0 || !io_thread_key_created))
+		return NULL;
+
+	filetrack_lock();
+
+	FileTrackIoThread* thread = io_threads;
+	while (thread != NULL && thread->in_use)
+		thread = thread->next;
+
+	if (thread == NULL) {
+		thread = calloc(1, sizeof(FileTrackIoThread));
+		if (UNLIKELY(thread == NULL)) {
+			filetrack_unlock();
+			return NULL;
+		}
+		thread->next = io_threads;
+		io_threads = thread;
+	}
+	thread->in_use = true;
+
+	filetrack_unlock();
+
+	if (UNLIKELY(pthread_setspecific(io_thread_key, thread) != 0)) {
+		filetrack_lock();
+		thread->in_use = false;
+		filetrack_unlock();
+		return NULL;
+	}
+
+	io_thread = thread;
+	return thread;
+}
+
+
+/* 所有スレッドがスロットの中身を移して手放す、ロックは使わない */
+static void io_slot_spill (FileTrackIoSlot* slot) {
+	FileTrackIoSpill* spill = malloc(sizeof(FileTrackIoSpill));
+	if (UNLIKELY(spill == NULL)) {  /* 移せなければロックして回収する */
+		filetrack_lock();
+		io_slot_flush(slot);
+		filetrack_unlock();
+		return;
+	}
+
+	FileTrackIoSlot* dst = &spill->slot;
+	atomic_init(&dst->stream, atomic_load_explicit(&slot->stream, memory_order_relaxed));
+	for (size_t i = 0; i < FT_IO_KIND_COUNT; i++)
+		atomic_init(&dst->calls[i], atomic_exchange_explicit(&slot->calls[i], 0, memory_order_relaxed));
+	for (size_t i = 0; i < 2; i++)
+		atomic_init(&dst->bytes[i], atomic_exchange_explicit(&slot->bytes[i], 0, memory_order_relaxed));
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+	atomic_init(&dst->unflushed, atomic_exchange_explicit(&slot->unflushed, 0, memory_order_relaxed));
+	for (size_t i = 0; i < FT_SIZE_BUCKETS; i++) {
+		atomic_init(&dst->write_sizes[i], atomic_exchange_explicit(&slot->write_sizes[i], 0, memory_order_relaxed));
+		atomic_init(&dst->flush_sizes[i], atomic_exchange_explicit(&slot->flush_sizes[i], 0, memory_order_relaxed));
+	}
+#endif
+#ifdef FILETRACK_ENABLE_FADVISE
+	atomic_init(&dst->far_seeks, atomic_exchange_explicit(&slot->far_seeks, 0, memory_order_relaxed));
+#endif
+
+	spill->next = atomic_load_explicit(&io_spills, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(&io_spills, &spill->next, spill, memory_order_release, memory_order_relaxed));
+}
+
+
+static void io_count (FILE* stream, FileTrackIoKind kind, uint64_t bytes) {
+	if (stream == NULL || stream == stdin || stream == stdout || stream == stderr) return;
+	if (UNLIKELY(atomic_load_explicit(&io_stopped, memory_order_relaxed))) return;
+
+	FileTrackIoThread* thread = io_thread;
+	if (UNLIKELY(thread == NULL)) {
+		thread = io_thread_attach();
+		if (UNLIKELY(thread == NULL)) return;
+	}
+
+	FileTrackIoSlot* slot = &thread->slots[io_slot_index(stream)];
+	FILE* owner = atomic_load_explicit(&slot->stream, memory_order_relaxed);
+	if (UNLIKELY(owner != stream)) {
+		if (owner != NULL) {  /* 別のストリームが使っていたスロットを明け渡してもらう */
+			io_slot_spill(slot);
+		} else {              /* 閉じる処理と競合した場合の残りを捨てる */
+			io_slot_drain(slot, NULL);
+#if defined (FILETRACK_ENABLE_WRITE_ADVISOR) || defined (FILETRACK_ENABLE_FADVISE)
+			io_slot_drain_entry(slot, NULL, true);
+#endif
+		}
+		atomic_store_explicit(&slot->stream, stream, memory_order_relaxed);
+	}
+
+	atomic_fetch_add_explicit(&slot->calls[kind], 1, memory_order_relaxed);
+	if (kind == FT_IO_READ || kind == FT_IO_WRITE)
+		atomic_fetch_add_explicit(&slot->bytes[kind], bytes, memory_order_relaxed);
+
+#ifdef FILETRACK_ENABLE_FADVISE
+	if (kind == FT_IO_SEEK && bytes > 0)  /* FT_IO_SEEK の bytes は遠くへのシークなら 0 以外 */
+		atomic_fetch_add_explicit(&slot->far_seeks, 1, memory_order_relaxed);
+#endif
+
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+	if (kind == FT_IO_WRITE && bytes > 0) {
+		atomic_fetch_add_explicit(&slot->write_sizes[size_bucket(bytes)], 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&slot->unflushed, bytes, memory_order_relaxed);
+	} else if (kind == FT_IO_FLUSH || kind == FT_IO_SEEK) {  /* fseek も書き込み待ちのものを書き出す */
+		uint64_t unflushed = atomic_exchange_explicit(&slot->unflushed, 0, memory_order_relaxed);
+		if (unflushed > 0)  /* 書き出すものがなければシステムコールは発生しない */
+			atomic_fetch_add_explicit(&slot->flush_sizes[size_bucket(unflushed)], 1, memory_order_relaxed);
+	}
+#endif
+}
+
+
+/* 他のスレッドがまだ書き込んでいる可能性があるので、スレッドごとのカウンタは解放しない */
+static void io_quit (void) {
+	atomic_store_explicit(&io_stopped, true, memory_order_relaxed);
+
+	FileTrackIoSpill* spill = atomic_exchange_explicit(&io_spills, NULL, memory_order_acquire);
+	while (spill != NULL) {
+		FileTrackIoSpill* next = spill->next;
+		free(spill);
+		spill = next;
+	}
+
+	if (io_thread_key_created) {
+		pthread_key_delete(io_thread_key);
+		io_thread_key_created = false;
+	}
+}
+#endif
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void init (void) {
+	for (size_t i = 0; i < FILETRACK_ENTRIES_TRIAL; i++) {
+		filetrack_entries = mht_uint_create(FILETRACK_ENTRIES_COUNT);
+		if (LIKELY(filetrack_entries != NULL)) break;
+	}
+	if (UNLIKELY(filetrack_entries == NULL)) {
+		fprintf(stderr, "Failed to initialize file tracking.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+		filetrack_unlock();
+		global_lock_quit();
+		exit(EXIT_FAILURE);
+	}
+
+	atexit(quit);
+
+	filetrack_sites = mht_uint_create(FILETRACK_ENTRIES_COUNT);
+	if (UNLIKELY(filetrack_sites == NULL)) {
+		filetrack_errfunc = "init";
+	}
+
+#ifdef DEBUG
+	filename_stream_entries = mht_str_create(FILETRACK_ENTRIES_COUNT);
+	if (UNLIKELY(filename_stream_entries == NULL)) {
+		filetrack_errfunc = "init";
+	}
+#endif
+
+#ifdef FILETRACK_ENABLE_SHM_REGISTRY
+	shm_init();
+#endif
+}
+
+
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+/*
+ * begin_ns からの経過時間を呼び出し元のヒストグラムに記録する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void latency_record (const char* file, int line, FileTrackLatencyOp op, uint64_t begin_ns) {
+	uint64_t end_ns = clock_ns();
+
+	if (UNLIKELY(filetrack_entries == NULL)) init();
+
+	FileTrackSite* site = site_get(file, line);
+	if (UNLIKELY(site == NULL)) return;
+
+	if (site->latency[op] == NULL) {
+		site->latency[op] = calloc(1, sizeof(FileTrackHist));
+		if (UNLIKELY(site->latency[op] == NULL)) return;
+	}
+
+	hist_record(site->latency[op], (end_ns > begin_ns) ? end_ns - begin_ns : 0);
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+/* 重要: admission_mutex をロックした後に呼び出す必要があります */
+static void admission_wake_head (void) {
+	if (admission_head != NULL && (admission_budget == 0 || admission_used < admission_budget))
+		pthread_cond_signal(&admission_head->cond);
+}
+
+
+/*
+ * 開いているストリームの枠を 1 つ確保する
+ * 枠が空くまで到着順に待ち、時間切れなら EAGAIN を設定して false を返す
+ * *waited_ns には待った時間が入る
+ * 重要: この関数はグローバルロックの外で呼び出す必要があります！
+ */
+static bool admission_acquire (bool* granted, uint64_t* waited_ns) {
+	*granted = false;
+	*waited_ns = 0;
+
+	pthread_mutex_lock(&admission_mutex);
+
+	if (admission_budget == 0) {
+		pthread_mutex_unlock(&admission_mutex);
+		return true;
+	}
+
+	if (admission_head == NULL && admission_used < admission_budget) {
+		admission_used++;
+		*granted = true;
+		pthread_mutex_unlock(&admission_mutex);
+		return true;
+	}
+
+	FileTrackAdmissionWaiter waiter = { .next = NULL };
+	if (UNLIKELY(pthread_cond_init(&waiter.cond, NULL) != 0)) {
+		pthread_mutex_unlock(&admission_mutex);
+		errno = EAGAIN;
+		return false;
+	}
+
+	if (admission_tail != NULL) admission_tail->next = &waiter;
+	else admission_head = &waiter;
+	admission_tail = &waiter;
+
+	uint64_t begin_ns = clock_ns();
+
+	struct timespec deadline;
+	bool has_deadline = (admission_timeout_ms >= 0 && clock_gettime(CLOCK_REALTIME, &deadline) == 0);
+	if (has_deadline) {
+		deadline.tv_sec += (time_t)(admission_timeout_ms / 1000);
+		deadline.tv_nsec += (long)(admission_timeout_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+
+	bool timed_out = false;
+	while (!(admission_head == &waiter && (admission_budget == 0 || admission_used < admission_budget))) {
+		if (has_deadline) {
+			if (pthread_cond_timedwait(&waiter.cond, &admission_mutex, &deadline) == ETIMEDOUT) {
+				timed_out = !(admission_head == &waiter && (admission_budget == 0 || admission_used < admission_budget));
+				break;
+			}
+		} else {
+			pthread_cond_wait(&waiter.cond, &admission_mutex);
+		}
+	}
+
+	/* 待ち行列から外す */
+	FileTrackAdmissionWaiter** link = &admission_head;
+	FileTrackAdmissionWaiter* prev = NULL;
+	while (*link != &waiter) {
+		prev = *link;
+		link = &(*link)->next;
+	}
+	*link = waiter.next;
+	if (admission_tail == &waiter) admission_tail = prev;
+
+	if (!timed_out && admission_budget > 0) {
+		admission_used++;
+		*granted = true;
+	}
+	admission_wake_head();  /* 先頭が変わったか、まだ枠が残っている */
+
+	pthread_mutex_unlock(&admission_mutex);
+	pthread_cond_destroy(&waiter.cond);
+
+	uint64_t end_ns = clock_ns();
+	*waited_ns = (end_ns > begin_ns) ? end_ns - begin_ns : 0;
+
+	if (timed_out) errno = EAGAIN;
+	return !timed_out;
+}
+
+
+static void admission_release (void) {
+	pthread_mutex_lock(&admission_mutex);
+	if (LIKELY(admission_used > 0)) admission_used--;
+	admission_wake_head();
+	pthread_mutex_unlock(&admission_mutex);
+}
+
+
+/*
+ * エントリに渡らなかった枠を返す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void admission_settle (void) {
+	if (admission_granted) {
+		admission_granted = false;
+		admission_release();
+	}
+}
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void admission_record (const char* file, int line, uint64_t waited_ns, bool timed_out) {
+	if (UNLIKELY(filetrack_entries == NULL)) init();
+
+	FileTrackSite* site = site_get(file, line);
+	if (UNLIKELY(site == NULL)) return;
+
+	if (timed_out) site->admission_timeout_cnt++;
+
+	if (site->admission_wait == NULL) {
+		site->admission_wait = calloc(1, sizeof(FileTrackHist));
+		if (UNLIKELY(site->admission_wait == NULL)) return;
+	}
+	hist_record(site->admission_wait, waited_ns);
+}
+
+
+/*
+ * 枠を確保し、待ち時間を記録する
+ * 枠を確保した場合、グローバルロックを取った状態で返る
+ */
+static bool admission_enter (const char* func, const char* file, int line) {
+	bool granted;
+	uint64_t waited_ns;
+	bool admitted = admission_acquire(&granted, &waited_ns);
+
+	filetrack_lock();
+
+	if (granted || !admitted)
+		admission_record(file, line, waited_ns, !admitted);
+
+	if (!admitted) {
+		fprintf(stderr, "Timed out waiting for a free stream slot.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = func;
+		filetrack_unlock();
+		errno = EAGAIN;
+		return false;
+	}
+
+	admission_granted = granted;
+	return true;
+}
+
+
+void filetrack_admission_set (uint64_t budget, int64_t timeout_ms) {
+	pthread_mutex_lock(&admission_mutex);
+	admission_budget = budget;
+	admission_timeout_ms = timeout_ms;
+	admission_wake_head();  /* 枠が増えた、または無効になった */
+	pthread_mutex_unlock(&admission_mutex);
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+/*
+ * 記述子のエントリを取得する
+ * create が true なら、必要に応じて表を広げる
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static FileTrackFdEntry* fd_entry_get (int fd, bool create) {
+	if (UNLIKELY(fd < 0)) return NULL;
+	if ((size_t)fd < fd_entries_cnt) return &fd_entries[fd];
+	if (!create) return NULL;
+
+	size_t new_cnt = (fd_entries_cnt < FT_FD_ENTRIES_MIN) ? FT_FD_ENTRIES_MIN : fd_entries_cnt * 2;
+	if (new_cnt <= (size_t)fd) new_cnt = (size_t)fd + 1;
+
+	FileTrackFdEntry* new_entries = realloc(fd_entries, sizeof(FileTrackFdEntry) * new_cnt);
+	if (UNLIKELY(new_entries == NULL)) return NULL;
+
+	memset(new_entries + fd_entries_cnt, 0, sizeof(FileTrackFdEntry) * (new_cnt - fd_entries_cnt));  /* FT_FD_NONE */
+	fd_entries = new_entries;
+	fd_entries_cnt = new_cnt;
+	return &fd_entries[fd];
+}
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void fd_release (FileTrackFdEntry* entry) {
+	if (entry->type == FT_FD_NONE) return;
+
+	if (entry->type != FT_FD_STREAM) {
+		if (entry->open_site != NULL && LIKELY(entry->open_site->fd_live_cnt > 0))
+			entry->open_site->fd_live_cnt--;
+		if (LIKELY(fd_live_total > 0)) fd_live_total--;
+	}
+
+#ifdef DEBUG
+	free(entry->path);
+#endif
+	memset(entry, 0, sizeof(FileTrackFdEntry));
+}
+
+
+/*
+ * 記述子を記録する
+ * 追跡外で閉じられた記述子の番号が再利用された場合は、古い記録を上書きする
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void fd_register (int fd, FileTrackFdType type, FileTrackSite* site, FILE* stream, const char* path) {
+	FileTrackFdEntry* entry = fd_entry_get(fd, true);
+	if (UNLIKELY(entry == NULL)) {
+		if (fd >= 0) filetrack_errfunc = "filetrack_fd_register";
+		return;
+	}
+
+	fd_release(entry);
+
+	entry->type = type;
+	entry->open_site = site;
+	entry->stream = stream;
+#ifdef DEBUG
+	if (path != NULL) {
+		entry->path = mutils_strndup(path, FT_FILENAME_LEN_MAX);
+		if (UNLIKELY(entry->path == NULL))
+			filetrack_errfunc = "filetrack_fd_register";
+	}
+#else
+	(void)path;
+#endif
+
+	if (type != FT_FD_STREAM) {
+		fd_live_total++;
+		if (site != NULL) {
+			site->fd_open_cnt++;
+			site->fd_live_cnt++;
+		}
+	}
+}
+
+
+/*
+ * ストリームが閉じられる際に、そのストリームの記述子の記録だけを消す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void fd_unlink_stream (int fd, const FILE* stream) {
+	FileTrackFdEntry* entry = fd_entry_get(fd, false);
+	if (entry != NULL && entry->type == FT_FD_STREAM && entry->stream == stream)
+		fd_release(entry);
+}
+
+
+static void fd_quit (void) {
+	for (size_t i = 0; i < fd_entries_cnt; i++) {
+		FileTrackFdEntry* entry = &fd_entries[i];
+		if (entry->type == FT_FD_NONE) continue;
+
+#ifdef DEBUG
+		if (entry->type != FT_FD_STREAM) {  /* 記述子はプロセスの終了時に閉じられるので報告のみ */
+			fprintf(stderr, "\nDescriptor not closed!\nDescriptor: %zu   Type: %s\nFile Name: %s\nopen File: %s   Line: %d\n", i, FileTrackFdTypeNames[entry->type], (entry->path != NULL) ? entry->path : "unknown", (entry->open_site != NULL) ? entry->open_site->file : "unknown", (entry->open_site != NULL) ? entry->open_site->line : 0);
+			errno = EPERM;
+			filetrack_errfunc = "quit";
+		}
+#endif
+		fd_release(entry);
+	}
+
+	free(fd_entries);
+	fd_entries = NULL;
+	fd_entries_cnt = 0;
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_MEMFD_TMPFILE
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static bool memfd_register (int fd, FileTrackSite* site) {
+	if (memfds_cnt == memfds_cap) {
+		size_t new_cap = (memfds_cap < FT_MEMFD_ENTRIES_MIN) ? FT_MEMFD_ENTRIES_MIN : memfds_cap * 2;
+		FileTrackMemfd* new_memfds = realloc(memfds, sizeof(FileTrackMemfd) * new_cap);
+		if (UNLIKELY(new_memfds == NULL)) return false;
+		memfds = new_memfds;
+		memfds_cap = new_cap;
+	}
+
+	memfds[memfds_cnt++] = (FileTrackMemfd){
+		.site = site,
+		.fd = fd
+	};
+	return true;
+}
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void memfd_unregister (int fd) {
+	for (size_t i = 0; i < memfds_cnt; i++) {
+		if (memfds[i].fd != fd) continue;
+		memfds[i] = memfds[--memfds_cnt];
+		return;
+	}
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+/* size 以上で最も小さい区分を返す、大きすぎる場合は -1 を返す */
+static int buffer_class (size_t size) {
+	for (int index = 0; index < FT_BUFFER_CLASSES; index++) {
+		if (size <= ((size_t)1 << (index + FT_BUFFER_CLASS_MIN_BITS))) return index;
+	}
+	return -1;
+}
+
+
+#ifdef __linux__
+/* ヒュージページの境界に揃えて確保し、透過的ヒュージページを使うように指示する */
+static void* buffer_hugepage_map (size_t size) {
+	size_t map_size = size + FT_HUGE_PAGE_SIZE;
+	char* addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) return NULL;
+
+	/* 境界に揃えるため前後の余りを返す */
+	size_t head = (FT_HUGE_PAGE_SIZE - ((uintptr_t)addr % FT_HUGE_PAGE_SIZE)) % FT_HUGE_PAGE_SIZE;
+	if (head > 0) munmap(addr, head);
+	if (map_size - head > size) munmap(addr + head + size, map_size - head - size);
+
+	madvise(addr + head, size, MADV_HUGEPAGE);  /* 失敗しても通常のページで使える */
+	return addr + head;
+}
+
+
+/*
+ * ヒュージページの領域から切り出す、領域の大きさ以上のものは個別に確保する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void* buffer_hugepage_alloc (size_t size, uint8_t* origin) {
+	if (size >= FT_HUGE_PAGE_SIZE) {
+		*origin = FT_BUFFER_MMAP;
+		return buffer_hugepage_map(size);
+	}
+
+	if (buffer_slab_used + size > FT_HUGE_PAGE_SIZE || buffer_slabs == NULL) {
+		FileTrackBufferSlab* slab = malloc(sizeof(FileTrackBufferSlab));
+		if (UNLIKELY(slab == NULL)) return NULL;
+		slab->addr = buffer_hugepage_map(FT_HUGE_PAGE_SIZE);
+		if (slab->addr == NULL) {
+			free(slab);
+			return NULL;
+		}
+		slab->next = buffer_slabs;
+		buffer_slabs = slab;
+		buffer_slab_used = 0;
+		buffer_pool_stats.hugepage_bytes += FT_HUGE_PAGE_SIZE;
+	}
+
+	void* buffer = (char*)buffer_slabs->addr + buffer_slab_used;  /* 区分は 2 の累乗なので境界は揃う */
+	buffer_slab_used += size;
+	*origin = FT_BUFFER_SLAB;
+	return buffer;
+}
+#endif
+
+
+/*
+ * プールからバッファを取り出す、空なら新しく確保する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void* buffer_take (int index, uint8_t* origin, bool* hit) {
+	FileTrackBufferNode* node = buffer_free[index];
+	if (node != NULL) {
+		buffer_free[index] = node->next;
+		buffer_free_cnt[index]--;
+		buffer_pool_stats.pooled_bytes -= (size_t)1 << (index + FT_BUFFER_CLASS_MIN_BITS);
+		*origin = node->origin;
+		*hit = true;
+		return node;
+	}
+
+	*hit = false;
+	size_t size = (size_t)1 << (index + FT_BUFFER_CLASS_MIN_BITS);
+
+	int tmp_errno = errno;
+	void* buffer = NULL;
+#ifdef __linux__
+	if (buffer_hugepages) {
+		buffer = buffer_hugepage_alloc(size, origin);
+		if (buffer != NULL && *origin == FT_BUFFER_MMAP) buffer_pool_stats.hugepage_bytes += size;
+	}
+#endif
+	if (buffer == NULL) {
+		buffer = malloc(size);
+		*origin = FT_BUFFER_MALLOC;
+	}
+	errno = tmp_errno;
+	return buffer;
+}
+
+
+/*
+ * 閉じたストリームのバッファをプールへ戻す、手元に十分あれば解放する
+ * ヒュージページの領域から切り出したものは個別に解放できないので常に戻す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void buffer_put (void* buffer, int index, uint8_t origin) {
+	size_t size = (size_t)1 << (index + FT_BUFFER_CLASS_MIN_BITS);
+
+	if (origin != FT_BUFFER_SLAB && buffer_free_cnt[index] >= FT_BUFFER_POOL_KEEP) {
+#ifdef __linux__
+		if (origin == FT_BUFFER_MMAP) {
+			munmap(buffer, size);
+			buffer_pool_stats.hugepage_bytes -= size;
+			return;
+		}
+#endif
+		free(buffer);
+		return;
+	}
+
+	FileTrackBufferNode* node = buffer;
+	node->next = buffer_free[index];
+	node->origin = origin;
+	buffer_free[index] = node;
+	buffer_free_cnt[index]++;
+	buffer_pool_stats.pooled_bytes += size;
+	buffer_pool_stats.returned++;
+}
+
+
+/*
+ * 記録を先に閉じるストリームのバッファをエントリから外す
+ * fclose が書き出すまで stdio が使うので、閉じた後に buffer_put で戻す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void* buffer_detach (FILE* stream, int* index, uint8_t* origin) {
+	if (filetrack_entries == NULL) return NULL;
+
+	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+	if (entry == NULL || entry->buffer == NULL) return NULL;
+#ifdef DEBUG
+	if (entry->is_closed) return NULL;
+#endif
+
+	void* buffer = entry->buffer;
+	*index = entry->buffer_class;
+	*origin = entry->buffer_origin;
+	entry->buffer = NULL;
+	return buffer;
+}
+
+
+static void buffer_pool_quit (void) {
+	for (int index = 0; index < FT_BUFFER_CLASSES; index++) {
+		while (buffer_free[index] != NULL) {
+			FileTrackBufferNode* node = buffer_free[index];
+			buffer_free[index] = node->next;
+#ifdef __linux__
+			if (node->origin == FT_BUFFER_MMAP) munmap(node, (size_t)1 << (index + FT_BUFFER_CLASS_MIN_BITS));
+			else
+#endif
+			if (node->origin == FT_BUFFER_MALLOC) free(node);
+		}
+		buffer_free_cnt[index] = 0;
+	}
+
+#ifdef __linux__
+	while (buffer_slabs != NULL) {  /* 開いたままのストリームは quit で閉じられている */
+		FileTrackBufferSlab* slab = buffer_slabs;
+		buffer_slabs = slab->next;
+		munmap(slab->addr, FT_HUGE_PAGE_SIZE);
+		free(slab);
+	}
+	buffer_slab_used = 0;
+#endif
+
+	buffer_pool_stats.pooled_bytes = 0;
+	buffer_pool_stats.hugepage_bytes = 0;
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+/* 区間を代表する値 (区間の中央) */
+static uint64_t size_bucket_mid (size_t index) {
+	if (index == 0) return 1;
+	return ((uint64_t)3 << index) >> 1;
+}
+
+
+/* permille の位置を含む区間の最大値を返す、空なら 0 を返す */
+static uint64_t size_percentile (const uint64_t* buckets, unsigned int permille) {
+	uint64_t total = 0;
+	for (size_t i = 0; i < FT_SIZE_BUCKETS; i++)
+		total += buckets[i];
+	if (total == 0) return 0;
+
+	uint64_t rank = (total * permille + 999u) / 1000u;  /* 1 始まりの順位 */
+	if (rank == 0) rank = 1;
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < FT_SIZE_BUCKETS; i++) {
+		seen += buckets[i];
+		if (seen >= rank) return (i == 0) ? 1 : ((uint64_t)2 << i) - 1;
+	}
+	return ((uint64_t)2 << (FT_SIZE_BUCKETS - 1)) - 1;
+}
+
+
+/* 書き出しの間隔の分布から、バッファが buffer_size バイトの場合に write が呼ばれる回数を見積もる */
+static uint64_t advisor_write_calls (const FileTrackWriteProfile* profile, uint64_t buffer_size) {
+	uint64_t calls = 0;
+	for (size_t i = 0; i < FT_SIZE_BUCKETS; i++) {
+		if (profile->flush_sizes[i] == 0) continue;
+		calls += profile->flush_sizes[i] * ((size_bucket_mid(i) + buffer_size - 1) / buffer_size);
+	}
+	return calls;
+}
+
+
+/* 呼び出し元で開いたストリームが使っているバッファの大きさ */
+static uint64_t advisor_buffer_size (const FileTrackSite* site) {
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	size_t size = site->buffer_size_set ? site->buffer_size : buffer_default_size;
+	int index = (size > 0) ? buffer_class(size) : -1;
+	if (index >= 0) return (uint64_t)1 << (index + FT_BUFFER_CLASS_MIN_BITS);
+#else
+	(void)site;
+#endif
+	return BUFSIZ;  /* stdio の既定値、実際には st_blksize が使われることもある */
+}
+
+
+/*
+ * 閉じられたストリームの分布から、バッファを大きくした場合と fflush をやめた場合の write の回数を見積もる
+ * 見積もるだけの情報がなければ false を返す
+ */
+static bool advisor_evaluate (const FileTrackSite* site, FileTrackWriteAdvice* advice) {
+	const FileTrackWriteProfile* profile = site->write_profile;
+	if (profile == NULL || site->write_closed_cnt == 0) return false;
+
+	uint64_t intervals = 0;
+	uint64_t bytes = 0;
+	for (size_t i = 0; i < FT_SIZE_BUCKETS; i++) {
+		intervals += profile->flush_sizes[i];
+		bytes += profile->flush_sizes[i] * size_bucket_mid(i);
+	}
+	if (intervals == 0) return false;
+
+	uint64_t current_size = advisor_buffer_size(site);
+
+	/* 書き出しの間隔の大部分が一度の write で済む大きさを勧める */
+	uint64_t wanted = size_percentile(profile->flush_sizes, 900);
+	uint64_t size = FT_WRITE_ADVISOR_BUFFER_MIN;
+	while (size < wanted && size < FT_WRITE_ADVISOR_BUFFER_MAX)
+		size <<= 1;
+	if (size < current_size) size = current_size;
+
+	*advice = (FileTrackWriteAdvice){
+		.current_size = current_size,
+		.current_calls = advisor_write_calls(profile, current_size),
+		.buffer_size = size,
+		.buffer_calls = advisor_write_calls(profile, size),
+		.flush_interval = size_percentile(profile->flush_sizes, 500),
+		.explicit_flushes = (intervals > site->write_closed_cnt) ? intervals - site->write_closed_cnt : 0,
+		.noflush_calls = site->write_closed_cnt + bytes / size  /* 閉じる時に一度だけ書き出す場合 */
+	};
+	if (advice->noflush_calls > advice->buffer_calls) advice->noflush_calls = advice->buffer_calls;
+	return true;
+}
+
+
+/* 削減できる回数が十分に大きければ true を返す */
+static bool advisor_worth (uint64_t before, uint64_t after) {
+	if (after >= before) return false;
+	uint64_t saved = before - after;
+	return saved >= FT_WRITE_ADVISOR_MIN_SAVED && saved * 10u >= before;
+}
+
+
+/*
+ * 閉じられたストリームの分布を呼び出し元に加え、自動調整が有効なら以降に開くストリームのバッファの大きさを変える
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void advisor_entry_close (FileTrackEntry* entry) {
+	FileTrackWriteProfile* profile = entry->write_profile;
+	if (profile == NULL) return;
+	entry->write_profile = NULL;
+
+	if (profile->pending > 0) {  /* 閉じる時に書き出される残り */
+		profile->flush_sizes[size_bucket(profile->pending)]++;
+		profile->pending = 0;
+	}
+
+	FileTrackSite* site = entry->open_site;
+	if (site == NULL) {
+		free(profile);
+		return;
+	}
+
+	if (site->write_profile == NULL) {  /* 最初のものはそのまま引き継ぐ */
+		site->write_profile = profile;
+	} else {
+		for (size_t i = 0; i < FT_SIZE_BUCKETS; i++) {
+			site->write_profile->write_sizes[i] += profile->write_sizes[i];
+			site->write_profile->flush_sizes[i] += profile->flush_sizes[i];
+		}
+		free(profile);
+	}
+	site->write_closed_cnt++;
+
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	FileTrackWriteAdvice advice;
+	if (write_advisor_autotune && site->write_closed_cnt >= FT_WRITE_ADVISOR_AUTOTUNE_MIN && advisor_evaluate(site, &advice) && advice.buffer_size > advice.current_size && advisor_worth(advice.current_calls, advice.buffer_calls)) {
+		site->buffer_size = (size_t)advice.buffer_size;
+		site->buffer_size_set = true;
+		site->buffer_autotune_cnt++;
+	}
+#endif
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_PREFETCH
+/* 重要: この関数は prefetch_mutex をロックした後に呼び出す必要があります！ */
+static void prefetch_unlink (FileTrackPrefetchJob* job) {
+	if (job->prev != NULL) job->prev->next = job->next;
+	else prefetch_head = job->next;
+	if (job->next != NULL) job->next->prev = job->prev;
+	else prefetch_tail = job->prev;
+}
+
+
+/* offset から length バイトをページキャッシュに読み込ませ、処理したバイト数を返す */
+static ssize_t prefetch_chunk (int fd, uint64_t offset, size_t length, char* scratch) {
+#ifdef __linux__
+	(void)scratch;
+	if (readahead(fd, (off64_t)offset, length) != 0) return -1;
+	return (ssize_t)length;
+#else
+	size_t total = 0;  /* readahead がないので実際に読み込む */
+	while (total < length) {
+		ssize_t result = pread(fd, scratch, length - total, (off_t)(offset + total));
+		if (result < 0 && errno == EINTR) continue;
+		if (result <= 0) break;
+		total += (size_t)result;
+	}
+	return (total > 0) ? (ssize_t)total : -1;
+#endif
+}
+
+
+static void* prefetch_main (void* arg) {
+	(void)arg;
+
+#ifdef __linux__
+	char* scratch = NULL;
+#else
+	char* scratch = malloc(FT_PREFETCH_CHUNK);
+	if (UNLIKELY(scratch == NULL)) return NULL;  /* 他のワーカーか、stdio に任せる */
+#endif
+
+	pthread_mutex_lock(&prefetch_mutex);
+	for (;;) {
+		FileTrackPrefetchJob* job = prefetch_head;
+		while (job != NULL && job->state != FT_PREFETCH_QUEUED)
+			job = job->next;
+		if (job == NULL) {
+			if (prefetch_stopping) break;
+			pthread_cond_wait(&prefetch_cond, &prefetch_mutex);
+			continue;
+		}
+
+		job->state = FT_PREFETCH_RUNNING;
+		while (!job->cancel && !prefetch_stopping && job->done < job->length) {
+			int fd = job->fd;
+			uint64_t offset = job->done;
+			size_t length = (job->length - offset < FT_PREFETCH_CHUNK) ? (size_t)(job->length - offset) : FT_PREFETCH_CHUNK;
+			pthread_mutex_unlock(&prefetch_mutex);
+
+			ssize_t result = prefetch_chunk(fd, offset, length, scratch);  /* 実行中は記述子を閉じられない */
+
+			pthread_mutex_lock(&prefetch_mutex);
+			if (result <= 0) break;
+			job->done += (uint64_t)result;
+		}
+
+		close(job->fd);
+		job->fd = -1;
+		if (job->orphan) {
+			prefetch_unlink(job);
+			free(job);
+		} else {
+			job->state = FT_PREFETCH_FINISHED;
+		}
+	}
+	pthread_mutex_unlock(&prefetch_mutex);
+
+	free(scratch);
+	return NULL;
+}
+
+
+/*
+ * ワーカーがいなければ起動する、一つも起動できなければ false を返す
+ * 重要: この関数は prefetch_mutex をロックした後に呼び出す必要があります！
+ */
+static bool prefetch_workers_start (void) {
+	while (prefetch_workers_cnt < FT_PREFETCH_WORKERS) {
+		if (pthread_create(&prefetch_workers[prefetch_workers_cnt], NULL, prefetch_main, NULL) != 0) break;
+		prefetch_workers_cnt++;
+	}
+	return prefetch_workers_cnt > 0;
+}
+
+
+/*
+ * ストリームから先読みの依頼を切り離し、終わっていなければ取り消す
+ * consumed はストリームが読み進めたバイト数、わからなければ -1
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void prefetch_detach (FileTrackEntry* entry, int64_t consumed) {
+	FileTrackPrefetchJob* job = entry->prefetch;
+	entry->prefetch = NULL;
+
+	pthread_mutex_lock(&prefetch_mutex);
+	uint64_t done = job->done;
+	uint8_t state = job->state;
+	if (state == FT_PREFETCH_RUNNING) {  /* 今の単位が終わったらワーカーが解放する */
+		job->cancel = true;
+		job->orphan = true;
+	} else {
+		prefetch_unlink(job);
+		if (job->fd >= 0) close(job->fd);
+		free(job);
+	}
+	pthread_mutex_unlock(&prefetch_mutex);
+
+	if (state != FT_PREFETCH_FINISHED) prefetch_stats.cancelled++;
+	if (consumed < 0) return;
+
+	uint64_t used = ((uint64_t)consumed < done) ? (uint64_t)consumed : done;
+	prefetch_stats.bytes += done;
+	prefetch_stats.used_bytes += used;
+	if (state != FT_PREFETCH_FINISHED && (uint64_t)consumed > done) prefetch_stats.overtaken++;
+
+	FileTrackSite* site = entry->open_site;
+	if (site != NULL) {
+		site->prefetch_bytes += done;
+		site->prefetch_used_bytes += used;
+	}
+}
+
+
+/* 終了時の後始末、開いたままのストリームの依頼も解放する */
+static void prefetch_quit (void) {
+	pthread_mutex_lock(&prefetch_mutex);
+	prefetch_stopping = true;  /* 実行中のものは今の単位で打ち切る */
+	pthread_cond_broadcast(&prefetch_cond);
+	size_t workers_cnt = prefetch_workers_cnt;
+	pthread_mutex_unlock(&prefetch_mutex);
+
+	for (size_t i = 0; i < workers_cnt; i++)
+		pthread_join(prefetch_workers[i], NULL);
+
+	pthread_mutex_lock(&prefetch_mutex);
+	while (prefetch_head != NULL) {
+		FileTrackPrefetchJob* job = prefetch_head;
+		prefetch_head = job->next;
+		if (job->fd >= 0) close(job->fd);
+		free(job);
+	}
+	prefetch_tail = NULL;
+	prefetch_workers_cnt = 0;
+	prefetch_stopping = false;
+	pthread_mutex_unlock(&prefetch_mutex);
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+static void sampling_filter_index (const FILE* stream, size_t index[2]) {
+	uint64_t hash = (uint64_t)(uintptr_t)stream * UINT64_C(0x9e3779b97f4a7c15);
+	index[0] = (size_t)(hash >> (64 - FT_SAMPLING_FILTER_BITS));
+	index[1] = (size_t)(hash >> (64 - 2 * FT_SAMPLING_FILTER_BITS)) & (FT_SAMPLING_FILTER_SIZE - 1);
+}
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void sampling_filter_add (const FILE* stream) {
+	size_t index[2];
+	sampling_filter_index(stream, index);
+	for (size_t i = 0; i < 2; i++) {
+		if (sampling_filter[index[i]] < UINT8_MAX) sampling_filter[index[i]]++;
+	}
+}
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void sampling_filter_remove (const FILE* stream) {
+	size_t index[2];
+	sampling_filter_index(stream, index);
+	for (size_t i = 0; i < 2; i++) {
+		if (sampling_filter[index[i]] > 0 && sampling_filter[index[i]] < UINT8_MAX) sampling_filter[index[i]]--;
+	}
+}
+
+
+/*
+ * 追跡している可能性があれば true を返す、false なら確実に追跡していない
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static bool sampling_filter_check (const FILE* stream) {
+	size_t index[2];
+	sampling_filter_index(stream, index);
+	return sampling_filter[index[0]] > 0 && sampling_filter[index[1]] > 0;
+}
+
+
+/* 平均が period になる 1 以上の間隔を返す */
+static uint64_t sampling_interval (uint64_t period) {
+	if (period <= 1) return 1;
+
+	if (UNLIKELY(sampling_random == 0))
+		sampling_random = ((uint64_t)(uintptr_t)&sampling_random ^ (uint64_t)time(NULL)) | 1u;
+
+	/* xorshift64 */
+	sampling_random ^= sampling_random << 13;
+	sampling_random ^= sampling_random >> 7;
+	sampling_random ^= sampling_random << 17;
+	return 1 + sampling_random % (2 * period - 1);
+}
+
+
+/* 呼び出し元の開いた回数が増えるほど間引き、sampling_period まで間隔を広げる */
+static uint64_t sampling_site_period (const FileTrackSite* site) {
+	uint64_t period = 1;
+	uint64_t rounds = site->sample_seen_cnt / FT_SAMPLING_FULL_OPENS;
+	while (period < sampling_period && rounds >= period * 2)
+		period *= 2;
+	return period;
+}
+
+
+/*
+ * 開いたストリームを追跡しない場合は true を返す
+ * 追跡する場合は、エントリに渡す重みを sampling_weight に設定する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static bool sampling_skip (const char* file, int line) {
+	if (sampling_period <= 1) return false;
+
+	uint64_t period = sampling_period;
+	uint64_t* countdown = &sampling_countdown;
+	if (sampling_adaptive) {
+		if (UNLIKELY(filetrack_entries == NULL)) init();
+
+		FileTrackSite* site = site_get(file, line);
+		if (LIKELY(site != NULL)) {
+			period = sampling_site_period(site);
+			countdown = &site->sample_countdown;
+			site->sample_seen_cnt++;
+		}
+	}
+
+	if (*countdown > 1) {
+		(*countdown)--;
+		sampling_stats.skipped++;
+		return true;
+	}
+
+	*countdown = sampling_interval(period);
+	sampling_weight = period;
+	return false;
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_BACKTRACE
+#ifdef FT_BACKTRACE_FRAME_WALK
+/* 呼び出したスレッドのスタックの上端を返す、取得できなければ 0 を返す */
+static uintptr_t backtrace_stack_top_get (void) {
+	pthread_attr_t attr;
+	if (pthread_getattr_np(pthread_self(), &attr) != 0) return 0;
+
+	void* addr;
+	size_t size;
+	uintptr_t top = 0;
+	if (pthread_attr_getstack(&attr, &addr, &size) == 0)
+		top = (uintptr_t)addr + size;
+	pthread_attr_destroy(&attr);
+	return top;
+}
+
+
+/*
+ * フレームポインタを辿ってリターンアドレスを集める
+ * フレームポインタを省略してビルドされた関数は飛ばされるか、そこで打ち切られる
+ * 読むのは今のフレームからスタックの上端までに限るので、壊れた値を辿っても落ちない
+ */
+static size_t backtrace_walk (void** frames, size_t depth) {
+	if (backtrace_stack_top == 0) {
+		backtrace_stack_top = backtrace_stack_top_get();
+		if (UNLIKELY(backtrace_stack_top == 0)) backtrace_stack_top = 1;
+	}
+	if (UNLIKELY(backtrace_stack_top == 1)) return (size_t)backtrace(frames, (int)depth);
+
+	uintptr_t top = backtrace_stack_top;
+	void* current = __builtin_frame_address(0);
+	uintptr_t fp = (uintptr_t)current;
+	size_t cnt = 0;
+	while (cnt < depth) {
+		if (fp == 0 || (fp & (sizeof(uintptr_t) - 1)) != 0 || fp > top - 2 * sizeof(uintptr_t)) break;
+
+		const uintptr_t* frame = (const uintptr_t*)fp;  /* [0] が呼び出し元のフレーム、[1] がリターンアドレス */
+		if (frame[1] == 0) break;
+		frames[cnt++] = (void*)frame[1];
+
+		if (frame[0] <= fp) break;  /* スタックは上位に向かって遡るはず */
+		fp = frame[0];
+	}
+	return cnt;
+}
+#endif
+
+
+static uint_keyt backtrace_hash (const FileTrackSite* site, void* const* frames, size_t depth) {
+	uint64_t hash = 14695981039346656037u;  /* FNV-1a をアドレス単位で使う */
+	hash ^= (uint64_t)(uintptr_t)site;
+	hash *= 1099511628211u;
+	for (size_t i = 0; i < depth; i++) {
+		hash ^= (uint64_t)(uintptr_t)frames[i];
+		hash *= 1099511628211u;
+	}
+	return (uint_keyt)(hash ^ (hash >> 32));
+}
+
+
+/*
+ * 同じ呼び出し元と呼び出し履歴の組を表に 1 つだけ登録し、それを返す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static FileTrackStack* backtrace_intern (const FileTrackSite* site, void* const* frames, size_t depth) {
+	if (UNLIKELY(backtrace_table == NULL)) {
+		backtrace_table = mht_uint_create(FILETRACK_ENTRIES_COUNT);
+		if (UNLIKELY(backtrace_table == NULL)) return NULL;
+	}
+
+	uint_keyt key = backtrace_hash(site, frames, depth);
+
+	FileTrackStack** head = mht_uint_get(backtrace_table, key);
+	if (head != NULL) {
+		for (FileTrackStack* stack = *head; stack != NULL; stack = stack->hash_next) {
+			if (stack->site == site && stack->depth == depth && memcmp(stack->frames, frames, depth * sizeof(void*)) == 0)
+				return stack;
+		}
+	}
+
+	if (UNLIKELY(backtrace_stacks_cnt >= UINT32_MAX)) return NULL;
+	if (backtrace_stacks_cnt == backtrace_stacks_cap) {
+		size_t cap = (backtrace_stacks_cap > 0) ? backtrace_stacks_cap * 2 : 64;
+		FileTrackStack** stacks = realloc(backtrace_stacks, cap * sizeof(FileTrackStack*));
+		if (UNLIKELY(stacks == NULL)) return NULL;
+		backtrace_stacks = stacks;
+		backtrace_stacks_cap = cap;
+	}
+
+	size_t size = sizeof(FileTrackStack) + depth * sizeof(void*);
+	FileTrackStack* stack = calloc(1, size);
+	if (UNLIKELY(stack == NULL)) return NULL;
+
+	stack->site = site;
+	stack->id = (uint32_t)(backtrace_stacks_cnt + 1);
+	stack->depth = (uint32_t)depth;
+	memcpy(stack->frames, frames, depth * sizeof(void*));
+
+	if (head != NULL) {  /* ハッシュ値の衝突 */
+		stack->hash_next = *head;
+		*head = stack;
+	} else if (UNLIKELY(!mht_uint_set(backtrace_table, key, &stack, sizeof(FileTrackStack*)))) {
+		free(stack);
+		return NULL;
+	}
+
+	backtrace_stacks[backtrace_stacks_cnt++] = stack;
+	backtrace_stats.unique++;
+	backtrace_stats.bytes += size;
+	return stack;
+}
+
+
+/*
+ * 開いた時の呼び出し履歴を記録し、その ID を返す (記録しなかった場合は 0)
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static uint32_t backtrace_capture (const FileTrackSite* site) {
+	if (backtrace_depth == 0 || site == NULL) return 0;
+
+	void* frames[FT_BACKTRACE_DEPTH_MAX];
+#ifdef FT_BACKTRACE_FRAME_WALK
+	size_t depth = backtrace_walk(frames, backtrace_depth);
+#else
+	size_t depth = (size_t)backtrace(frames, (int)backtrace_depth);
+#endif
+	if (depth == 0) return 0;
+
+	backtrace_stats.captured++;
+
+	FileTrackStack* stack = backtrace_intern(site, frames, depth);
+	if (UNLIKELY(stack == NULL)) return 0;
+
+	stack->open_cnt++;
+	stack->live_cnt++;
+	return stack->id;
+}
+
+
+static FileTrackStack* backtrace_stack_get (uint32_t id) {
+	if (id == 0 || id > backtrace_stacks_cnt) return NULL;
+	return backtrace_stacks[id - 1];
+}
+
+
+/* 先頭から続く filetrack 自身の関数のフレームを数える */
+static uint32_t backtrace_own_depth (const FileTrackStack* stack) {
+	Dl_info self;
+	if (dladdr((void*)(uintptr_t)&filetrack_entry_add, &self) == 0) return 0;
+
+	uint32_t cnt = 0;
+	for (; cnt < stack->depth; cnt++) {
+		Dl_info info;
+		if (dladdr(stack->frames[cnt], &info) == 0 || info.dli_fbase != self.dli_fbase) break;
+		/* 実行ファイルに静的にリンクされ、シンボルが公開されていなければ区別できないので省かない */
+		if (info.dli_sname == NULL || strncmp(info.dli_sname, "filetrack_", 10) != 0) break;
+	}
+	return (cnt < stack->depth) ? cnt : 0;
+}
+
+
+/*
+ * 呼び出し履歴を出力する、シンボル名は初めて出力する時に解決する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void backtrace_print (FileTrackStack* stack) {
+	if (!stack->symbolized) {
+		stack->symbols = backtrace_symbols(stack->frames, (int)stack->depth);  /* 失敗した場合はアドレスだけを出力する */
+		stack->own_depth = backtrace_own_depth(stack);
+		stack->symbolized = true;
+	}
+
+	for (uint32_t i = stack->own_depth; i < stack->depth; i++) {
+		if (stack->symbols != NULL)
+			printf("    #%lu %s\n", (unsigned long)(i - stack->own_depth), stack->symbols[i]);
+		else
+			printf("    #%lu %p\n", (unsigned long)(i - stack->own_depth), stack->frames[i]);
+	}
+}
+
+
+static void backtrace_quit (void) {
+	for (size_t i = 0; i < backtrace_stacks_cnt; i++) {
+		free(backtrace_stacks[i]->symbols);
+		free(backtrace_stacks[i]);
+	}
+	free(backtrace_stacks);
+	backtrace_stacks = NULL;
+	backtrace_stacks_cnt = 0;
+	backtrace_stacks_cap = 0;
+
+	if (backtrace_table != NULL) {
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		int tmp_errno = errno;
+#endif
+		errno = 0;
+
+		mht_destroy(backtrace_table);
+
+		if (UNLIKELY(errno != 0)) filetrack_errfunc = "quit";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		else errno = tmp_errno;
+#endif
+		backtrace_table = NULL;
+	}
+}
+#endif
+
+
+/*
+ * エントリが閉じられる際の集計と後始末
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void entry_release (FileTrackEntry* entry) {
+#ifdef FILETRACK_ENABLE_IO_STATS
+	io_collect(entry->stream, entry, true);
+	if (entry->open_site != NULL)
+		io_stats_add(&entry->open_site->io, &entry->io);
+#endif
+
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+	advisor_entry_close(entry);
+#endif
+
+	if (entry->open_site != NULL && LIKELY(entry->open_site->live_cnt > 0))
+		entry->open_site->live_cnt--;
+
+	if (LIKELY(stream_live_cnt > 0)) stream_live_cnt--;
+
+#ifdef FILETRACK_ENABLE_BACKTRACE
+	FileTrackStack* stack = backtrace_stack_get(entry->stack_id);
+	if (stack != NULL && LIKELY(stack->live_cnt > 0))
+		stack->live_cnt--;
+#endif
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+	if (entry->open_site != NULL && LIKELY(entry->open_site->sample_live_est >= entry->sample_weight))
+		entry->open_site->sample_live_est -= entry->sample_weight;
+	if (LIKELY(sampling_stats.live_estimate >= entry->sample_weight))
+		sampling_stats.live_estimate -= entry->sample_weight;
+#endif
+
+#ifdef FILETRACK_ENABLE_STREAM_CACHE
+	if (entry->cache_info != NULL) {  /* キャッシュへ移さずに閉じられた場合 */
+		free(entry->cache_info->path);
+		free(entry->cache_info);
+		entry->cache_info = NULL;
+	}
+#endif
+
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+	if (entry->admitted) {
+		entry->admitted = false;
+		if (admission_keep) admission_granted = true;
+		else admission_release();
+	}
+#endif
+
+#ifdef FT_POPEN_SUPPORTED
+	if (entry->open_type == FILE_OPEN_POPEN) {
+		if (LIKELY(popen_live_cnt > 0)) popen_live_cnt--;  /* 子プロセスの実行時間は回収した後に pclose_finish で集計する */
+	}
+#endif
+
+#ifdef FILETRACK_ENABLE_LIFETIME_STATS
+	uint64_t now_ns = coarse_clock_ns();
+#ifdef DEBUG
+	entry->close_ns = now_ns;
+#endif
+	if (entry->open_site != NULL) {
+		if (entry->open_site->lifetime == NULL)
+			entry->open_site->lifetime = calloc(1, sizeof(FileTrackHist));
+		if (LIKELY(entry->open_site->lifetime != NULL))
+			hist_record(entry->open_site->lifetime, lifetime_us(entry->open_ns, now_ns));
+	}
+#endif
+
+#ifdef FILETRACK_ENABLE_SHM_REGISTRY
+	shm_record_close(entry->shm_slot);
+	entry->shm_slot = FT_SHM_NO_SLOT;
+#endif
+
+#ifdef FILETRACK_ENABLE_MEMFD_TMPFILE
+	if (entry->memfd >= 0) {
+		memfd_unregister(entry->memfd);
+		entry->memfd = -1;
+	}
+#endif
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	fd_unlink_stream(entry->fd, entry->stream);
+#endif
+
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	if (entry->buffer != NULL) {  /* ストリームは閉じられているか、開き直されて別のバッファを使っている */
+		buffer_put(entry->buffer, entry->buffer_class, entry->buffer_origin);
+		entry->buffer = NULL;
+	}
+#endif
+
+#ifdef FILETRACK_ENABLE_PREFETCH
+	if (entry->prefetch != NULL)  /* fclose 以外で閉じられた */
+		prefetch_detach(entry, -1);
+#endif
+}
+
+
+/*
+ * エントリの内容を作成し、呼び出し元などの集計を開始する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static bool entry_fill (FileTrackEntry* entry, FILE* stream, FileOpenType open_type, const char* filename, const char* mode, size_t filename_len_max, const char* file, int line) {
+#ifdef DEBUG
+	if (filename_len_max < 1) {
+		fprintf(stderr, "filename_len_max must be at least 1.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_entry_add";
+		return false;
+	}
+
+	char* filename_cpy = mutils_strndup(filename, filename_len_max);
+	if (UNLIKELY(filename_cpy == NULL)) {
+		fprintf(stderr, "Failed to duplicate filename string.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_entry_add";
+	}
+
+	char* mode_cpy = mutils_strndup(mode, FT_MODE_LEN_MAX);
+	if (UNLIKELY(mode_cpy == NULL)) {
+		fprintf(stderr, "Failed to duplicate mode string.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_entry_add";
+	}
+#else
+	(void)filename_len_max;
+#endif
+
+	FileTrackSite* open_site = site_get(file, line);
+
+	*entry = (FileTrackEntry){
+		.stream = stream,
+		.open_site = open_site,
+		.open_type = open_type
+#ifdef FT_POPEN_SUPPORTED
+		, 
+		.popen_ns = (open_type == FILE_OPEN_POPEN) ? clock_ns() : 0
+#endif
+#ifdef FILETRACK_ENABLE_LIFETIME_STATS
+		, 
+		.open_ns = coarse_clock_ns(),
+		.mode_change_ns = 0
+#endif
+#ifdef FILETRACK_ENABLE_IO_STATS
+		, 
+		.io = { 0 }
+#endif
+#ifdef DEBUG
+		, 
+		.filename = filename_cpy,
+		.mode = mode_cpy,
+		.open_file = file,
+		.open_line = line,
+		.last_change_mode_file = NULL,
+		.last_change_mode_line = 0,
+		.is_closed = false,
+		.closed_type = FILE_NOT_CLOSED,
+		.close_file = NULL,
+		.close_line = 0
+#endif
+#ifdef FILETRACK_ENABLE_SHM_REGISTRY
+		, 
+		.shm_slot = shm_record_open(stream, open_type, filename, mode, file, line)
+#endif
+	};
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	int tmp_errno = errno;
+	entry->fd = fileno(stream);  /* cookie のストリームは -1 */
+	errno = tmp_errno;
+
+	fd_register(entry->fd, FT_FD_STREAM, open_site, stream, filename);
+#endif
+
+	if (open_site != NULL) {
+		open_site->open_cnt++;
+		open_site->live_cnt++;
+	}
+
+#ifdef FILETRACK_ENABLE_BACKTRACE
+	entry->stack_id = backtrace_capture(open_site);
+#endif
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+	entry->sample_weight = sampling_weight;
+	sampling_weight = 1;
+	if (open_site != NULL) {
+		open_site->sample_open_est += entry->sample_weight;
+		open_site->sample_live_est += entry->sample_weight;
+	}
+	sampling_stats.sampled++;
+	sampling_stats.live_estimate += entry->sample_weight;
+#endif
+
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+	entry->admitted = admission_granted;
+	admission_granted = false;
+#endif
+
+#ifdef FILETRACK_ENABLE_MEMFD_TMPFILE
+	entry->memfd = memfd_pending;
+	memfd_pending = -1;
+	if (entry->memfd >= 0 && UNLIKELY(!memfd_register(entry->memfd, open_site)))
+		entry->memfd = -1;  /* 使用メモリに数えられないだけ */
+#endif
+
+	stream_live_cnt++;
+	if (stream_live_cnt > stream_peak_cnt) stream_peak_cnt = stream_live_cnt;
+	if (stream_live_cnt > stream_interval_peak_cnt) stream_interval_peak_cnt = stream_live_cnt;
+
+#ifdef FILETRACK_ENABLE_NOFILE_ALARM
+	nofile_check();
+#endif
+
+#ifdef FT_POPEN_SUPPORTED
+	if (open_type == FILE_OPEN_POPEN) {
+		if (open_site != NULL) open_site->child_cnt++;
+		if (++popen_live_cnt > popen_peak_cnt) popen_peak_cnt = popen_live_cnt;
+	}
+#endif
+
+#ifdef FILETRACK_ENABLE_IO_STATS
+	io_collect(stream, NULL, true);  /* 同じアドレスを使っていた以前のストリームの残りを捨てる */
+#endif
+
+#if !defined (DEBUG) && !defined (FILETRACK_ENABLE_SHM_REGISTRY)
+	(void)filename;
+	(void)mode;
+#endif
+	return true;
+}
+
+
+/*
+ * 登録できなかったエントリを破棄する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void entry_discard (FileTrackEntry* entry) {
+	entry_release(entry);
+#ifdef DEBUG
+	free(entry->filename);
+	free(entry->mode);
+	entry->filename = NULL;
+	entry->mode = NULL;
+#endif
+}
+
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+/*
+ * 標本に選ぶかどうかを判断せずにエントリを追加する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void entry_add (FILE* stream, FileOpenType open_type, const char* filename, const char* mode, size_t filename_len_max, const char* file, int line) {
+#else
+void filetrack_entry_add (FILE* stream, FileOpenType open_type, const char* filename, const char* mode, size_t filename_len_max, const char* file, int line) {
+#endif
+	if (stream == NULL) {
+		fprintf(stderr, "stream is null! File cannot be tracked!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_entry_add";
+		return;
+	}
+
+	if (UNLIKELY(filetrack_entries == NULL)) init();
+
+	/* 追跡されたまま上書きされるエントリの集計を閉じておく */
+	FileTrackEntry* old_entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+#ifdef DEBUG
+	if (old_entry != NULL && !old_entry->is_closed)
+#else
+	if (old_entry != NULL)
+#endif
+		entry_release(old_entry);
+
+	FileTrackEntry entry;
+	if (!entry_fill(&entry, stream, open_type, filename, mode, filename_len_max, file, line))
+		return;
+
+	if (UNLIKELY(!mht_uint_set(filetrack_entries, (uint_keyt)stream, &entry, sizeof(FileTrackEntry)))) {
+		fprintf(stderr, "Failed to add entry to file tracking.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_entry_add";
+		entry_discard(&entry);
+		return;
+	}
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+	if (old_entry == NULL) sampling_filter_add(stream);  /* 上書きした場合は既に加えてある */
+#endif
+
+#ifdef DEBUG
+	/* tmpfile と fdopen はファイル名不明、popen はコマンド、メモリストリームはファイルではないので記録しない */
+	if (entry.open_type == FILE_OPEN_TMPFILE || entry.open_type == FILE_OPEN_POPEN || entry.open_type == FILE_OPEN_FDOPEN || entry.open_type == FILE_OPEN_FMEMOPEN || entry.open_type == FILE_OPEN_OPEN_MEMSTREAM) return;
+
+	FilenameStreamEntry filename_stream_entry = {
+		.filename = entry.filename,
+		.stream = stream
+	};
+
+	if (UNLIKELY(!mht_str_set(filename_stream_entries, entry.filename, &filename_stream_entry, sizeof(FilenameStreamEntry)))) {
+		filetrack_errfunc = "filetrack_entry_add";
+	}
+#endif
+}
+
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+void filetrack_entry_add (FILE* stream, FileOpenType open_type, const char* filename, const char* mode, size_t filename_len_max, const char* file, int line) {
+	if (stream != NULL && sampling_skip(file, line)) return;
+	entry_add(stream, open_type, filename, mode, filename_len_max, file, line);
+}
+#endif
+
+
+/* 注意: filename == NULL で freopen を使った場合にのみ呼び出す */
+void filetrack_entry_update (FILE* stream, const char* filename, const char* mode, const char* file, int line) {
+	if (filename != NULL) {
+		fprintf(stderr, "filename must be NULL when updating mode with freopen!\nFile: %s   Line: %d\n", file, line);
+		filetrack_unlock();
+		exit(EXIT_FAILURE);
+	}
+
+	if (stream == NULL) {
+		fprintf(stderr, "stream is null! File cannot be closed!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_entry_update";
+		return;
+	}
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+	if (!sampling_filter_check(stream)) return;  /* 標本に選ばれなかったストリーム */
+#endif
+
+	if (UNLIKELY(filetrack_entries == NULL)) {
+		init();
+
+		fprintf(stderr, "No entry found to close! The file might not be tracked.\nFile: %s   Line: %d\n", file, line);
+		errno = EPERM;
+		filetrack_errfunc = "filetrack_entry_update";
+
+		filetrack_entry_add(stream, FILE_OPEN_UNKNOWN, "unknown", mode, 8, file, line);
+		return;
+	}
+
+	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+	if (entry == NULL) {
+#ifdef FILETRACK_ENABLE_SAMPLING
+		return;  /* フィルタの偽陽性 */
+#else
+		fprintf(stderr, "No entry found to close! The file might not be tracked.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_entry_update";
+
+		filetrack_entry_add(stream, FILE_OPEN_UNKNOWN, "unknown", mode, 8, file, line);
+		return;
+#endif
+	}
+
+#ifdef DEBUG
+	free(entry->mode);
+
+	char* mode_cpy = mutils_strndup(mode, FT_MODE_LEN_MAX);
+	if (UNLIKELY(mode_cpy == NULL)) {
+		fprintf(stderr, "Failed to duplicate mode string.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_entry_update";
+	}
+
+	entry->mode = mode_cpy;
+	entry->last_change_mode_file = file;
+	entry->last_change_mode_line = line;
+#endif
+
+#ifdef FILETRACK_ENABLE_LIFETIME_STATS
+	entry->mode_change_ns = coarse_clock_ns();
+#endif
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	/* 開き直しで記述子が変わることがある */
+	fd_unlink_stream(entry->fd, stream);
+	entry->fd = fileno(stream);
+#ifdef DEBUG
+	fd_register(entry->fd, FT_FD_STREAM, entry->open_site, stream, entry->filename);
+#else
+	fd_register(entry->fd, FT_FD_STREAM, entry->open_site, stream, NULL);
+#endif
+#endif
+
+#ifdef FILETRACK_ENABLE_SHM_REGISTRY
+	shm_record_update_mode(entry->shm_slot, mode);
+#endif
+}
+
+
+void filetrack_entry_close (FILE* stream, FileClosedType closed_type, const char* file, int line) {
+	if (stream == NULL) {
+		fprintf(stderr, "stream is null! File cannot be closed!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_entry_close";
+		return;
+	}
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+	if (!sampling_filter_check(stream)) return;  /* 標本に選ばれなかったストリームは探さない */
+#endif
+
+	if (UNLIKELY(filetrack_entries == NULL)) {
+		init();
+
+		fprintf(stderr, "No entry found to close! The file might not be tracked.\nFile: %s   Line: %d\n", file, line);
+		errno = EPERM;
+		filetrack_errfunc = "filetrack_entry_close";
+		return;
+	}
+
+	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+	if (entry == NULL) {
+#ifndef FILETRACK_ENABLE_SAMPLING  /* フィルタの偽陽性 */
+		fprintf(stderr, "No entry found to close! The file might not be tracked.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_entry_close";
+#endif
+		return;
+	}
+
+#ifdef DEBUG
+	if (!entry->is_closed)  /* 閉じ直しで二重に集計しない */
+#endif
+		entry_release(entry);
+
+#ifndef DEBUG
+	if (!mht_uint_delete(filetrack_entries, (uint_keyt)stream))
+		filetrack_errfunc = "filetrack_entry_close";
+#ifdef FILETRACK_ENABLE_SAMPLING
+	sampling_filter_remove(stream);
+#endif
+#else
+	entry->is_closed = true;
+	entry->closed_type = closed_type;
+	entry->close_file = file;
+	entry->close_line = line;
+#endif
+}
+
+
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+/*
+ * fopencookie で包んだストリームの管理情報
+ * エントリはハッシュテーブルではなくここに置かれ、コールバックから直接参照される
+ */
+typedef struct FileTrackCookie {
+	FileTrackEntry entry;
+	FileTrackIoStats io;  /* 実ファイルへの入出力（バッファリング後） */
+	FILE* real;           /* 仮想ハンドルが休止中なら NULL */
+	struct FileTrackCookie* prev;
+	struct FileTrackCookie* next;
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+	char* path;    /* NULL なら仮想ハンドルではない */
+	char mode[FT_MODE_LEN_MAX + 1];
+	off_t offset;  /* 休止中の読み込み位置 */
+	dev_t dev;     /* 開き直したファイルが同じものか確かめる */
+	ino_t ino;
+	struct FileTrackCookie* lru_prev;  /* 実ファイルを開いている仮想ハンドルの一覧 (先頭が最近使われたもの) */
+	struct FileTrackCookie* lru_next;
+	bool busy;     /* コールバックが実ファイルを使っている間は閉じない */
+#endif
+	bool tracked;
+} FileTrackCookie;
+
+
+static FileTrackCookie* cookies = NULL;  /* 開いているもの一覧 */
+static MHashTable* cookie_table = NULL;  /* 外側のストリームで引く、値は FileTrackCookie* */
+
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+	static FileTrackCookie* virtual_lru_head = NULL;
+	static FileTrackCookie* virtual_lru_tail = NULL;
+	static size_t virtual_open_cnt = 0;  /* 実ファイルを開いている仮想ハンドル */
+	static size_t virtual_open_max = 0;  /* 0 なら記述子が足りなくなった時だけ閉じる */
+#endif
+
+#ifdef DEBUG
+	static THREAD_LOCAL bool cookie_closed = false;  /* 直前の fclose がコールバックで処理されたか */
+	static const char* cookie_close_file = NULL;  /* コールバックに渡せない fclose の呼び出し元 */
+	static int cookie_close_line = 0;
+#endif
+
+
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void virtual_lru_unlink (FileTrackCookie* cookie) {
+	if (cookie->lru_prev != NULL) cookie->lru_prev->lru_next = cookie->lru_next;
+	else if (virtual_lru_head == cookie) virtual_lru_head = cookie->lru_next;
+	else return;  /* 一覧に入っていない */
+
+	if (cookie->lru_next != NULL) cookie->lru_next->lru_prev = cookie->lru_prev;
+	else virtual_lru_tail = cookie->lru_prev;
+
+	cookie->lru_prev = NULL;
+	cookie->lru_next = NULL;
+	virtual_open_cnt--;
+}
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void virtual_lru_push (FileTrackCookie* cookie) {
+	cookie->lru_prev = NULL;
+	cookie->lru_next = virtual_lru_head;
+	if (virtual_lru_head != NULL) virtual_lru_head->lru_prev = cookie;
+	else virtual_lru_tail = cookie;
+	virtual_lru_head = cookie;
+	virtual_open_cnt++;
+}
+
+
+/*
+ * 使われていない仮想ハンドルのうち最も古いものの実ファイルを閉じる
+ * 閉じられるものがなければ false を返す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static bool virtual_park_lru (const FileTrackCookie* except) {
+	FileTrackCookie* cookie = virtual_lru_tail;
+	while (cookie != NULL && (cookie->busy || cookie == except))
+		cookie = cookie->lru_prev;
+	if (cookie == NULL) return false;
+
+	int tmp_errno = errno;
+
+	off_t offset = ftello(cookie->real);  /* 内側はバッファなしなので正確 */
+	if (UNLIKELY(offset < 0)) {
+		errno = tmp_errno;
+		return false;
+	}
+
+	virtual_lru_unlink(cookie);
+	fclose(cookie->real);
+	cookie->real = NULL;
+	cookie->offset = offset;
+
+	if (cookie->entry.open_site != NULL)
+		cookie->entry.open_site->virtual_park_cnt++;
+
+	errno = tmp_errno;
+	return true;
+}
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void virtual_enforce_max (const FileTrackCookie* except) {
+	while (virtual_open_max > 0 && virtual_open_cnt > virtual_open_max) {
+		if (!virtual_park_lru(except)) break;
+	}
+}
+
+
+/*
+ * 記述子が足りずに開けなかった場合に、仮想ハンドルを 1 つ休止させて再試行してよいか
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static bool virtual_make_room (int open_errno, const FileTrackCookie* except) {
+	if (open_errno != EMFILE && open_errno != ENFILE) return false;
+	return virtual_park_lru(except);
+}
+
+
+/*
+ * コールバックで実ファイルを使う前に呼び出す
+ * 休止中なら開き直して元の位置に戻す
+ */
+static bool virtual_acquire (FileTrackCookie* cookie) {
+	filetrack_lock();
+
+	if (cookie->real == NULL) {
+		FILE* real;
+		while ((real = fopen(cookie->path, cookie->mode)) == NULL) {
+			if (!virtual_make_room(errno, cookie)) {
+				filetrack_unlock();
+				return false;
+			}
+		}
+
+		/* 相対パスは作業ディレクトリが変わると別のファイルを指すので、開いた時と同じファイルか確かめる */
+		struct stat st;
+		if (fstat(fileno(real), &st) != 0 || st.st_dev != cookie->dev || st.st_ino != cookie->ino) {
+			fclose(real);
+			errno = ESTALE;
+			filetrack_unlock();
+			return false;
+		}
+
+		if (UNLIKELY(setvbuf(real, NULL, _IONBF, 0) != 0 || fseeko(real, cookie->offset, SEEK_SET) != 0)) {
+			int tmp_errno = errno;
+			fclose(real);
+			errno = tmp_errno;
+			filetrack_unlock();
+			return false;
+		}
+
+		cookie->real = real;
+		virtual_lru_push(cookie);
+		if (cookie->entry.open_site != NULL)
+			cookie->entry.open_site->virtual_reopen_cnt++;
+	} else {
+		/* 最近使われたものとして先頭に移す */
+		virtual_lru_unlink(cookie);
+		virtual_lru_push(cookie);
+	}
+
+	cookie->busy = true;
+	virtual_enforce_max(cookie);
+
+	filetrack_unlock();
+	return true;
+}
+
+
+static void virtual_release (FileTrackCookie* cookie) {
+	filetrack_lock();
+	cookie->busy = false;
+	filetrack_unlock();
+}
+
+
+/* 読み込み専用で開かれたものだけを仮想ハンドルにする */
+static bool virtual_mode_check (const char* mode) {
+	size_t mode_len = mutils_strnlen(mode, FT_MODE_LEN_MAX);
+	return mode_len > 0 && mode[0] == 'r' && memchr(mode, '+', mode_len) == NULL;
+}
+
+
+/*
+ * 仮想ハンドルとして登録する
+ * 失敗した場合は通常の cookie のストリームとして扱う
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void virtual_init (FileTrackCookie* cookie, const char* filename, const char* mode, size_t filename_len_max) {
+	struct stat st;
+	if (UNLIKELY(fstat(fileno(cookie->real), &st) != 0)) return;
+
+	cookie->path = mutils_strndup(filename, filename_len_max);
+	if (UNLIKELY(cookie->path == NULL)) return;
+
+	cookie->dev = st.st_dev;
+	cookie->ino = st.st_ino;
+
+	size_t mode_len = mutils_strnlen(mode, FT_MODE_LEN_MAX);
+	memcpy(cookie->mode, mode, mode_len);
+	cookie->mode[mode_len] = '\0';
+
+	virtual_lru_push(cookie);
+	virtual_enforce_max(cookie);
+}
+
+
+void filetrack_virtual_handles_set (size_t max_open) {
+	filetrack_lock();
+	virtual_open_max = max_open;
+	virtual_enforce_max(NULL);
+	filetrack_unlock();
+}
+#endif
+
+
+static ssize_t cookie_read (void* arg, char* buf, size_t size) {
+	FileTrackCookie* cookie = (FileTrackCookie*)arg;
+
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+	if (cookie->path != NULL && !virtual_acquire(cookie)) return -1;
+#endif
+
+	size_t result = fread(buf, 1, size, cookie->real);
+	cookie->io.read_calls++;
+	cookie->io.bytes_read += result;
+	bool failed = (result == 0 && ferror(cookie->real));
+
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+	if (cookie->path != NULL) virtual_release(cookie);
+#endif
+
+	if (failed) return -1;
+	return (ssize_t)result;
+}
+
+
+static ssize_t cookie_write (void* arg, const char* buf, size_t size) {
+	FileTrackCookie* cookie = (FileTrackCookie*)arg;
+
+	size_t result = fwrite(buf, 1, size, cookie->real);
+	cookie->io.write_calls++;
+	cookie->io.bytes_written += result;
+
+	if (result == 0 && size > 0) return -1;
+	return (ssize_t)result;
+}
+
+
+static int cookie_seek (void* arg, off64_t* offset, int whence) {
+	FileTrackCookie* cookie = (FileTrackCookie*)arg;
+
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+	if (cookie->path != NULL) {
+		/* 休止中でも末尾からの移動でなければ開き直さずに位置だけ変える */
+		filetrack_lock();
+		if (cookie->real == NULL && whence != SEEK_END) {
+			off64_t position = (whence == SEEK_CUR) ? (off64_t)cookie->offset + *offset : *offset;
+			if (position >= 0) cookie->offset = (off_t)position;
+			filetrack_unlock();
+
+			if (position < 0) {
+				errno = EINVAL;
+				return -1;
+			}
+			*offset = position;
+			return 0;
+		}
+		filetrack_unlock();
+
+		if (!virtual_acquire(cookie)) return -1;
+	}
+#endif
+
+	cookie->io.seek_calls++;
+	int result = fseeko(cookie->real, (off_t)*offset, whence);
+
+	off_t position = (result == 0) ? ftello(cookie->real) : -1;
+
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+	if (cookie->path != NULL) virtual_release(cookie);
+#endif
+
+	if (position < 0) return -1;
+
+	*offset = (off64_t)position;
+	return 0;
+}
+
+
+/*
+ * 開いているものの一覧と表から外す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void cookie_unlink (FileTrackCookie* cookie) {
+	if (cookie->prev != NULL) cookie->prev->next = cookie->next;
+	else if (cookies == cookie) cookies = cookie->next;
+	if (cookie->next != NULL) cookie->next->prev = cookie->prev;
+	cookie->prev = NULL;
+	cookie->next = NULL;
+	cookie->tracked = false;
+
+	if (cookie_table != NULL && UNLIKELY(!mht_uint_delete(cookie_table, (uint_keyt)cookie->entry.stream)))
+		filetrack_errfunc = "filetrack_fclose";
+}
+
+
+#ifdef DEBUG
+/*
+ * 閉じたストリームのエントリを閉じた印を付けて表に残し、二重に閉じたことを検出できるようにする
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void cookie_tombstone (FileTrackCookie* cookie) {
+	FileTrackEntry* entry = &cookie->entry;
+	entry->is_closed = true;
+	entry->closed_type = FILE_CLOSED_FCLOSE;
+	entry->close_file = (cookie_close_file != NULL) ? cookie_close_file : "unknown";
+	entry->close_line = cookie_close_line;
+	cookie_close_file = NULL;
+	cookie_close_line = 0;
+
+	/* ファイル名などの文字列は表のエントリに引き継ぐ */
+	if (filetrack_entries == NULL || UNLIKELY(!mht_uint_set(filetrack_entries, (uint_keyt)entry->stream, entry, sizeof(FileTrackEntry)))) {
+		filetrack_errfunc = "filetrack_fclose";
+		free(entry->filename);
+		free(entry->mode);
+	}
+	entry->filename = NULL;
+	entry->mode = NULL;
+}
+#endif
+
+
+/* 重要: filetrack_fclose などからロック中に呼ばれる */
+static int cookie_close (void* arg) {
+	FileTrackCookie* cookie = (FileTrackCookie*)arg;
+
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+	int result = 0;
+	if (cookie->real != NULL) {  /* 休止中なら既に閉じている */
+		virtual_lru_unlink(cookie);
+		result = fclose(cookie->real);
+	}
+	free(cookie->path);
+#else
+	int result = fclose(cookie->real);
+#endif
+
+	if (cookie->tracked) {
+		if (cookie->entry.open_site != NULL)
+			io_stats_add(&cookie->entry.open_site->sys_io, &cookie->io);
+
+#ifdef DEBUG
+		entry_release(&cookie->entry);
+		cookie_tombstone(cookie);
+#else
+		entry_discard(&cookie->entry);
+#endif
+		cookie_unlink(cookie);
+	}
+
+	free(cookie);
+
+#ifdef DEBUG
+	cookie_closed = true;
+#endif
+	return result;
+}
+
+
+/*
+ * fopencookie に渡すモードは先頭の文字と '+' の有無だけで決まる
+ * tmpfile の "(tmpfile)" のように解釈できないものは "w+" として扱う
+ */
+static void cookie_mode_get (const char* mode, char cookie_mode[3]) {
+	size_t mode_len = mutils_strnlen(mode, FT_MODE_LEN_MAX);
+
+	if (mode_len == 0 || (mode[0] != 'r' && mode[0] != 'w' && mode[0] != 'a')) {
+		memcpy(cookie_mode, "w+", 3);
+		return;
+	}
+
+	cookie_mode[0] = mode[0];
+	cookie_mode[1] = (memchr(mode, '+', mode_len) != NULL) ? '+' : '\0';
+	cookie_mode[2] = '\0';
+}
+
+
+/*
+ * real を包んだストリームを返す
+ * 失敗した場合は NULL を返し、real はそのまま残る
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static FILE* cookie_wrap (FILE* real, FileOpenType open_type, const char* filename, const char* mode, size_t filename_len_max, const char* file, int line) {
+	if (UNLIKELY(filetrack_entries == NULL)) init();
+
+	FileTrackCookie* cookie = calloc(1, sizeof(FileTrackCookie));
+	if (UNLIKELY(cookie == NULL)) return NULL;
+
+	/* 外側のバッファだけを使い、コールバック 1 回が実ファイルへの入出力 1 回になるようにする */
+	if (UNLIKELY(setvbuf(real, NULL, _IONBF, 0) != 0)) {
+		free(cookie);
+		return NULL;
+	}
+
+	cookie->real = real;
+
+	char cookie_mode[3];
+	cookie_mode_get(mode, cookie_mode);
+
+	cookie_io_functions_t functions = {
+		.read = cookie_read,
+		.write = cookie_write,
+		.seek = cookie_seek,
+		.close = cookie_close
+	};
+
+	FILE* stream = fopencookie(cookie, cookie_mode, functions);
+	if (UNLIKELY(stream == NULL)) {
+		free(cookie);
+		return NULL;
+	}
+
+#ifdef DEBUG
+	/* 同じアドレスで閉じられた以前のストリームの記録は、filetrack_entry_add と同じく新しいストリームで置き換える */
+	FileTrackEntry* stale = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+	if (stale != NULL) {
+		if (!stale->is_closed) entry_release(stale);
+		free(stale->filename);
+		free(stale->mode);
+		if (UNLIKELY(!mht_uint_delete(filetrack_entries, (uint_keyt)stream)))
+			filetrack_errfunc = "filetrack_entry_add";
+	}
+#endif
+
+	if (UNLIKELY(cookie_table == NULL)) {
+		cookie_table = mht_uint_create(FILETRACK_ENTRIES_COUNT);
+		if (UNLIKELY(cookie_table == NULL)) filetrack_errfunc = "filetrack_entry_add";
+	}
+
+	cookie->tracked = entry_fill(&cookie->entry, stream, open_type, filename, mode, filename_len_max, file, line);
+	if (cookie->tracked && UNLIKELY(cookie_table == NULL || !mht_uint_set(cookie_table, (uint_keyt)stream, &cookie, sizeof(FileTrackCookie*)))) {
+		fprintf(stderr, "Failed to add entry to file tracking.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_entry_add";
+		entry_discard(&cookie->entry);
+		cookie->tracked = false;
+	}
+	if (cookie->tracked) {
+		cookie->next = cookies;
+		if (cookies != NULL) cookies->prev = cookie;
+		cookies = cookie;
+	}
+
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+	if (open_type == FILE_OPEN_FOPEN && virtual_mode_check(mode))
+		virtual_init(cookie, filename, mode, filename_len_max);
+#endif
+	return stream;
+}
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static FileTrackCookie* cookie_find (const FILE* stream) {
+	if (cookie_table == NULL || stream == NULL) return NULL;
+
+	FileTrackCookie** cookie = mht_uint_get(cookie_table, (uint_keyt)stream);
+	return (cookie != NULL) ? *cookie : NULL;
+}
+
+
+#ifdef FILETRACK_ENABLE_IO_STATS
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static FileTrackEntry* cookie_entry_find (const FILE* stream) {
+	FileTrackCookie* cookie = cookie_find(stream);
+	return (cookie != NULL) ? &cookie->entry : NULL;
+}
+#endif
+#endif
+
+#ifdef FT_POPEN_SUPPORTED
+/*
+ * 追跡中で開いているストリームの開き方を返す
+ * 追跡していない場合は FILE_NOT_OPEN を返す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static FileOpenType entry_open_type_get (FILE* stream) {
+	if (filetrack_entries == NULL) return FILE_NOT_OPEN;
+
+	const FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	if (entry == NULL) {  /* cookie のストリームの記録は表ではなく cookie にある */
+		const FileTrackCookie* cookie = cookie_find(stream);
+		if (cookie != NULL && cookie->tracked) entry = &cookie->entry;
+	}
+#endif
+	if (entry == NULL) return FILE_NOT_OPEN;
+#ifdef DEBUG
+	if (entry->is_closed) return FILE_NOT_OPEN;
+#endif
+	return entry->open_type;
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_NEGATIVE_CACHE
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static FileTrackNegativeEntry* negative_find (const char* path) {
+	if (negative_entries == NULL) return NULL;
+
+	str_keyt key = {
+		.ptr = path,
+		.len = strlen(path)
+	};
+	return mht_str_get(negative_entries, key);
+}
+
+
+/*
+ * 有効期限内に ENOENT が記録されているファイル名なら true を返す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static bool negative_check (const char* path) {
+	FileTrackNegativeEntry* negative = negative_find(path);
+	if (negative == NULL || negative->expire_ns == 0) return false;
+
+	if (coarse_clock_ns() < negative->expire_ns) return true;
+
+	negative->expire_ns = 0;  /* 期限切れ */
+	return false;
+}
+
+
+/*
+ * 一杯になった表を、無効なものと期限切れのものを除いて作り直す
+ * それでも空きがなければ、記録の古い方から平均以下のものを捨てる
+ * 空きができなければ false を返す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static bool negative_reclaim (uint64_t now_ns) {
+	size_t count = 0;
+	FileTrackNegativeEntry** all = (FileTrackNegativeEntry**)mht_all_get(negative_entries, &count);
+	if (UNLIKELY(all == NULL)) return false;
+
+	FileTrackNegativeEntry* kept = malloc(sizeof(FileTrackNegativeEntry) * (count + 1));
+	if (UNLIKELY(kept == NULL)) {
+		mht_all_release_arr(all);
+		return false;
+	}
+
+	size_t kept_cnt = 0;
+	uint64_t expire_sum = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (all[i]->expire_ns == 0 || all[i]->expire_ns <= now_ns) {
+			free(all[i]->path);
+			continue;
+		}
+		kept[kept_cnt++] = *all[i];
+		expire_sum += (all[i]->expire_ns - now_ns);
+	}
+	mht_all_release_arr(all);
+
+	if (kept_cnt >= FT_NEGATIVE_CACHE_MAX) {  /* TTL は共通なので期限の早いものほど古い */
+		uint64_t expire_mean = now_ns + expire_sum / kept_cnt;
+		size_t j = 0;
+		for (size_t i = 0; i < kept_cnt; i++) {
+			if (kept[i].expire_ns <= expire_mean) free(kept[i].path);
+			else kept[j++] = kept[i];
+		}
+		kept_cnt = j;
+	}
+
+	mht_destroy(negative_entries);
+	negative_entries = mht_str_create(FT_NEGATIVE_CACHE_MAX);
+	negative_entries_cnt = 0;
+
+	for (size_t i = 0; i < kept_cnt; i++) {
+		if (LIKELY(negative_entries != NULL && mht_str_set(negative_entries, kept[i].path, &kept[i], sizeof(FileTrackNegativeEntry))))
+			negative_entries_cnt++;
+		else
+			free(kept[i].path);
+	}
+	free(kept);
+
+	return negative_entries != NULL;
+}
+
+
+/*
+ * fopen が ENOENT で失敗したことを記録する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void negative_record (const char* path) {
+	if (negative_ttl_ns == 0) return;
+
+	uint64_t now_ns = coarse_clock_ns();
+	uint64_t expire_ns = now_ns + negative_ttl_ns;
+
+	FileTrackNegativeEntry* negative = negative_find(path);
+	if (negative != NULL) {  /* 同じファイル名の要素は削除せずに使い回す */
+		negative->expire_ns = expire_ns;
+		return;
+	}
+
+	int tmp_errno = errno;
+
+	if (negative_entries_cnt >= FT_NEGATIVE_CACHE_MAX && !negative_reclaim(now_ns)) {
+		errno = tmp_errno;
+		return;
+	}
+
+	if (negative_entries == NULL) {
+		negative_entries = mht_str_create(FT_NEGATIVE_CACHE_MAX);
+		if (UNLIKELY(negative_entries == NULL)) {
+			errno = tmp_errno;
+			return;  /* 記録できなくても fopen の結果は変わらない */
+		}
+	}
+
+	FileTrackNegativeEntry entry = {
+		.path = mutils_strndup(path, strlen(path)),
+		.expire_ns = expire_ns
+	};
+	if (UNLIKELY(entry.path == NULL)) {
+		errno = tmp_errno;
+		return;
+	}
+
+	if (LIKELY(mht_str_set(negative_entries, entry.path, &entry, sizeof(FileTrackNegativeEntry))))
+		negative_entries_cnt++;
+	else
+		free(entry.path);
+
+	errno = tmp_errno;
+}
+
+
+/*
+ * ファイルが作成された可能性がある場合に記録を無効にする
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void negative_invalidate (const char* path) {
+	FileTrackNegativeEntry* negative = negative_find(path);
+	if (negative != NULL) negative->expire_ns = 0;
+}
+
+
+/* ファイルが無ければ作成するモードなら true を返す */
+static bool negative_mode_creates (const char* mode) {
+	return mode[0] == 'w' || mode[0] == 'a';
+}
+
+
+static void negative_quit (void) {
+	if (negative_entries == NULL) return;
+
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	int tmp_errno = errno;
+#endif
+	errno = 0;
+
+	size_t count = 0;
+	FileTrackNegativeEntry** all = (FileTrackNegativeEntry**)mht_all_get(negative_entries, &count);
+	if (all != NULL) {
+		for (size_t i = 0; i < count; i++)
+			free(all[i]->path);
+		mht_all_release_arr(all);
+	}
+
+	mht_destroy(negative_entries);
+
+	if (UNLIKELY(errno != 0)) filetrack_errfunc = "quit";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	else errno = tmp_errno;
+#endif
+
+	negative_entries = NULL;
+	negative_entries_cnt = 0;
+}
+
+
+void filetrack_negative_cache_ttl_set (uint64_t ttl_ms) {
+	filetrack_lock();
+	negative_ttl_ns = ttl_ms * 1000000u;
+
+	if (negative_ttl_ns == 0 && negative_entries != NULL) {  /* 記録済みのものも使わない */
+		size_t count = 0;
+		FileTrackNegativeEntry** all = (FileTrackNegativeEntry**)mht_all_get(negative_entries, &count);
+		if (all != NULL) {
+			for (size_t i = 0; i < count; i++)
+				all[i]->expire_ns = 0;
+			mht_all_release_arr(all);
+		}
+	}
+	filetrack_unlock();
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+/*
+ * 開いたばかりのストリームに、呼び出し元ごとに設定された大きさのバッファをプールから割り当てる
+ * cookie で包んだ場合は、システムコールの回数を決める実ファイルの方に割り当てる
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void buffer_assign (FILE* stream) {
+	if (stream == NULL || filetrack_entries == NULL) return;
+
+	FILE* real = stream;
+	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	if (entry == NULL) {
+		FileTrackCookie* cookie = cookie_find(stream);
+		if (cookie == NULL || !cookie->tracked) return;
+		entry = &cookie->entry;
+		real = cookie->real;
+	}
+#endif
+	if (entry == NULL || real == NULL || entry->buffer != NULL) return;
+#ifdef DEBUG
+	if (entry->is_closed) return;
+#endif
+
+	FileTrackSite* site = entry->open_site;
+	size_t size = (site != NULL && site->buffer_size_set) ? site->buffer_size : buffer_default_size;
+	if (size == 0) return;  /* stdio に任せる */
+
+	int index = buffer_class(size);
+	if (index < 0) return;
+
+	uint8_t origin;
+	bool hit;
+	void* buffer = buffer_take(index, &origin, &hit);
+	if (UNLIKELY(buffer == NULL)) return;
+
+	int tmp_errno = errno;
+	if (UNLIKELY(setvbuf(real, buffer, _IOFBF, (size_t)1 << (index + FT_BUFFER_CLASS_MIN_BITS)) != 0)) {
+		errno = tmp_errno;
+		buffer_put(buffer, index, origin);
+		return;
+	}
+	errno = tmp_errno;
+
+	entry->buffer = buffer;
+	entry->buffer_class = (uint8_t)index;
+	entry->buffer_origin = origin;
+
+	if (hit) buffer_pool_stats.hits++;
+	else buffer_pool_stats.misses++;
+	if (site != NULL) {
+		if (hit) site->buffer_hit_cnt++;
+		else site->buffer_miss_cnt++;
+	}
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_FADVISE
+/* 呼び出し元で学習した使われ方、十分に観測していなければ FT_PATTERN_UNKNOWN */
+static FileTrackAccessPattern fadvise_site_pattern (const FileTrackSite* site) {
+	if (site == NULL || site->pattern_observed_cnt < FT_FADVISE_LEARN_MIN) return FT_PATTERN_UNKNOWN;
+
+	uint64_t quorum = (site->pattern_observed_cnt * 3u + 3u) / 4u;  /* 4 分の 3 以上が同じ使われ方 */
+	if (site->pattern_write_once_cnt >= quorum) return FT_PATTERN_WRITE_ONCE;
+	if (site->pattern_seq_cnt >= quorum) return FT_PATTERN_SEQUENTIAL;
+	if (site->pattern_random_cnt >= quorum) return FT_PATTERN_RANDOM;
+	return FT_PATTERN_UNKNOWN;
+}
+
+
+/* 連続して読まれ、ほとんど最後まで読まれる呼び出し元なら true を返す */
+static bool fadvise_site_reads_through (const FileTrackSite* site) {
+	return fadvise_site_pattern(site) == FT_PATTERN_SEQUENTIAL && site->pattern_full_read_cnt * 4u >= site->pattern_seq_cnt * 3u;
+}
+
+
+/* fd のページキャッシュにあるページ数を返す、調べられなければ -1 を返す */
+static int64_t fadvise_cached_pages (int fd) {
+#if defined (__linux__) && defined (__NR_cachestat)
+	/* 古いヘッダーとの衝突を避けるため、カーネルと同じ配置の構造体を自前で用意する */
+	struct {
+		uint64_t off;
+		uint64_t len;  /* 0 ならファイルの終わりまで */
+	} range = { 0, 0 };
+	struct {
+		uint64_t nr_cache;
+		uint64_t nr_dirty;
+		uint64_t nr_writeback;
+		uint64_t nr_evicted;
+		uint64_t nr_recently_evicted;
+	} cstat;
+
+	int tmp_errno = errno;
+	long result = syscall(__NR_cachestat, fd, &range, &cstat, 0);
+	errno = tmp_errno;
+	if (result != 0) return -1;  /* Linux 6.5 より前 */
+	return (int64_t)cstat.nr_cache;
+#else
+	(void)fd;
+	return -1;
+#endif
+}
+
+
+/*
+ * 呼び出し元で学習した使われ方に合わせて、開いたばかりのストリームにヒントを与える
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void fadvise_open (FILE* stream, const char* mode) {
+	if (stream == NULL || filetrack_entries == NULL) return;
+
+	FILE* real = stream;
+	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	if (entry == NULL) {
+		FileTrackCookie* cookie = cookie_find(stream);
+		if (cookie == NULL || !cookie->tracked) return;
+		entry = &cookie->entry;
+		real = cookie->real;
+	}
+#endif
+	if (entry == NULL || real == NULL) return;
+#ifdef DEBUG
+	if (entry->is_closed) return;
+#endif
+
+	size_t mode_len = mutils_strnlen(mode, FT_MODE_LEN_MAX);
+	if (mode_len > 0 && (mode[0] == 'w' || mode[0] == 'a') && memchr(mode, '+', mode_len) == NULL)
+		entry->fadvise_write_only = true;
+
+	FileTrackSite* site = entry->open_site;
+	FileTrackAccessPattern pattern = fadvise_site_pattern(site);
+	if (pattern == FT_PATTERN_UNKNOWN) return;
+
+	int tmp_errno = errno;
+	int fd = fileno(real);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		errno = tmp_errno;
+		return;
+	}
+
+	int advice;
+	switch (pattern) {
+		case FT_PATTERN_SEQUENTIAL:
+			advice = POSIX_FADV_SEQUENTIAL;
+			break;
+		case FT_PATTERN_RANDOM:
+			advice = POSIX_FADV_RANDOM;
+			break;
+		default:  /* FT_PATTERN_WRITE_ONCE */
+			advice = POSIX_FADV_NOREUSE;
+			break;
+	}
+
+	if (posix_fadvise(fd, 0, 0, advice) == 0) {
+		site->fadvise_hint_cnt++;
+		if (pattern == FT_PATTERN_SEQUENTIAL) fadvise_stats.sequential_hints++;
+		else if (pattern == FT_PATTERN_RANDOM) fadvise_stats.random_hints++;
+		else fadvise_stats.noreuse_hints++;
+	}
+
+#if defined (__linux__) && !defined (FILETRACK_ENABLE_PREFETCH)  /* 有効ならバックグラウンドで先読みする */
+	/* ほとんど最後まで読まれる呼び出し元なら、先頭から先に読み込ませておく */
+	if (fadvise_readahead && fadvise_site_reads_through(site) && st.st_size > 0) {
+		size_t length = ((uint64_t)st.st_size < FT_FADVISE_READAHEAD_MAX) ? (size_t)st.st_size : FT_FADVISE_READAHEAD_MAX;
+		if (readahead(fd, 0, length) == 0)
+			fadvise_stats.readahead_bytes += length;
+	}
+#endif
+
+	errno = tmp_errno;
+}
+
+
+/*
+ * 閉じる直前のストリームの使われ方を呼び出し元に記録し、書き込むだけのファイルならページキャッシュから落とす
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void fadvise_close (FILE* stream) {
+	if (stream == NULL || filetrack_entries == NULL) return;
+
+	FILE* real = stream;
+	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	if (entry == NULL) {
+		FileTrackCookie* cookie = cookie_find(stream);
+		if (cookie == NULL || !cookie->tracked) return;
+		entry = &cookie->entry;
+		real = cookie->real;  /* 休止中の仮想ハンドルは NULL */
+	}
+#endif
+	if (entry == NULL || entry->open_type != FILE_OPEN_FOPEN) return;
+#ifdef DEBUG
+	if (entry->is_closed) return;
+#endif
+
+	io_collect(entry->stream, entry, false);  /* 最新の読み込みとシークの回数 */
+
+	int tmp_errno = errno;
+	int fd = (real != NULL) ? fileno(real) : -1;
+	struct stat st;
+	bool regular = (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode));
+
+	FileTrackSite* site = entry->open_site;
+	if (site != NULL && (entry->io.read_calls > 0 || entry->io.write_calls > 0)) {
+		site->pattern_observed_cnt++;
+		if (entry->fadvise_write_only && entry->io.read_calls == 0) {
+			site->pattern_write_once_cnt++;
+		} else if (entry->far_seek_cnt >= FT_FADVISE_RANDOM_SEEKS && entry->far_seek_cnt * 4u >= entry->io.read_calls) {
+			site->pattern_random_cnt++;
+		} else if (entry->far_seek_cnt == 0 && entry->io.read_calls > 0) {
+			site->pattern_seq_cnt++;
+			if (regular && entry->io.bytes_read * 2u >= (uint64_t)st.st_size)  /* 半分以上読まれた */
+				site->pattern_full_read_cnt++;
+		}
+	}
+
+	/* 書き出しが終わっていないページは落とせないので、カーネルが書き出しを始めるだけのこともある */
+	if (regular && entry->fadvise_write_only && entry->io.read_calls == 0 && entry->io.bytes_written > 0 && fflush(stream) == 0 && (real == stream || fflush(real) == 0)) {
+		int64_t before = fadvise_cached_pages(fd);
+		if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0) {
+			fadvise_stats.dontneed_calls++;
+			fadvise_stats.dontneed_bytes += (uint64_t)st.st_size;
+			int64_t after = (before >= 0) ? fadvise_cached_pages(fd) : -1;
+			if (after >= 0 && before > after) fadvise_stats.pages_dropped += (uint64_t)(before - after);
+		}
+	}
+
+	errno = tmp_errno;
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_PREFETCH
+/*
+ * 読み込み専用で開いたばかりのストリームの先頭を、バックグラウンドでページキャッシュに読み込ませる
+ * 呼び出し元に大きさが設定されているか、最後まで読まれることを学習している場合のみ
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void prefetch_open (FILE* stream, const char* mode) {
+	if (stream == NULL || filetrack_entries == NULL) return;
+
+	size_t mode_len = mutils_strnlen(mode, FT_MODE_LEN_MAX);
+	if (mode_len == 0 || mode[0] != 'r' || memchr(mode, '+', mode_len) != NULL) return;
+
+	FILE* real = stream;
+	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	if (entry == NULL) {
+		FileTrackCookie* cookie = cookie_find(stream);
+		if (cookie == NULL || !cookie->tracked) return;
+		entry = &cookie->entry;
+		real = cookie->real;
+	}
+#endif
+	if (entry == NULL || real == NULL || entry->prefetch != NULL) return;
+#ifdef DEBUG
+	if (entry->is_closed) return;
+#endif
+
+	FileTrackSite* site = entry->open_site;
+	if (site == NULL) return;
+
+	uint64_t length = 0;
+	if (site->prefetch_size_set) length = site->prefetch_size;
+#ifdef FILETRACK_ENABLE_FADVISE
+	else if (fadvise_readahead && fadvise_site_reads_through(site)) length = FT_FADVISE_READAHEAD_MAX;
+#endif
+	if (length == 0) return;
+
+	int tmp_errno = errno;
+	int fd = fileno(real);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		errno = tmp_errno;
+		return;
+	}
+	if ((uint64_t)st.st_size < length) length = (uint64_t)st.st_size;
+
+	FileTrackPrefetchJob* job = malloc(sizeof(FileTrackPrefetchJob));
+	if (UNLIKELY(job == NULL)) {
+		errno = tmp_errno;
+		return;
+	}
+
+	*job = (FileTrackPrefetchJob){
+		.prev = NULL,
+		.next = NULL,
+		.length = length,
+		.done = 0,
+		.fd = fcntl(fd, F_DUPFD_CLOEXEC, 0),  /* ストリームが先に閉じられても読み続けられるように */
+		.state = FT_PREFETCH_QUEUED,
+		.cancel = false,
+		.orphan = false
+	};
+	if (UNLIKELY(job->fd < 0)) {
+		errno = tmp_errno;
+		free(job);
+		return;
+	}
+
+	pthread_mutex_lock(&prefetch_mutex);
+	bool started = !prefetch_stopping && prefetch_workers_start();
+	if (LIKELY(started)) {
+		job->prev = prefetch_tail;
+		if (prefetch_tail != NULL) prefetch_tail->next = job;
+		else prefetch_head = job;
+		prefetch_tail = job;
+		pthread_cond_signal(&prefetch_cond);
+	}
+	pthread_mutex_unlock(&prefetch_mutex);
+
+	if (UNLIKELY(!started)) {  /* 終了処理中、またはスレッドを作れない場合 */
+		close(job->fd);
+		free(job);
+		errno = tmp_errno;
+		return;
+	}
+	errno = tmp_errno;
+
+	entry->prefetch = job;
+	site->prefetch_cnt++;
+	prefetch_stats.files++;
+}
+
+
+/*
+ * 閉じる直前のストリームが読み進めた位置を記録し、終わっていない先読みを取り消す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void prefetch_close (FILE* stream) {
+	if (stream == NULL || filetrack_entries == NULL) return;
+
+	FILE* real = stream;
+	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	FileTrackCookie* cookie = NULL;
+	if (entry == NULL) {
+		cookie = cookie_find(stream);
+		if (cookie == NULL || !cookie->tracked) return;
+		entry = &cookie->entry;
+		real = cookie->real;  /* 外側の ftell は仮想ハンドルのコールバックでロックを取るので、内側の位置を使う */
+	}
+#endif
+	if (entry == NULL || entry->prefetch == NULL) return;
+
+	int tmp_errno = errno;
+	off_t consumed = -1;  /* 読み込み専用なので読み進めた位置 */
+	if (real != NULL) consumed = ftello(real);
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+	else if (cookie != NULL) consumed = cookie->offset;  /* 休止中 */
+#endif
+	errno = tmp_errno;
+
+	prefetch_detach(entry, (consumed >= 0) ? (int64_t)consumed : -1);
+}
+#endif
+
+
+/*
+ * fopen で開いたストリームの追跡を開始し、利用者に返すストリームを返す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static FILE* fopen_track (FILE* stream, const char* filename, const char* mode, size_t filename_len_max, const char* file, int line) {
+#ifdef FILETRACK_ENABLE_SAMPLING
+	if (sampling_skip(file, line)) return stream;  /* 追跡しないストリームは cookie で包まず、ヒントなども与えない */
+#endif
+
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+#ifdef FILETRACK_ENABLE_STREAM_CACHE
+	FILE* cookie_stream = stream_cache_opening ? NULL : cookie_wrap(stream, FILE_OPEN_FOPEN, filename, mode, filename_len_max, file, line);  /* cookie で包むと閉じずに残せない */
+#else
+	FILE* cookie_stream = cookie_wrap(stream, FILE_OPEN_FOPEN, filename, mode, filename_len_max, file, line);
+#endif
+	if (cookie_stream != NULL) {
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+		buffer_assign(cookie_stream);
+#endif
+#ifdef FILETRACK_ENABLE_FADVISE
+		fadvise_open(cookie_stream, mode);
+#endif
+#ifdef FILETRACK_ENABLE_PREFETCH
+		prefetch_open(cookie_stream, mode);
+#endif
+		return cookie_stream;
+	}  /* 失敗した場合は通常の方法で追跡する */
+#endif
+
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	int tmp_errno = errno;
+#endif
+	errno = 0;
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+	entry_add(stream, FILE_OPEN_FOPEN, filename, mode, filename_len_max, file, line);  /* 既に標本に選ばれている */
+#else
+	filetrack_entry_add(stream, FILE_OPEN_FOPEN, filename, mode, filename_len_max, file, line);
+#endif
+
+	if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_fopen";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	else errno = tmp_errno;
+#endif
+
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	buffer_assign(stream);  /* 追跡できなかった場合は何もしない */
+#endif
+#ifdef FILETRACK_ENABLE_FADVISE
+	fadvise_open(stream, mode);
+#endif
+#ifdef FILETRACK_ENABLE_PREFETCH
+	prefetch_open(stream, mode);
+#endif
+	return stream;
+}
+
+
+static FILE* filetrack_fopen_without_lock (const char* filename, const char* mode, size_t filename_len_max, const char* file, int line) {
+	if (filename == NULL) {
+		fprintf(stderr, "No processing was done because the filename is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fopen";
+		return NULL;
+	}
+
+	if (filename[0] == '\0') {
+		fprintf(stderr, "No processing was done because the filename is empty.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fopen";
+		return NULL;
+	}
+
+	if (mode == NULL) {
+		fprintf(stderr, "No processing was done because the mode is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fopen";
+		return NULL;
+	}
+
+	if (mode[0] == '\0') {
+		fprintf(stderr, "No processing was done because the mode is empty.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fopen";
+		return NULL;
+	}
+
+	if (filename_len_max < 1) {
+		fprintf(stderr, "filename_len_max must be at least 1.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fopen";
+		return NULL;
+	}
+
+	char* filename_tmp = mutils_strndup(filename, filename_len_max);
+	if (filename_tmp == NULL) {
+		filetrack_errfunc = "filetrack_fopen";
+		return NULL;
+	}
+
+	char* mode_tmp = mutils_strndup(mode, FT_MODE_LEN_MAX);
+	if (mode_tmp == NULL) {
+		free(filename_tmp);
+		filetrack_errfunc = "filetrack_fopen";
+		return NULL;
+	}
+
+#ifdef FILETRACK_ENABLE_NEGATIVE_CACHE
+	if (!negative_mode_creates(mode_tmp) && negative_check(filename_tmp)) {  /* 同じ診断を繰り返し出力しない */
+		if (UNLIKELY(filetrack_entries == NULL)) init();
+		FileTrackSite* site = site_get(file, line);
+		if (site != NULL) site->negative_hit_cnt++;
+
+		free(filename_tmp);
+		free(mode_tmp);
+		errno = ENOENT;
+		filetrack_errfunc = "filetrack_fopen";
+		return NULL;
+	}
+#endif
+
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+	uint64_t begin_ns = clock_ns();
+#endif
+
+	FILE* stream = fopen(filename_tmp, mode_tmp);
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+	while (stream == NULL && virtual_make_room(errno, NULL))  /* 記述子が足りなければ使われていない仮想ハンドルを閉じる */
+		stream = fopen(filename_tmp, mode_tmp);
+#endif
+
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+	latency_record(file, line, FT_LATENCY_FOPEN, begin_ns);
+#endif
+
+#ifdef FILETRACK_ENABLE_NEGATIVE_CACHE
+	if (stream == NULL) {
+		if (errno == ENOENT && !negative_mode_creates(mode_tmp)) negative_record(filename_tmp);
+	} else if (negative_mode_creates(mode_tmp)) {
+		negative_invalidate(filename_tmp);
+	}
+#endif
+
+	free(filename_tmp);  /* ヌル終端を保証するためだけなのですぐに解放 */
+	free(mode_tmp);
+
+	if (UNLIKELY(stream == NULL)) {
+		fprintf(stderr, "Failed to open file '%s' with mode '%s'.\nFile: %s   Line: %d\n", filename, mode, file, line);
+		filetrack_errfunc = "filetrack_fopen";
+		return NULL;
+	}
+	return fopen_track(stream, filename, mode, filename_len_max, file, line);
+}
+
+
+FILE* filetrack_fopen (const char* filename, const char* mode, size_t filename_len_max, const char* file, int line) {
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+	if (!admission_enter("filetrack_fopen", file, line)) return NULL;
+	FILE* stream = filetrack_fopen_without_lock(filename, mode, filename_len_max, file, line);
+	admission_settle();  /* 開けなかった場合 */
+#else
+	filetrack_lock();
+	FILE* stream = filetrack_fopen_without_lock(filename, mode, filename_len_max, file, line);
+#endif
+	filetrack_unlock();
+	return stream;
+}
+
+
+#ifdef FILETRACK_ENABLE_STREAM_CACHE
+static void cache_info_free (FileTrackCacheInfo* info) {
+	if (info == NULL) return;
+	free(info->path);
+	free(info);
+}
+
+
+static void cache_info_stat_set (FileTrackCacheInfo* info, const struct stat* st) {
+	info->mtime = FT_STAT_MTIM(*st);
+	info->size = st->st_size;
+	info->dev = st->st_dev;
+	info->ino = st->st_ino;
+}
+
+
+static bool cache_info_stat_check (const FileTrackCacheInfo* info, const struct stat* st) {
+	return info->dev == st->st_dev && info->ino == st->st_ino && info->size == st->st_size &&
+		info->mtime.tv_sec == FT_STAT_MTIM(*st).tv_sec && info->mtime.tv_nsec == FT_STAT_MTIM(*st).tv_nsec;
+}
+
+
+/*
+ * キャッシュのストリームを閉じて取り除く
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void stream_cache_drop (size_t index) {
+	FileTrackCacheSlot* slot = &stream_cache[index];
+
+	int tmp_errno = errno;
+	fclose(slot->stream);
+	errno = tmp_errno;
+
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	if (slot->info->buffer != NULL)  /* ストリームを閉じた後でなければ戻せない */
+		buffer_put(slot->info->buffer, slot->info->buffer_class, slot->info->buffer_origin);
+#endif
+	cache_info_free(slot->info);
+
+	stream_cache[index] = stream_cache[--stream_cache_cnt];
+	stream_cache_stats.cached_cnt = stream_cache_cnt;
+}
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static bool stream_cache_holds (const FILE* stream) {
+	for (size_t i = 0; i < stream_cache_cnt; i++) {
+		if (stream_cache[i].stream == stream) return true;
+	}
+	return false;
+}
+
+
+/*
+ * fopen_cached で開いたストリームなら、閉じずにキャッシュへ移して true を返す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static bool stream_cache_put (FILE* stream, const char* file, int line) {
+	if (filetrack_entries == NULL) return false;
+
+	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+	if (entry == NULL || entry->cache_info == NULL) return false;
+#ifdef DEBUG
+	if (entry->is_closed) return false;
+#endif
+	if (ferror(stream)) return false;  /* 通常どおり閉じ、情報は entry_release で解放される */
+
+	FileTrackCacheInfo* info = entry->cache_info;
+	entry->cache_info = NULL;
+
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	/* 閉じずに残すので、バッファはエントリと一緒にプールへ戻さずキャッシュで持つ */
+	info->buffer = entry->buffer;
+	info->buffer_class = entry->buffer_class;
+	info->buffer_origin = entry->buffer_origin;
+	entry->buffer = NULL;
+#endif
+
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	int tmp_errno = errno;
+#endif
+	errno = 0;
+
+	filetrack_entry_close(stream, FILE_CLOSED_FCLOSE, file, line);
+
+	if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_fclose";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	else errno = tmp_errno;
+#endif
+
+	if (stream_cache_cnt == FT_STREAM_CACHE_MAX) {  /* 最も長く使われていないものを追い出す */
+		size_t oldest = 0;
+		for (size_t i = 1; i < stream_cache_cnt; i++) {
+			if (stream_cache[i].last_used < stream_cache[oldest].last_used) oldest = i;
+		}
+		stream_cache_drop(oldest);
+		stream_cache_stats.evictions++;
+	}
+
+	stream_cache[stream_cache_cnt++] = (FileTrackCacheSlot){
+		.stream = stream,
+		.info = info,
+		.last_used = ++stream_cache_tick
+	};
+	stream_cache_stats.cached_cnt = stream_cache_cnt;
+	return true;
+}
+
+
+/*
+ * 同じファイル名とモードのストリームをキャッシュから取り出す
+ * ファイルが変更されていれば閉じて NULL を返す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static FILE* stream_cache_take (const char* path, const char* mode, FileTrackCacheInfo** info) {
+	for (size_t i = 0; i < stream_cache_cnt;) {
+		FileTrackCacheSlot* slot = &stream_cache[i];
+		if (strcmp(slot->info->mode, mode) != 0 || strcmp(slot->info->path, path) != 0) {
+			i++;
+			continue;
+		}
+
+		int tmp_errno = errno;
+		struct stat st;
+		bool unchanged = (stat(path, &st) == 0 && cache_info_stat_check(slot->info, &st));
+		errno = tmp_errno;
+
+		if (!unchanged) {  /* 同じファイルの他のストリームも古いので探索を続ける */
+			stream_cache_drop(i);
+			stream_cache_stats.invalidations++;
+			continue;
+		}
+
+		FILE* stream = slot->stream;
+		*info = slot->info;
+		slot->info = NULL;  /* 所有権を呼び出し元へ移す */
+
+		stream_cache[i] = stream_cache[--stream_cache_cnt];
+		stream_cache_stats.cached_cnt = stream_cache_cnt;
+
+		rewind(stream);
+		return stream;
+	}
+	return NULL;
+}
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void stream_cache_invalidate (const char* path) {
+	for (size_t i = 0; i < stream_cache_cnt;) {
+		if (strcmp(stream_cache[i].info->path, path) == 0) {
+			stream_cache_drop(i);  /* 最後の要素が i に移るので進めない */
+			stream_cache_stats.invalidations++;
+		} else {
+			i++;
+		}
+	}
+}
+
+
+static void stream_cache_quit (void) {
+	while (stream_cache_cnt > 0)
+		stream_cache_drop(stream_cache_cnt - 1);
+}
+
+
+/* 読み込み専用のモードだけをキャッシュする */
+static bool stream_cache_mode_check (const char* mode) {
+	size_t mode_len = mutils_strnlen(mode, FT_MODE_LEN_MAX);
+	return mode_len > 0 && mode[0] == 'r' && memchr(mode, '+', mode_len) == NULL;
+}
+
+
+FILE* filetrack_fopen_cached (const char* filename, const char* mode, size_t filename_len_max, const char* file, int line) {
+	if (filename == NULL || filename[0] == '\0' || mode == NULL || !stream_cache_mode_check(mode) || filename_len_max < 1)
+		return filetrack_fopen(filename, mode, filename_len_max, file, line);  /* 検査とエラーの報告も任せる */
+
+	FileTrackCacheInfo* info = calloc(1, sizeof(FileTrackCacheInfo));
+	if (UNLIKELY(info == NULL)) {
+		filetrack_errfunc = "filetrack_fopen_cached";
+		return NULL;
+	}
+
+	info->path = mutils_strndup(filename, filename_len_max);
+	if (UNLIKELY(info->path == NULL)) {
+		free(info);
+		filetrack_errfunc = "filetrack_fopen_cached";
+		return NULL;
+	}
+
+	size_t mode_len = mutils_strnlen(mode, FT_MODE_LEN_MAX);
+	memcpy(info->mode, mode, mode_len);
+	info->mode[mode_len] = '\0';
+
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+	if (!admission_enter("filetrack_fopen_cached", file, line)) {
+		cache_info_free(info);
+		return NULL;
+	}
+#else
+	filetrack_lock();
+#endif
+
+	if (UNLIKELY(filetrack_entries == NULL)) init();
+	FileTrackSite* site = site_get(file, line);
+
+	FileTrackCacheInfo* cached_info = NULL;
+	FILE* stream = stream_cache_take(info->path, info->mode, &cached_info);
+	if (stream != NULL) {
+		cache_info_free(info);
+		info = cached_info;
+		stream_cache_stats.hits++;
+		if (site != NULL) site->cache_hit_cnt++;
+
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		int tmp_errno = errno;
+#endif
+		errno = 0;
+
+		filetrack_entry_add(stream, FILE_OPEN_FOPEN, filename, mode, filename_len_max, file, line);
+
+		if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_fopen_cached";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		else errno = tmp_errno;
+#endif
+	} else {
+		stream_cache_stats.misses++;
+		if (site != NULL) site->cache_miss_cnt++;
+
+		/* 負のキャッシュ、バッファプールや先読みなども通常の fopen と同じように働かせる */
+		stream_cache_opening = true;
+		stream = filetrack_fopen_without_lock(filename, mode, filename_len_max, file, line);
+		stream_cache_opening = false;
+
+		int tmp_errno = errno;
+		struct stat st;
+		if (stream != NULL && fstat(fileno(stream), &st) == 0) {
+			cache_info_stat_set(info, &st);
+		} else {  /* 開けなかったか、変更を検出できない場合はキャッシュしない */
+			cache_info_free(info);
+			info = NULL;
+		}
+		errno = tmp_errno;
+	}
+
+	if (stream != NULL) {
+		FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);  /* サンプリングで外れたものは表にない */
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+		if (info != NULL && info->buffer != NULL && LIKELY(entry != NULL)) {  /* キャッシュから取り出したストリームのバッファを新しいエントリに渡す */
+			entry->buffer = info->buffer;
+			entry->buffer_class = info->buffer_class;
+			entry->buffer_origin = info->buffer_origin;
+			info->buffer = NULL;
+		}
+#endif
+		if (LIKELY(entry != NULL)) entry->cache_info = info;
+		else cache_info_free(info);  /* バッファはストリームが使い続けるのでプールへ戻さない */
+	}
+
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+	admission_settle();  /* 開けなかった場合 */
+#endif
+	filetrack_unlock();
+	return stream;
+}
+
+
+bool filetrack_stream_cache_stats (FileTrackStreamCacheStats* stats) {
+	if (stats == NULL) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_stream_cache_stats";
+		return false;
+	}
+
+	filetrack_lock();
+	*stats = stream_cache_stats;
+	filetrack_unlock();
+	return true;
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_MEMFD_TMPFILE
+/*
+ * memfd の一時ファイルが実際に使っているメモリ (バイト)、site が NULL なら全体
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static uint64_t memfd_ram_bytes (const FileTrackSite* site, uint64_t* count) {
+	int tmp_errno = errno;
+
+	uint64_t bytes = 0;
+	uint64_t found = 0;
+	for (size_t i = 0; i < memfds_cnt; i++) {
+		if (site != NULL && memfds[i].site != site) continue;
+		found++;
+
+		struct stat st;
+		if (fstat(memfds[i].fd, &st) == 0)
+			bytes += (uint64_t)st.st_blocks * 512u;  /* 書き込まれていない部分はメモリを使わない */
+	}
+
+	errno = tmp_errno;
+	if (count != NULL) *count = found;
+	return bytes;
+}
+
+
+/*
+ * memfd で一時ファイルを作成する、上限を超えている場合は NULL を返す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static FILE* memfd_tmpfile (void) {
+	if (memfd_ram_max == 0) return NULL;
+
+	if (memfd_ram_bytes(NULL, NULL) >= memfd_ram_max) {
+		memfd_fallback_cnt++;
+		return NULL;
+	}
+
+	int tmp_errno = errno;
+
+	FILE* stream = NULL;
+	int fd = memfd_create("filetrack-tmpfile", 0);
+	if (fd >= 0) {
+		stream = fdopen(fd, "w+b");  /* tmpfile と同じモード */
+		if (UNLIKELY(stream == NULL)) close(fd);
+	}
+
+	if (UNLIKELY(stream == NULL)) {  /* 対応していないカーネルなどではディスクに作る */
+		memfd_fallback_cnt++;
+	} else {
+		memfd_created_cnt++;
+		memfd_pending = fd;
+	}
+
+	errno = tmp_errno;
+	return stream;
+}
+
+
+static void memfd_quit (void) {
+	free(memfds);
+	memfds = NULL;
+	memfds_cnt = 0;
+	memfds_cap = 0;
+}
+
+
+void filetrack_memfd_tmpfile_cap_set (uint64_t ram_max) {
+	filetrack_lock();
+	memfd_ram_max = ram_max;
+	filetrack_unlock();
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_TMPFILE_POOL
+/* 名前のない一時ファイルを作成する、補充用スレッドから呼ばれる */
+static FILE* tmpfile_pool_create (void) {
+	int fd = -1;
+#ifdef O_TMPFILE
+	fd = open(tmpfile_pool_dir, O_TMPFILE | O_RDWR | O_EXCL, S_IRUSR | S_IWUSR);
+#endif
+
+	if (fd < 0) {  /* O_TMPFILE に対応していないファイルシステムの場合 */
+		static const char suffix[] = "/filetrack.XXXXXX";
+		size_t dir_len = strlen(tmpfile_pool_dir);
+
+		char* path = malloc(dir_len + sizeof(suffix));
+		if (UNLIKELY(path == NULL)) return NULL;
+		memcpy(path, tmpfile_pool_dir, dir_len);
+		memcpy(path + dir_len, suffix, sizeof(suffix));
+
+		fd = mkstemp(path);
+		if (fd >= 0) unlink(path);
+		free(path);
+		if (fd < 0) return NULL;
+	}
+
+	FILE* stream = fdopen(fd, "w+b");  /* tmpfile と同じモード */
+	if (UNLIKELY(stream == NULL)) close(fd);
+	return stream;
+}
+
+
+static void* tmpfile_pool_main (void* arg) {
+	(void)arg;
+
+	pthread_mutex_lock(&tmpfile_pool_mutex);
+	while (!tmpfile_pool_stopping) {
+		if (tmpfile_pool_cnt >= tmpfile_pool_target) {
+			pthread_cond_wait(&tmpfile_pool_cond, &tmpfile_pool_mutex);
+			continue;
+		}
+
+		pthread_mutex_unlock(&tmpfile_pool_mutex);
+		FILE* stream = tmpfile_pool_create();
+		pthread_mutex_lock(&tmpfile_pool_mutex);
+
+		if (UNLIKELY(stream == NULL)) {  /* 容量不足などの間は作成を繰り返さない */
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += FT_TMPFILE_POOL_RETRY_MS * 1000000L;
+			if (deadline.tv_nsec >= 1000000000L) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&tmpfile_pool_cond, &tmpfile_pool_mutex, &deadline);
+			continue;
+		}
+
+		if (!tmpfile_pool_stopping && tmpfile_pool_cnt < tmpfile_pool_target) {
+			tmpfile_pool[tmpfile_pool_cnt++] = stream;
+		} else {
+			pthread_mutex_unlock(&tmpfile_pool_mutex);
+			fclose(stream);
+			pthread_mutex_lock(&tmpfile_pool_mutex);
+		}
+	}
+	pthread_mutex_unlock(&tmpfile_pool_mutex);
+	return NULL;
+}
+
+
+/* 用意されている一時ファイルを取り出す、なければ NULL を返す */
+static FILE* tmpfile_pool_take (void) {
+	pthread_mutex_lock(&tmpfile_pool_mutex);
+
+	FILE* stream = NULL;
+	if (tmpfile_pool_running) {
+		if (tmpfile_pool_cnt > 0) {
+			stream = tmpfile_pool[--tmpfile_pool_cnt];
+			tmpfile_pool_stats.hits++;
+		} else {
+			tmpfile_pool_stats.misses++;
+		}
+		pthread_cond_signal(&tmpfile_pool_cond);  /* 補充させる */
+	}
+
+	pthread_mutex_unlock(&tmpfile_pool_mutex);
+	return stream;
+}
+
+
+/*
+ * 閉じようとしているストリームが再利用できる一時ファイルなら、その記述子を複製して返す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static int tmpfile_pool_recycle_dup (FILE* stream) {
+	if (stream == NULL || filetrack_entries == NULL) return -1;
+
+	pthread_mutex_lock(&tmpfile_pool_mutex);
+	bool wanted = (tmpfile_pool_running && tmpfile_pool_recycle && tmpfile_pool_cnt < tmpfile_pool_target);
+	pthread_mutex_unlock(&tmpfile_pool_mutex);
+	if (!wanted) return -1;
+
+	FILE* real = stream;
+	const FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	if (entry == NULL) {
+		const FileTrackCookie* cookie = cookie_find(stream);
+		if (cookie == NULL || cookie->real == NULL) return -1;
+		entry = &cookie->entry;
+		real = cookie->real;
+	}
+#endif
+	if (entry == NULL || entry->open_type != FILE_OPEN_TMPFILE) return -1;
+#ifdef DEBUG
+	if (entry->is_closed) return -1;
+#endif
+#ifdef FILETRACK_ENABLE_MEMFD_TMPFILE
+	if (entry->memfd >= 0) return -1;  /* プールにはディスクの一時ファイルだけを置く */
+#endif
+
+	int tmp_errno = errno;
+	int fd = dup(fileno(real));
+	errno = tmp_errno;
+	return fd;
+}
+
+
+/* 閉じられた一時ファイルを空にしてプールへ戻す */
+static void tmpfile_pool_recycle_put (int fd) {
+	int tmp_errno = errno;
+
+	FILE* stream = NULL;
+	if (ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0)
+		stream = fdopen(fd, "w+b");
+
+	if (stream == NULL) {
+		close(fd);
+		errno = tmp_errno;
+		return;
+	}
+
+	pthread_mutex_lock(&tmpfile_pool_mutex);
+	bool pooled = (tmpfile_pool_running && tmpfile_pool_cnt < tmpfile_pool_target);
+	if (pooled) {
+		tmpfile_pool[tmpfile_pool_cnt++] = stream;
+		tmpfile_pool_stats.recycled++;
+	}
+	pthread_mutex_unlock(&tmpfile_pool_mutex);
+
+	if (!pooled) fclose(stream);
+	errno = tmp_errno;
+}
+
+
+/* 補充用スレッドを止め、用意されていた一時ファイルを閉じる */
+static void tmpfile_pool_stop (void) {
+	pthread_mutex_lock(&tmpfile_pool_mutex);
+	if (!tmpfile_pool_running) {
+		pthread_mutex_unlock(&tmpfile_pool_mutex);
+		return;
+	}
+	tmpfile_pool_stopping = true;
+	pthread_cond_signal(&tmpfile_pool_cond);
+	pthread_mutex_unlock(&tmpfile_pool_mutex);
+
+	pthread_join(tmpfile_pool_thread, NULL);
+
+	pthread_mutex_lock(&tmpfile_pool_mutex);
+	while (tmpfile_pool_cnt > 0)
+		fclose(tmpfile_pool[--tmpfile_pool_cnt]);
+	tmpfile_pool_running = false;
+	tmpfile_pool_stopping = false;
+	tmpfile_pool_target = 0;
+	tmpfile_pool_stats.ready_cnt = 0;
+	pthread_mutex_unlock(&tmpfile_pool_mutex);
+
+	free(tmpfile_pool_dir);
+	tmpfile_pool_dir = NULL;
+}
+
+
+bool filetrack_tmpfile_pool_set (size_t ready_cnt, bool recycle) {
+	if (ready_cnt > FT_TMPFILE_POOL_MAX) ready_cnt = FT_TMPFILE_POOL_MAX;
+
+	filetrack_lock();  /* 設定の変更同士を直列化する、補充用スレッドはこのロックを取らない */
+
+	if (UNLIKELY(filetrack_entries == NULL)) init();  /* 終了時にスレッドを止めるため */
+
+	if (ready_cnt == 0) {
+		tmpfile_pool_stop();
+		filetrack_unlock();
+		return true;
+	}
+
+	pthread_mutex_lock(&tmpfile_pool_mutex);
+	bool running = tmpfile_pool_running;
+	tmpfile_pool_target = ready_cnt;
+	tmpfile_pool_recycle = recycle;
+	pthread_cond_signal(&tmpfile_pool_cond);
+	pthread_mutex_unlock(&tmpfile_pool_mutex);
+
+	if (running) {
+		filetrack_unlock();
+		return true;
+	}
+
+	const char* dir = getenv("TMPDIR");
+	if (dir == NULL || dir[0] == '\0') dir = P_tmpdir;
+	tmpfile_pool_dir = mutils_strndup(dir, FT_FILENAME_LEN_MAX);
+	if (UNLIKELY(tmpfile_pool_dir == NULL)) {
+		filetrack_errfunc = "filetrack_tmpfile_pool_set";
+		filetrack_unlock();
+		return false;
+	}
+
+	tmpfile_pool_running = true;  /* スレッドが参照する前に設定しておく */
+	int result = pthread_create(&tmpfile_pool_thread, NULL, tmpfile_pool_main, NULL);
+	if (UNLIKELY(result != 0)) {
+		tmpfile_pool_running = false;
+		free(tmpfile_pool_dir);
+		tmpfile_pool_dir = NULL;
+		errno = result;
+		filetrack_errfunc = "filetrack_tmpfile_pool_set";
+		filetrack_unlock();
+		return false;
+	}
+
+	filetrack_unlock();
+	return true;
+}
+
+
+bool filetrack_tmpfile_pool_stats (FileTrackTmpfilePoolStats* stats) {
+	if (stats == NULL) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_tmpfile_pool_stats";
+		return false;
+	}
+
+	pthread_mutex_lock(&tmpfile_pool_mutex);
+	tmpfile_pool_stats.ready_cnt = tmpfile_pool_cnt;
+	*stats = tmpfile_pool_stats;
+	pthread_mutex_unlock(&tmpfile_pool_mutex);
+	return true;
+}
+#endif
+
+
+static FILE* filetrack_tmpfile_without_lock (const char* file, int line) {
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+	uint64_t begin_ns = clock_ns();
+#endif
+
+	FILE* stream = NULL;
+#ifdef FILETRACK_ENABLE_MEMFD_TMPFILE
+	stream = memfd_tmpfile();
+	const char* backing = (stream != NULL) ? "(memfd)" : "unknown";  /* ファイル名の代わりに記録する */
+#else
+	const char* backing = "unknown";
+#endif
+#ifdef FILETRACK_ENABLE_TMPFILE_POOL
+	if (stream == NULL) stream = tmpfile_pool_take();
+#endif
+	if (stream == NULL) stream = tmpfile();
+
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+	latency_record(file, line, FT_LATENCY_TMPFILE, begin_ns);
+#endif
+
+	if (UNLIKELY(stream == NULL)) {
+		fprintf(stderr, "Failed to create a temporary file.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_tmpfile";
+	} else {
+#ifdef FILETRACK_ENABLE_SAMPLING
+		if (sampling_skip(file, line)) {
+#ifdef FILETRACK_ENABLE_MEMFD_TMPFILE
+			memfd_pending = -1;  /* 使用メモリにも数えない */
+#endif
+			return stream;
+		}
+#endif
+
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+		FILE* cookie_stream = cookie_wrap(stream, FILE_OPEN_TMPFILE, backing, "(tmpfile)", 8, file, line);
+		if (LIKELY(cookie_stream != NULL)) return cookie_stream;  /* 失敗した場合は通常の方法で追跡する */
+#endif
+
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		int tmp_errno = errno;
+#endif
+		errno = 0;
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+		entry_add(stream, FILE_OPEN_TMPFILE, backing, "(tmpfile)", 8, file, line);
+#else
+		filetrack_entry_add(stream, FILE_OPEN_TMPFILE, backing, "(tmpfile)", 8, file, line);
+#endif
+
+		if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_tmpfile";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		else errno = tmp_errno;
+#endif
+	}
+	return stream;
+}
+
+
+FILE* filetrack_tmpfile (const char* file, int line) {
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+	if (!admission_enter("filetrack_tmpfile", file, line)) return NULL;
+	FILE* stream = filetrack_tmpfile_without_lock(file, line);
+	admission_settle();  /* 作成できなかった場合 */
+#else
+	filetrack_lock();
+	FILE* stream = filetrack_tmpfile_without_lock(file, line);
+#endif
+	filetrack_unlock();
+	return stream;
+}
+
+
+static FILE* filetrack_freopen_without_lock (const char* filename, const char* mode, FILE* stream, size_t filename_len_max, const char* file, int line) {
+	if (filename != NULL && filename[0] == '\0') {
+		fprintf(stderr, "No processing was done because the filename is empty.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_freopen";
+		return NULL;
+	}
+
+	if (mode == NULL) {
+		fprintf(stderr, "No processing was done because the mode is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_freopen";
+		return NULL;
+	}
+
+	if (mode[0] == '\0') {
+		fprintf(stderr, "No processing was done because the mode is empty.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_freopen";
+		return NULL;
+	}
+
+	if (stream == NULL) {
+		fprintf(stderr, "No processing was done because the stream is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_freopen";
+		return NULL;
+	}
+
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	if (cookie_find(stream) != NULL) {
+		fprintf(stderr, "Streams created by the cookie engine cannot be reopened.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_freopen";
+		return NULL;
+	}
+#endif
+
+#ifdef FT_POPEN_SUPPORTED
+	if (entry_open_type_get(stream) == FILE_OPEN_POPEN) {
+		fprintf(stderr, "Streams opened with popen cannot be reopened. Use pclose instead.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_freopen";
+		return NULL;
+	}
+#endif
+
+	if (filename_len_max < 1) {
+		fprintf(stderr, "filename_len_max must be at least 1.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_freopen";
+		return NULL;
+	}
+
+	char* filename_tmp = NULL;  /* NULL のままならモード変更 */
+	if (filename != NULL) {
+		filename_tmp = mutils_strndup(filename, filename_len_max);
+		if (filename_tmp == NULL) {
+			filetrack_errfunc = "filetrack_freopen";
+			return NULL;
+		}
+	}
+
+	char* mode_tmp = mutils_strndup(mode, FT_MODE_LEN_MAX);
+	if (mode_tmp == NULL) {
+		free(filename_tmp);
+		filetrack_errfunc = "filetrack_freopen";
+		return NULL;
+	}
+
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+	uint64_t begin_ns = clock_ns();
+#endif
+
+	FILE* new_stream = freopen(filename_tmp, mode_tmp, stream);
+
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+	latency_record(file, line, FT_LATENCY_FREOPEN, begin_ns);
+#endif
+
+#ifdef FILETRACK_ENABLE_NEGATIVE_CACHE
+	if (new_stream != NULL && filename_tmp != NULL && negative_mode_creates(mode_tmp))
+		negative_invalidate(filename_tmp);
+#endif
+
+	free(filename_tmp);  /* ヌル終端を保証するためだけなのですぐに解放 */
+	free(mode_tmp);
+
+	if (UNLIKELY(new_stream == NULL)) {
+		fprintf(stderr, "Failed to reopen file '%s' with mode '%s'.\nFile: %s   Line: %d\n", filename, mode, file, line);
+		filetrack_errfunc = "filetrack_freopen";
+		filetrack_entry_close(stream, FILE_CLOSED_FREOPEN, file, line);
+		return NULL;
+	}
+
+	if (stream == stdin || stream == stdout || stream == stderr)
+		return new_stream;   /* 標準ストリームは管理対象外 */
+
+	if (filename == NULL) {  /* モード変更の場合 */
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		int tmp_errno = errno;
+#endif
+		errno = 0;
+
+		filetrack_entry_update(new_stream, filename, mode, file, line);
+
+		if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_freopen";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		else errno = tmp_errno;
+#endif
+	} else {                 /* 閉じて開き直す場合 */
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		int tmp_errno = errno;
+#endif
+		errno = 0;
+
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+		admission_keep = true;  /* 同じストリームを開き直すので枠は返さない */
+#endif
+		filetrack_entry_close(stream, FILE_CLOSED_FREOPEN, file, line);
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+		admission_keep = false;
+#endif
+
+		if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_freopen";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		else errno = tmp_errno;
+
+		tmp_errno = errno;
+#endif
+		errno = 0;
+
+		filetrack_entry_add(new_stream, FILE_OPEN_FREOPEN, filename, mode, filename_len_max, file, line);
+
+		if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_freopen";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		else errno = tmp_errno;
+#endif
+
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+		admission_settle();  /* 登録できなかった場合 */
+#endif
+	}
+	return new_stream;
+}
+
+
+FILE* filetrack_freopen (const char* filename, const char* mode, FILE* stream, size_t filename_len_max, const char* file, int line) {
+	filetrack_lock();
+	FILE* new_stream = filetrack_freopen_without_lock(filename, mode, stream, filename_len_max, file, line);
+	filetrack_unlock();
+	return new_stream;
+}
+
+
+#ifdef FT_POPEN_SUPPORTED
+static FILE* filetrack_popen_without_lock (const char* command, const char* mode, const char* file, int line) {
+	if (command == NULL) {
+		fprintf(stderr, "No processing was done because the command is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_popen";
+		return NULL;
+	}
+
+	if (mode == NULL) {
+		fprintf(stderr, "No processing was done because the mode is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_popen";
+		return NULL;
+	}
+
+	if (mode[0] == '\0') {
+		fprintf(stderr, "No processing was done because the mode is empty.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_popen";
+		return NULL;
+	}
+
+	char* mode_tmp = mutils_strndup(mode, FT_MODE_LEN_MAX);
+	if (mode_tmp == NULL) {
+		filetrack_errfunc = "filetrack_popen";
+		return NULL;
+	}
+
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+	uint64_t begin_ns = clock_ns();
+#endif
+
+	FILE* stream = popen(command, mode_tmp);
+
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+	latency_record(file, line, FT_LATENCY_POPEN, begin_ns);
+#endif
+
+	free(mode_tmp);  /* ヌル終端を保証するためだけなのですぐに解放 */
+
+	if (UNLIKELY(stream == NULL)) {
+		fprintf(stderr, "Failed to run command '%s' with mode '%s'.\nFile: %s   Line: %d\n", command, mode, file, line);
+		filetrack_errfunc = "filetrack_popen";
+	} else {
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		int tmp_errno = errno;
+#endif
+		errno = 0;
+
+		filetrack_entry_add(stream, FILE_OPEN_POPEN, command, mode, FT_FILENAME_LEN_MAX, file, line);
+
+		if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_popen";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		else errno = tmp_errno;
+#endif
+	}
+	return stream;
+}
+
+
+FILE* filetrack_popen (const char* command, const char* mode, const char* file, int line) {
+	filetrack_lock();
+	FILE* stream = filetrack_popen_without_lock(command, mode, file, line);
+	filetrack_unlock();
+	return stream;
+}
+#endif
+
+
+#ifdef FT_FDOPEN_SUPPORTED
+FILE* filetrack_fdopen (int fd, const char* mode, const char* file, int line) {
+	if (mode == NULL) {
+		fprintf(stderr, "No processing was done because the mode is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fdopen";
+		return NULL;
+	}
+
+	if (mode[0] == '\0') {
+		fprintf(stderr, "No processing was done because the mode is empty.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fdopen";
+		return NULL;
+	}
+
+	filetrack_lock();
+
+	FILE* stream = fdopen(fd, mode);
+	if (UNLIKELY(stream == NULL)) {
+		fprintf(stderr, "Failed to open descriptor %d with mode '%s'.\nFile: %s   Line: %d\n", fd, mode, file, line);
+		filetrack_errfunc = "filetrack_fdopen";
+		filetrack_unlock();
+		return NULL;
+	}
+
+	FileOpenType open_type = FILE_OPEN_FDOPEN;
+	char* filename = NULL;  /* 記述子の記録はストリームの記録で上書きされるので複製する */
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	FileTrackFdEntry* fd_entry = fd_entry_get(fd, false);
+	if (fd_entry != NULL && fd_entry->type == FT_FD_STREAM) {
+		fprintf(stderr, "Descriptor %d already belongs to a tracked stream and will be closed twice.\nFile: %s   Line: %d\n", fd, file, line);
+		filetrack_errfunc = "filetrack_fdopen";
+	} else if (fd_entry != NULL && fd_entry->type == FT_FD_MKSTEMP) {
+		open_type = FILE_OPEN_MKSTEMP;
+	}
+
+#ifdef DEBUG
+	if (fd_entry != NULL && fd_entry->type != FT_FD_STREAM && fd_entry->path != NULL)
+		filename = mutils_strndup(fd_entry->path, FT_FILENAME_LEN_MAX);
+#endif
+#endif
+
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	int tmp_errno = errno;
+#endif
+	errno = 0;
+
+	filetrack_entry_add(stream, open_type, (filename != NULL) ? filename : "unknown", mode, FT_FILENAME_LEN_MAX, file, line);
+
+	if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_fdopen";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	else errno = tmp_errno;
+#endif
+
+	free(filename);
+
+	filetrack_unlock();
+	return stream;
+}
+#endif
+
+
+#ifdef FT_MEMSTREAM_SUPPORTED
+/*
+ * メモリストリームを登録し、バッファの大きさを取得するための情報を記録する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void memstream_add (FILE* stream, FileOpenType open_type, const char* mode, size_t* sizeloc, size_t size, const char* file, int line) {
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	int tmp_errno = errno;
+#endif
+	errno = 0;
+
+	filetrack_entry_add(stream, open_type, "(memory)", mode, 9, file, line);
+
+	if (UNLIKELY(errno != 0)) {
+		filetrack_errfunc = (open_type == FILE_OPEN_FMEMOPEN) ? "filetrack_fmemopen" : "filetrack_open_memstream";
+		return;
+	}
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	errno = tmp_errno;
+#endif
+
+	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+	if (LIKELY(entry != NULL)) {
+		entry->memstream_sizeloc = sizeloc;
+		entry->fmemopen_size = size;
+	}
+}
+
+
+FILE* filetrack_fmemopen (void* buf, size_t size, const char* mode, const char* file, int line) {
+	if (mode == NULL) {
+		fprintf(stderr, "No processing was done because the mode is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fmemopen";
+		return NULL;
+	}
+
+	if (mode[0] == '\0') {
+		fprintf(stderr, "No processing was done because the mode is empty.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fmemopen";
+		return NULL;
+	}
+
+	filetrack_lock();
+
+	FILE* stream = fmemopen(buf, size, mode);
+	if (UNLIKELY(stream == NULL)) {
+		fprintf(stderr, "Failed to open a memory stream of %zu bytes with mode '%s'.\nFile: %s   Line: %d\n", size, mode, file, line);
+		filetrack_errfunc = "filetrack_fmemopen";
+	} else {
+		memstream_add(stream, FILE_OPEN_FMEMOPEN, mode, NULL, size, file, line);
+	}
+
+	filetrack_unlock();
+	return stream;
+}
+
+
+FILE* filetrack_open_memstream (char** ptr, size_t* sizeloc, const char* file, int line) {
+	if (ptr == NULL || sizeloc == NULL) {
+		fprintf(stderr, "No processing was done because ptr or sizeloc is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_open_memstream";
+		return NULL;
+	}
+
+	filetrack_lock();
+
+	FILE* stream = open_memstream(ptr, sizeloc);
+	if (UNLIKELY(stream == NULL)) {
+		fprintf(stderr, "Failed to open a dynamic memory stream.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_open_memstream";
+	} else {
+		memstream_add(stream, FILE_OPEN_OPEN_MEMSTREAM, "w", sizeloc, 0, file, line);
+	}
+
+	filetrack_unlock();
+	return stream;
+}
+
+
+/*
+ * 開いているメモリストリームのバッファの大きさを出力する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void memstream_report (const FileTrackEntry* entry) {
+#ifdef DEBUG
+	if (entry->is_closed) return;  /* 利用者の変数はもう有効とは限らない */
+#endif
+
+	if (entry->open_type == FILE_OPEN_FMEMOPEN) {
+		printf("Buffer Size: %zu\n", entry->fmemopen_size);
+	} else if (entry->open_type == FILE_OPEN_OPEN_MEMSTREAM && entry->memstream_sizeloc != NULL) {
+		/*
+		 * 利用者のスレッドが書き込み中かもしれないので fflush はせず、最後に fflush された時の大きさを出す
+		 * (*sizeloc は fflush か fclose の時にしか更新されない)
+		 */
+		size_t size = *(volatile const size_t*)entry->memstream_sizeloc;
+		printf("Buffer Size: %zu (as of the last fflush)\n", size);
+	}
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_ASYNC_CLOSE
+/*
+ * 開いているストリームのエントリを取得する、cookie のストリームなら cookie のエントリ
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static FileTrackEntry* async_close_entry_find (FILE* stream) {
+	if (stream == NULL || filetrack_entries == NULL) return NULL;
+
+	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	if (entry == NULL) {
+		FileTrackCookie* cookie = cookie_find(stream);
+		if (cookie != NULL) entry = &cookie->entry;
+	}
+#endif
+#ifdef DEBUG
+	if (entry != NULL && entry->is_closed) return NULL;
+#endif
+	return entry;
+}
+#endif
+
+
+/*
+ * fclose で閉じるストリームの記録を閉じる
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void fclose_entry_close (FILE* stream, const char* file, int line) {
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	int tmp_errno = errno;
+#endif
+	errno = 0;
+
+	filetrack_entry_close(stream, FILE_CLOSED_FCLOSE, file, line);
+
+	if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_fclose";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	else errno = tmp_errno;
+#endif
+}
+
+
+static int filetrack_fclose_without_lock (FILE* stream, const char* file, int line) {
+	if (stream == NULL) {
+		fprintf(stderr, "No processing was done because the stream is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fclose";
+		return EOF;
+	}
+
+	if (stream == stdin) {
+		fprintf(stderr, "Cannot close stdin stream! Because it is a standard input stream.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fclose";
+		return EOF;
+	} else if (stream == stdout) {
+		fprintf(stderr, "Cannot close stdout stream! Because it is a standard output stream.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fclose";
+		return EOF;
+	} else if (stream == stderr) {
+		fprintf(stderr, "Cannot close stderr stream! Because it is a standard error stream.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fclose";
+		return EOF;
+	}
+
+	int return_value = 0;
+
+#ifdef FILETRACK_ENABLE_ASYNC_CLOSE
+	const FileTrackEntry* closing_entry = async_close_entry_find(stream);
+	if (closing_entry != NULL && closing_entry->closing) {
+		fprintf(stderr, "File is already being closed by fclose_async!\nreclose File: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fclose";
+		return EOF;
+	}
+#endif
+
+#ifdef FILETRACK_ENABLE_STREAM_CACHE
+	if (stream_cache_holds(stream)) {
+		fprintf(stderr, "File already closed!\nreclose File: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fclose";
+		return EOF;
+	}
+#endif
+
+#ifdef DEBUG
+	if (UNLIKELY(filetrack_entries == NULL)) {
+		init();
+
+		fprintf(stderr, "No entry found to close! The file might not be tracked.\nFile: %s   Line: %d\n", file, line);
+		errno = EPERM;
+		filetrack_errfunc = "filetrack_fclose";
+
+		return_value = fclose(stream);
+		if (return_value != 0) {
+			fprintf(stderr, "Failed to close file stream!\nFile: %s   Line: %d\n", file, line);
+			filetrack_errfunc = "filetrack_fclose";
+		}
+
+		return return_value;
+	}
+
+	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	if (cookie_find(stream) != NULL) entry = NULL;  /* 表にあるのは同じアドレスで閉じられた以前のストリーム */
+#endif
+	if (entry == NULL) {
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+		/* cookie のストリームの記録は cookie 自身が持っており、閉じるときにコールバックで閉じた印を付けて表に移される */
+		cookie_closed = false;
+		cookie_close_file = file;
+		cookie_close_line = line;
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+		uint64_t begin_ns = clock_ns();
+#endif
+		return_value = fclose(stream);
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+		if (cookie_closed) latency_record(file, line, FT_LATENCY_FCLOSE, begin_ns);
+#endif
+		if (return_value != 0) {
+			fprintf(stderr, "Failed to close file stream!\nFile: %s   Line: %d\n", file, line);
+			filetrack_errfunc = "filetrack_fclose";
+		}
+		if (cookie_closed) return return_value;
+
+		fprintf(stderr, "No entry found to close! The file might not be tracked.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_fclose";
+#else
+		fprintf(stderr, "No entry found to close! The file might not be tracked.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_fclose";
+
+		return_value = fclose(stream);
+		if (return_value != 0) {
+			fprintf(stderr, "Failed to close file stream!\nFile: %s   Line: %d\n", file, line);
+			filetrack_errfunc = "filetrack_fclose";
+		}
+#endif
+
+		return return_value;
+	}
+
+	if (entry->is_closed) {
+		fprintf(stderr, "File already closed!\nreclose File: %s   Line: %d\nclose File: %s   Line: %d\n", file, line, entry->close_file, entry->close_line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fclose";
+		return EOF;
+	}
+#endif
+
+#ifdef FT_POPEN_SUPPORTED
+	/* fclose では子プロセスが回収されずに残ってしまう */
+	if (entry_open_type_get(stream) == FILE_OPEN_POPEN) {
+		fprintf(stderr, "Stream opened with popen must be closed with pclose!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fclose";
+		return EOF;
+	}
+#endif
+
+#ifdef FILETRACK_ENABLE_STREAM_CACHE
+	if (stream_cache_put(stream, file, line)) return 0;
+#endif
+
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	int buffer_index = 0;
+	uint8_t buffer_origin = 0;
+	void* buffer = buffer_detach(stream, &buffer_index, &buffer_origin);  /* 記録と一緒に戻すと、書き出す前のデータが壊される */
+#endif
+
+	/* 閉じた後はポインタを使えないので、先に記録を閉じる */
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	if (cookie_find(stream) == NULL)  /* cookie のストリームの記録はコールバックで閉じられる */
+#endif
+		fclose_entry_close(stream, file, line);
+
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+	uint64_t begin_ns = clock_ns();
+#endif
+
+	return_value = fclose(stream);
+
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+	latency_record(file, line, FT_LATENCY_FCLOSE, begin_ns);
+#endif
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	if (buffer != NULL) buffer_put(buffer, buffer_index, buffer_origin);
+#endif
+	if (return_value != 0) {
+		fprintf(stderr, "Failed to close file stream!\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_fclose";
+	}
+
+	return return_value;
+}
+
+
+/*
+ * 一時ファイルのプールが有効なら、閉じた一時ファイルを再利用する
+ * 使われ方の学習や先読みをしている場合は、閉じる前に記録する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static int fclose_with_recycle (FILE* stream, const char* file, int line) {
+#ifdef FILETRACK_ENABLE_FADVISE
+	fadvise_close(stream);
+#endif
+#ifdef FILETRACK_ENABLE_PREFETCH
+	prefetch_close(stream);
+#endif
+
+#ifdef FILETRACK_ENABLE_TMPFILE_POOL
+	int recycle_fd = tmpfile_pool_recycle_dup(stream);
+	int return_value = filetrack_fclose_without_lock(stream, file, line);
+	if (recycle_fd >= 0) {
+		if (return_value == 0) tmpfile_pool_recycle_put(recycle_fd);
+		else close(recycle_fd);
+	}
+	return return_value;
+#else
+	return filetrack_fclose_without_lock(stream, file, line);
+#endif
+}
+
+
+int filetrack_fclose (FILE* stream, const char* file, int line) {
+	filetrack_lock();
+	int return_value = fclose_with_recycle(stream, file, line);
+	filetrack_unlock();
+	return return_value;
+}
+
+
+#ifdef FILETRACK_ENABLE_ASYNC_CLOSE
+/* 終了時の後始末、以降のストリームは同期的に閉じる */
+static void async_close_quit (void) {
+	pthread_mutex_lock(&async_close_mutex);
+	if (async_close_workers_cnt == 0) {
+		pthread_mutex_unlock(&async_close_mutex);
+		return;
+	}
+
+	async_close_stopping = true;  /* 待ち行列が空になってから止まる */
+	pthread_cond_broadcast(&async_close_work_cond);
+	size_t workers_cnt = async_close_workers_cnt;
+	pthread_mutex_unlock(&async_close_mutex);
+
+	for (size_t i = 0; i < workers_cnt; i++)
+		pthread_join(async_close_workers[i], NULL);
+
+	pthread_mutex_lock(&async_close_mutex);
+	async_close_workers_cnt = 0;
+	async_close_stopping = false;
+	pthread_mutex_unlock(&async_close_mutex);
+}
+
+
+/* ワーカーの中で、取り出したストリームを閉じて結果を記録する */
+static void async_close_run (FileTrackAsyncCloseJob* job) {
+	uint64_t begin_ns = clock_ns();
+
+	errno = 0;
+	int flush_result = fflush(job->stream);  /* 時間のかかる書き出しはロックの外で済ませる */
+	int flush_errno = errno;
+
+	filetrack_lock();
+
+	FileTrackEntry* entry = async_close_entry_find(job->stream);
+	if (LIKELY(entry != NULL)) entry->closing = false;
+
+	errno = 0;
+	int result = fclose_with_recycle(job->stream, job->file, job->line);  /* 閉じた後に同じアドレスが再利用される前に記録を片付ける */
+	int error = errno;
+	if (flush_result != 0 && result == 0) {
+		result = EOF;
+		error = flush_errno;
+	}
+
+	FileTrackAsyncCloseResult done = {
+		.stream = job->stream,
+		.file = job->file,
+		.line = job->line,
+		.result = result,
+		.error = (result != 0) ? error : 0,
+		.queued_ns = begin_ns - job->queued_ns,
+		.close_ns = clock_ns() - begin_ns
+	};
+
+	FileTrackSite* site = site_get(job->file, job->line);
+	if (site != NULL) {
+		if (site->async_close == NULL)
+			site->async_close = calloc(1, sizeof(FileTrackHist));
+		if (LIKELY(site->async_close != NULL))
+			hist_record(site->async_close, done.close_ns);
+		if (result != 0) site->async_close_fail_cnt++;
+	}
+
+	FileTrackAsyncCloseCallback callback = async_close_callback;
+	void* callback_arg = async_close_callback_arg;
+
+	filetrack_unlock();
+
+	if (result != 0) {  /* コールバックがなくても後で取り出せるように残す */
+		pthread_mutex_lock(&async_close_mutex);
+		if (async_close_errors_cnt == FT_ASYNC_CLOSE_ERRORS_MAX) {  /* 最も古いものを捨てる */
+			async_close_errors_head = (async_close_errors_head + 1) % FT_ASYNC_CLOSE_ERRORS_MAX;
+			async_close_errors_cnt--;
+			async_close_errors_lost++;
+		}
+		async_close_errors[(async_close_errors_head + async_close_errors_cnt) % FT_ASYNC_CLOSE_ERRORS_MAX] = done;
+		async_close_errors_cnt++;
+		pthread_mutex_unlock(&async_close_mutex);
+	}
+
+	if (callback != NULL) callback(&done, callback_arg);
+}
+
+
+static void* async_close_main (void* arg) {
+	(void)arg;
+
+	pthread_mutex_lock(&async_close_mutex);
+	for (;;) {
+		while (async_close_head == NULL && !async_close_stopping)
+			pthread_cond_wait(&async_close_work_cond, &async_close_mutex);
+		if (async_close_head == NULL) break;  /* 停止を求められ、残りもない */
+
+		FileTrackAsyncCloseJob* job = async_close_head;
+		async_close_head = job->next;
+		if (async_close_head == NULL) async_close_tail = NULL;
+		pthread_mutex_unlock(&async_close_mutex);
+
+		async_close_run(job);
+		free(job);
+
+		pthread_mutex_lock(&async_close_mutex);
+		if (--async_close_pending == 0) pthread_cond_broadcast(&async_close_idle_cond);
+	}
+	pthread_mutex_unlock(&async_close_mutex);
+	return NULL;
+}
+
+
+/*
+ * ワーカーがいなければ起動する、一つも起動できなければ false を返す
+ * 重要: この関数は async_close_mutex をロックした後に呼び出す必要があります！
+ */
+static bool async_close_workers_start (void) {
+	while (async_close_workers_cnt < FT_ASYNC_CLOSE_WORKERS) {
+		if (pthread_create(&async_close_workers[async_close_workers_cnt], NULL, async_close_main, NULL) != 0) break;
+		async_close_workers_cnt++;
+	}
+	return async_close_workers_cnt > 0;
+}
+
+
+int filetrack_fclose_async (FILE* stream, const char* file, int line) {
+	filetrack_lock();
+
+	if (UNLIKELY(filetrack_entries == NULL)) init();
+
+	FileTrackEntry* entry = async_close_entry_find(stream);
+	if (entry == NULL || entry->closing
+#ifdef FT_POPEN_SUPPORTED
+		|| entry->open_type == FILE_OPEN_POPEN
+#endif
+		) {  /* 追跡していない、閉じている途中などは同期的に処理してエラーを報告させる */
+		int return_value = fclose_with_recycle(stream, file, line);
+		filetrack_unlock();
+		return return_value;
+	}
+
+	FileTrackAsyncCloseJob* job = malloc(sizeof(FileTrackAsyncCloseJob));
+	if (UNLIKELY(job == NULL)) {
+		int return_value = fclose_with_recycle(stream, file, line);
+		filetrack_unlock();
+		return return_value;
+	}
+
+	*job = (FileTrackAsyncCloseJob){
+		.next = NULL,
+		.stream = stream,
+		.file = file,
+		.line = line,
+		.queued_ns = clock_ns()
+	};
+
+	pthread_mutex_lock(&async_close_mutex);
+
+	int tmp_errno = errno;
+	bool started = !async_close_stopping && async_close_workers_start();
+	errno = tmp_errno;
+
+	if (UNLIKELY(!started)) {  /* 終了処理中、またはスレッドを作れない場合 */
+		pthread_mutex_unlock(&async_close_mutex);
+		free(job);
+		int return_value = fclose_with_recycle(stream, file, line);
+		filetrack_unlock();
+		return return_value;
+	}
+
+	entry->closing = true;
+
+	if (async_close_tail != NULL) async_close_tail->next = job;
+	else async_close_head = job;
+	async_close_tail = job;
+	async_close_pending++;
+
+	pthread_cond_signal(&async_close_work_cond);
+	pthread_mutex_unlock(&async_close_mutex);
+
+	filetrack_unlock();
+	return 0;
+}
+
+
+void filetrack_fclose_async_drain (void) {
+	pthread_mutex_lock(&async_close_mutex);
+	while (async_close_pending > 0)
+		pthread_cond_wait(&async_close_idle_cond, &async_close_mutex);
+	pthread_mutex_unlock(&async_close_mutex);
+}
+
+
+bool filetrack_fclose_async_poll (FileTrackAsyncCloseResult* result, uint64_t* lost_cnt) {
+	pthread_mutex_lock(&async_close_mutex);
+
+	if (lost_cnt != NULL) {
+		*lost_cnt = async_close_errors_lost;
+		async_close_errors_lost = 0;
+	}
+
+	bool found = (async_close_errors_cnt > 0);
+	if (found) {
+		if (result != NULL) *result = async_close_errors[async_close_errors_head];
+		async_close_errors_head = (async_close_errors_head + 1) % FT_ASYNC_CLOSE_ERRORS_MAX;
+		async_close_errors_cnt--;
+	}
+
+	pthread_mutex_unlock(&async_close_mutex);
+	return found;
+}
+
+
+void filetrack_fclose_async_callback_set (FileTrackAsyncCloseCallback callback, void* arg) {
+	filetrack_lock();  /* ワーカーはロック中に読み出す */
+	async_close_callback = callback;
+	async_close_callback_arg = arg;
+	filetrack_unlock();
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_IO_URING
+static void uring_quit (void) {
+	if (uring.fd < 0) return;
+
+	if (uring.sqes != NULL) munmap(uring.sqes, uring.sqes_size);
+	if (uring.cq_ptr != NULL && uring.cq_ptr != uring.sq_ptr) munmap(uring.cq_ptr, uring.cq_size);
+	if (uring.sq_ptr != NULL) munmap(uring.sq_ptr, uring.sq_size);
+	close(uring.fd);
+
+	uring = (FileTrackUring){ .fd = -1 };
+}
+
+
+
+#ifndef FILETRACK_ENABLE_ADMISSION_CONTROL
+/*
+ * io_uring を準備する、使えない環境なら false を返し、以降は同期的に開く
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static bool uring_init (void) {
+	if (uring.fd >= 0) return true;
+	if (uring_unavailable) return false;
+
+	int tmp_errno = errno;
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	int fd = (int)syscall(__NR_io_uring_setup, FT_IO_URING_ENTRIES, &params);
+	if (fd < 0) {  /* 古いカーネル、seccomp で禁止されている場合など */
+		uring_unavailable = true;
+		errno = tmp_errno;
+		return false;
+	}
+
+	uring.fd = fd;
+	uring.sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	uring.cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) && uring.cq_size > uring.sq_size)
+		uring.sq_size = uring.cq_size;
+
+	uring.sq_ptr = mmap(NULL, uring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (uring.sq_ptr == MAP_FAILED) uring.sq_ptr = NULL;
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		uring.cq_ptr = uring.sq_ptr;
+	} else {
+		uring.cq_ptr = mmap(NULL, uring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (uring.cq_ptr == MAP_FAILED) uring.cq_ptr = NULL;
+	}
+
+	uring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring.sqes = mmap(NULL, uring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (uring.sqes == MAP_FAILED) uring.sqes = NULL;
+
+	if (UNLIKELY(uring.sq_ptr == NULL || uring.cq_ptr == NULL || uring.sqes == NULL)) {
+		uring_quit();
+		uring_unavailable = true;
+		errno = tmp_errno;
+		return false;
+	}
+
+	char* sq = (char*)uring.sq_ptr;
+	char* cq = (char*)uring.cq_ptr;
+	uring.sq_tail = (void*)(sq + params.sq_off.tail);
+	uring.sq_mask = *(const unsigned*)(void*)(sq + params.sq_off.ring_mask);
+	uring.sq_array = (void*)(sq + params.sq_off.array);
+	uring.cq_head = (void*)(cq + params.cq_off.head);
+	uring.cq_tail = (void*)(cq + params.cq_off.tail);
+	uring.cq_mask = *(const unsigned*)(void*)(cq + params.cq_off.ring_mask);
+	uring.cqes = (void*)(cq + params.cq_off.cqes);
+	uring.entries = params.sq_entries;
+
+	errno = tmp_errno;
+	return true;
+}
+
+
+/*
+ * paths の各ファイルを IORING_OP_OPENAT でまとめて開き、結果 (記述子または -errno) を results に入れる
+ * 途中で io_uring が使えなくなった場合、完了していないものは -ECANCELED になる
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void uring_openat_batch (char* const* paths, const int* flags, int* results, size_t count) {
+	for (size_t i = 0; i < count; i++)
+		results[i] = -ECANCELED;
+
+	int tmp_errno = errno;
+
+	for (size_t offset = 0; offset < count; offset += uring.entries) {
+		unsigned chunk = (count - offset < uring.entries) ? (unsigned)(count - offset) : uring.entries;
+
+		unsigned tail = atomic_load_explicit(uring.sq_tail, memory_order_relaxed);  /* 書き込むのはこちらだけ */
+		for (unsigned i = 0; i < chunk; i++) {
+			unsigned index = (tail + i) & uring.sq_mask;
+			struct io_uring_sqe* sqe = &uring.sqes[index];
+			memset(sqe, 0, sizeof(struct io_uring_sqe));
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uint64_t)(uintptr_t)paths[offset + i];
+			sqe->len = 0666;  /* fopen と同じく umask に任せる */
+			sqe->open_flags = (uint32_t)flags[offset + i];
+			sqe->user_data = offset + i;
+			uring.sq_array[index] = index;
+		}
+		atomic_store_explicit(uring.sq_tail, tail + chunk, memory_order_release);
+
+		unsigned to_submit = chunk;
+		unsigned completed = 0;
+		while (completed < chunk) {
+			int submitted = (int)syscall(__NR_io_uring_enter, uring.fd, to_submit, chunk - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+			if (submitted < 0) {
+				if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+				uring_quit();  /* 提出済みのものの結果を受け取れないので io_uring ごと閉じる */
+				uring_unavailable = true;
+				errno = tmp_errno;
+				return;
+			}
+			to_submit -= ((unsigned)submitted < to_submit) ? (unsigned)submitted : to_submit;
+
+			unsigned head = atomic_load_explicit(uring.cq_head, memory_order_relaxed);
+			unsigned cq_tail = atomic_load_explicit(uring.cq_tail, memory_order_acquire);
+			for (; head != cq_tail; head++) {
+				const struct io_uring_cqe* cqe = &uring.cqes[head & uring.cq_mask];
+				if (LIKELY(cqe->user_data < count)) results[cqe->user_data] = cqe->res;
+				completed++;
+			}
+			atomic_store_explicit(uring.cq_head, head, memory_order_release);
+		}
+	}
+
+	errno = tmp_errno;
+}
+
+
+/* fopen のモードを open のフラグに変換する、扱えないモードなら false を返す */
+static bool uring_open_flags (const char* mode, int* flags) {
+	int access_mode;
+	int extra;
+	switch (mode[0]) {
+		case 'r':
+			access_mode = O_RDONLY;
+			extra = 0;
+			break;
+		case 'w':
+			access_mode = O_WRONLY;
+			extra = O_CREAT | O_TRUNC;
+			break;
+		case 'a':
+			access_mode = O_WRONLY;
+			extra = O_CREAT | O_APPEND;
+			break;
+		default:
+			return false;
+	}
+
+	for (size_t i = 1; i < FT_MODE_LEN_MAX && mode[i] != '\0'; i++) {
+		switch (mode[i]) {
+			case '+':
+				access_mode = O_RDWR;
+				break;
+			case 'x':
+				extra |= O_EXCL;
+				break;
+			case 'e':
+				extra |= O_CLOEXEC;
+				break;
+			case 'b':
+			case 't':
+				break;
+			default:  /* ccs= などは fopen に任せる */
+				return false;
+		}
+	}
+
+	*flags = access_mode | extra;
+	return true;
+}
+#endif
+
+
+size_t filetrack_fopen_batch (const char* const* filenames, const char* const* modes, FILE** streams, size_t count, size_t filename_len_max, const char* file, int line) {
+	if (filenames == NULL || modes == NULL || streams == NULL) {
+		fprintf(stderr, "No processing was done because filenames, modes or streams is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fopen_batch";
+		return 0;
+	}
+
+	size_t opened = 0;
+
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+	/* 一つずつ枠を待つ必要があるので、まとめずに開く */
+	for (size_t i = 0; i < count; i++) {
+		streams[i] = filetrack_fopen(filenames[i], modes[i], filename_len_max, file, line);
+		if (streams[i] != NULL) opened++;
+	}
+	return opened;
+#else
+	filetrack_lock();
+
+	if (UNLIKELY(filetrack_entries == NULL)) init();
+	batch_stats.batches++;
+
+	/* paths と flags は io_uring に渡すものだけを詰め、index で元の位置に戻す */
+	char** paths = malloc(sizeof(char*) * count);
+	int* flags = malloc(sizeof(int) * count);
+	int* results = malloc(sizeof(int) * count);
+	size_t* index = malloc(sizeof(size_t) * count);
+	size_t queued = 0;
+
+	bool use_uring = (paths != NULL && flags != NULL && results != NULL && index != NULL && uring_init());
+
+	for (size_t i = 0; i < count; i++) {
+		streams[i] = NULL;
+
+		int open_flags = 0;
+		bool queue = use_uring && filenames[i] != NULL && filenames[i][0] != '\0' && modes[i] != NULL && modes[i][0] != '\0' && filename_len_max > 0 && uring_open_flags(modes[i], &open_flags);
+#ifdef FILETRACK_ENABLE_NEGATIVE_CACHE
+		if (queue && !negative_mode_creates(modes[i]) && negative_check(filenames[i])) queue = false;  /* 同期的な経路で処理させる */
+#endif
+		if (queue) {
+			paths[queued] = mutils_strndup(filenames[i], filename_len_max);
+			if (UNLIKELY(paths[queued] == NULL)) queue = false;
+		}
+
+		if (!queue) {  /* 引数の誤りの報告なども含めて fopen と同じように処理する */
+			streams[i] = filetrack_fopen_without_lock(filenames[i], modes[i], filename_len_max, file, line);
+			batch_stats.fallback_opens++;
+			continue;
+		}
+
+		flags[queued] = open_flags;
+		index[queued] = i;
+		queued++;
+	}
+
+	if (queued > 0) uring_openat_batch(paths, flags, results, queued);
+
+	for (size_t j = 0; j < queued; j++) {
+		size_t i = index[j];
+		int result = results[j];
+		free(paths[j]);
+
+		if (result == -EINVAL || result == -EMFILE || result == -ENFILE || result == -ECANCELED) {
+			/* OPENAT に対応していないカーネル、記述子の不足 (仮想ハンドルで空けられる) など */
+			streams[i] = filetrack_fopen_without_lock(filenames[i], modes[i], filename_len_max, file, line);
+			batch_stats.fallback_opens++;
+			continue;
+		}
+
+		batch_stats.uring_opens++;
+
+		FILE* stream = NULL;
+		if (result >= 0) {
+			stream = fdopen(result, modes[i]);
+			if (UNLIKELY(stream == NULL)) {
+				int tmp_errno = errno;
+				close(result);
+				errno = tmp_errno;
+			}
+		} else {
+			errno = -result;
+		}
+
+#ifdef FILETRACK_ENABLE_NEGATIVE_CACHE
+		if (stream == NULL) {
+			if (errno == ENOENT && !negative_mode_creates(modes[i])) negative_record(filenames[i]);
+		} else if (negative_mode_creates(modes[i])) {
+			negative_invalidate(filenames[i]);
+		}
+#endif
+
+		if (UNLIKELY(stream == NULL)) {
+			fprintf(stderr, "Failed to open file '%s' with mode '%s'.\nFile: %s   Line: %d\n", filenames[i], modes[i], file, line);
+			filetrack_errfunc = "filetrack_fopen_batch";
+			continue;
+		}
+
+		streams[i] = fopen_track(stream, filenames[i], modes[i], filename_len_max, file, line);
+	}
+
+	free(paths);
+	free(flags);
+	free(results);
+	free(index);
+
+	for (size_t i = 0; i < count; i++) {
+		if (streams[i] != NULL) opened++;
+	}
+
+	filetrack_unlock();
+	return opened;
+#endif
+}
+
+
+int filetrack_fclose_batch (FILE* const* streams, size_t count, const char* file, int line) {
+	if (streams == NULL) {
+		fprintf(stderr, "No processing was done because the streams is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fclose_batch";
+		return EOF;
+	}
+
+	int return_value = 0;
+
+	filetrack_lock();
+	for (size_t i = 0; i < count; i++) {
+		if (streams[i] == NULL) continue;
+		if (fclose_with_recycle(streams[i], file, line) != 0) return_value = EOF;
+	}
+	filetrack_unlock();
+
+	return return_value;
+}
+
+
+bool filetrack_batch_stats (FileTrackBatchStats* stats) {
+	if (stats == NULL) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_batch_stats";
+		return false;
+	}
+
+	filetrack_lock();
+	*stats = batch_stats;
+	stats->uring_available = (uring.fd >= 0);
+	filetrack_unlock();
+	return true;
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_GROUP_COMMIT
+/*
+ * 閉じるストリームの同期に使う記述子を用意する、同期せずに閉じるストリームなら false を返す
+ * 標本に選ばれなかったものなど追跡していないストリームも、記述子があれば同期する
+ * 書き出しは仮想ハンドルのコールバックがロックを取るので、呼び出し元がロックの外で行う
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static bool durable_prepare (FileTrackDurableJob* job) {
+	if (job->stream == NULL) return false;
+
+	FILE* real = job->stream;
+	const char* path = NULL;  /* 休止中の仮想ハンドルは名前で開き直して同期する */
+	const FileTrackEntry* entry = (filetrack_entries != NULL) ? mht_uint_get(filetrack_entries, (uint_keyt)job->stream) : NULL;
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	if (entry == NULL) {
+		const FileTrackCookie* cookie = cookie_find(job->stream);
+		if (cookie != NULL) {
+			entry = &cookie->entry;
+			real = cookie->real;
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+			if (real == NULL) path = cookie->path;
+#endif
+		}
+	}
+#endif
+	if (entry != NULL) {
+#ifdef DEBUG
+		if (entry->is_closed) return false;  /* 閉じ直しとして報告させる */
+#endif
+#ifdef FT_POPEN_SUPPORTED
+		if (entry->open_type == FILE_OPEN_POPEN) return false;  /* パイプは同期できない */
+#endif
+	}
+
+	int tmp_errno = errno;
+
+	/* cookie の内側のストリームはバッファなしなので、外側を書き出せば足りる */
+	if (real != NULL) {
+		int fd = fileno(real);
+		if (fd >= 0) job->fd = dup(fd);  /* 閉じた後でも同期できるように複製する */
+		else job->fd = -1;  /* fmemopen などは同期するものがない */
+	} else if (path != NULL) {
+		job->fd = open(path, O_RDONLY | O_CLOEXEC);
+	}
+
+	if (job->fd < 0 && (real != NULL ? fileno(real) >= 0 : path != NULL)) {
+		job->sync_result = -1;
+		job->sync_errno = errno;
+	} else if (job->fd >= 0) {
+		struct stat st;
+		if (fstat(job->fd, &st) == 0) {
+			if (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)) {
+				job->dev = st.st_dev;
+			} else {  /* パイプやソケットは fsync できない */
+				close(job->fd);
+				job->fd = -1;
+			}
+		}
+	}
+
+	errno = tmp_errno;
+	return true;
+}
+
+
+/* まとめて取り出したストリームを同期してから、一度のロックで全て閉じる */
+static void durable_commit (FileTrackDurableJob* batch, size_t syncfs_min) {
+	uint64_t begin_ns = clock_ns();
+	int tmp_errno = errno;
+
+	size_t batch_cnt = 0;
+	for (FileTrackDurableJob* job = batch; job != NULL; job = job->next)
+		batch_cnt++;
+
+	uint64_t sync_cnt = 0;
+#ifdef __linux__
+	/* 同じファイルシステム上のファイルが十分に多ければ、syncfs 一回で済ませる */
+	if (syncfs_min > 0 && batch_cnt >= syncfs_min) {
+		for (FileTrackDurableJob* job = batch; job != NULL; job = job->next) {
+			if (job->fd < 0 || job->synced) continue;
+
+			size_t same_cnt = 0;
+			for (const FileTrackDurableJob* other = job; other != NULL; other = other->next) {
+				if (other->fd >= 0 && !other->synced && other->dev == job->dev) same_cnt++;
+			}
+			if (same_cnt < syncfs_min) continue;
+
+			errno = 0;
+			int result = syncfs(job->fd);
+			int error = errno;
+			sync_cnt++;
+			for (FileTrackDurableJob* other = job; other != NULL; other = other->next) {
+				if (other->fd < 0 || other->synced || other->dev != job->dev) continue;
+				other->synced = true;
+				other->sync_result = result;
+				other->sync_errno = error;
+			}
+		}
+	}
+#else
+	(void)syncfs_min;
+#endif
+
+	for (FileTrackDurableJob* job = batch; job != NULL; job = job->next) {
+		if (job->fd < 0) continue;
+		if (!job->synced) {
+			errno = 0;
+			job->sync_result = fsync(job->fd);
+			job->sync_errno = errno;
+			job->synced = true;
+			sync_cnt++;
+		}
+		close(job->fd);
+		job->fd = -1;
+	}
+
+	errno = tmp_errno;
+
+	filetrack_lock();
+	for (FileTrackDurableJob* job = batch; job != NULL; job = job->next) {
+		if (job->sync_result != 0) {
+			fprintf(stderr, "Failed to write the stream to storage before closing it.\nFile: %s   Line: %d\n", job->file, job->line);
+		}
+
+		errno = 0;
+		job->result = fclose_with_recycle(job->stream, job->file, job->line);
+		job->error = errno;
+		if (job->sync_result != 0) {
+			job->result = EOF;
+			job->error = job->sync_errno;
+		}
+	}
+
+	durable_batches_cnt++;
+	durable_files_cnt += batch_cnt;
+	durable_sync_cnt += sync_cnt;
+	if (batch_cnt > durable_largest_batch) durable_largest_batch = batch_cnt;
+	hist_record(&durable_hist, clock_ns() - begin_ns);
+	filetrack_unlock();
+
+	errno = tmp_errno;
+}
+
+
+int filetrack_fclose_durable (FILE* stream, const char* file, int line) {
+	FileTrackDurableJob job = {
+		.next = NULL,
+		.stream = stream,
+		.file = file,
+		.line = line,
+		.fd = -1
+	};
+
+	filetrack_lock();
+
+	if (UNLIKELY(filetrack_entries == NULL)) init();
+
+	if (!durable_prepare(&job)) {  /* 閉じ直しやパイプは通常通り閉じてエラーを報告させる */
+		int return_value = fclose_with_recycle(stream, file, line);
+		filetrack_unlock();
+		return return_value;
+	}
+
+	filetrack_unlock();
+
+	int tmp_errno = errno;
+	errno = 0;
+	if (fflush(stream) != 0 && job.sync_result == 0) {  /* 閉じる処理は他と一緒に行い、失敗として報告する */
+		job.sync_result = -1;
+		job.sync_errno = (errno != 0) ? errno : EIO;
+	}
+	errno = tmp_errno;
+
+	pthread_mutex_lock(&durable_mutex);
+
+	if (durable_tail != NULL) durable_tail->next = &job;
+	else durable_head = &job;
+	durable_tail = &job;
+
+	/* 同期中のスレッドがいなければ、待っているもの全てをまとめて自分で同期する */
+	while (!job.done) {
+		if (durable_committing) {
+			pthread_cond_wait(&durable_cond, &durable_mutex);
+			continue;
+		}
+
+		durable_committing = true;
+		FileTrackDurableJob* batch = durable_head;
+		durable_head = NULL;
+		durable_tail = NULL;
+		size_t syncfs_min = durable_syncfs_min;
+		pthread_mutex_unlock(&durable_mutex);
+
+		durable_commit(batch, syncfs_min);
+
+		pthread_mutex_lock(&durable_mutex);
+		while (batch != NULL) {
+			FileTrackDurableJob* next = batch->next;  /* done にした後は待っていたスレッドが戻ってしまう */
+			batch->done = true;
+			batch = next;
+		}
+		durable_committing = false;
+		pthread_cond_broadcast(&durable_cond);
+	}
+
+	pthread_mutex_unlock(&durable_mutex);
+
+	if (job.result != 0) {
+		errno = job.error;
+		filetrack_errfunc = "filetrack_fclose_durable";
+	}
+	return job.result;
+}
+
+
+void filetrack_fclose_durable_syncfs_min_set (size_t file_cnt) {
+	pthread_mutex_lock(&durable_mutex);
+	durable_syncfs_min = file_cnt;
+	pthread_mutex_unlock(&durable_mutex);
+}
+
+
+bool filetrack_durable_stats (FileTrackDurableStats* stats) {
+	if (stats == NULL) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_durable_stats";
+		return false;
+	}
+
+	filetrack_lock();
+	*stats = (FileTrackDurableStats){
+		.batches = durable_batches_cnt,
+		.files = durable_files_cnt,
+		.sync_calls = durable_sync_cnt,
+		.largest_batch = durable_largest_batch,
+		.p50_ns = hist_percentile(&durable_hist, 500),
+		.p99_ns = hist_percentile(&durable_hist, 990),
+		.max_ns = durable_hist.max
+	};
+	filetrack_unlock();
+	return true;
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+bool filetrack_buffer_size_set (const char* file, int line, size_t size) {
+	if (file == NULL || (size > 0 && buffer_class(size) < 0)) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_buffer_size_set";
+		return false;
+	}
+
+	filetrack_lock();
+
+	if (UNLIKELY(filetrack_entries == NULL)) init();
+
+	FileTrackSite* site = site_get(file, line);
+	if (UNLIKELY(site == NULL)) {
+		filetrack_unlock();
+		errno = ENOMEM;
+		filetrack_errfunc = "filetrack_buffer_size_set";
+		return false;
+	}
+
+	site->buffer_size = size;
+	site->buffer_size_set = true;
+
+	filetrack_unlock();
+	return true;
+}
+
+
+bool filetrack_buffer_size_default_set (size_t size) {
+	if (size > 0 && buffer_class(size) < 0) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_buffer_size_default_set";
+		return false;
+	}
+
+	filetrack_lock();
+	buffer_default_size = size;
+	filetrack_unlock();
+	return true;
+}
+
+
+bool filetrack_buffer_pool_hugepages_set (bool enable) {
+#ifdef __linux__
+	filetrack_lock();
+	buffer_hugepages = enable;  /* 既にプールにあるものはそのまま使う */
+	filetrack_unlock();
+	return true;
+#else
+	if (!enable) return true;
+	errno = ENOTSUP;
+	filetrack_errfunc = "filetrack_buffer_pool_hugepages_set";
+	return false;
+#endif
+}
+
+
+bool filetrack_buffer_pool_stats (FileTrackBufferPoolStats* stats) {
+	if (stats == NULL) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_buffer_pool_stats";
+		return false;
+	}
+
+	filetrack_lock();
+	*stats = buffer_pool_stats;
+	filetrack_unlock();
+	return true;
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+bool filetrack_write_advisor_autotune_set (bool enable) {
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	filetrack_lock();
+	write_advisor_autotune = enable;
+	filetrack_unlock();
+	return true;
+#else
+	if (!enable) return true;
+	errno = ENOTSUP;  /* 以降に開くストリームのバッファを変える手段がない */
+	filetrack_errfunc = "filetrack_write_advisor_autotune_set";
+	return false;
+#endif
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_FADVISE
+void filetrack_fadvise_readahead_set (bool enable) {
+	filetrack_lock();
+	fadvise_readahead = enable;
+	filetrack_unlock();
+}
+
+
+bool filetrack_fadvise_stats (FileTrackFadviseStats* stats) {
+	if (stats == NULL) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_fadvise_stats";
+		return false;
+	}
+
+	filetrack_lock();
+	*stats = fadvise_stats;
+	filetrack_unlock();
+	return true;
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_PREFETCH
+bool filetrack_prefetch_set (const char* file, int line, size_t size) {
+	if (file == NULL) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_prefetch_set";
+		return false;
+	}
+
+	filetrack_lock();
+
+	if (UNLIKELY(filetrack_entries == NULL)) init();
+
+	FileTrackSite* site = site_get(file, line);
+	if (UNLIKELY(site == NULL)) {
+		filetrack_unlock();
+		errno = ENOMEM;
+		filetrack_errfunc = "filetrack_prefetch_set";
+		return false;
+	}
+
+	site->prefetch_size = size;
+	site->prefetch_size_set = true;
+
+	filetrack_unlock();
+	return true;
+}
+
+
+bool filetrack_prefetch_stats (FileTrackPrefetchStats* stats) {
+	if (stats == NULL) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_prefetch_stats";
+		return false;
+	}
+
+	filetrack_lock();
+	*stats = prefetch_stats;
+	filetrack_unlock();
+	return true;
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+bool filetrack_sampling_set (uint32_t period, bool adaptive) {
+	if (period == 0) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_sampling_set";
+		return false;
+	}
+
+	filetrack_lock();
+	sampling_period = period;
+	sampling_adaptive = adaptive;
+	sampling_countdown = 0;
+	filetrack_unlock();
+	return true;
+}
+
+
+bool filetrack_sampling_stats (FileTrackSamplingStats* stats) {
+	if (stats == NULL) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_sampling_stats";
+		return false;
+	}
+
+	filetrack_lock();
+	*stats = sampling_stats;
+	stats->period = sampling_period;
+	stats->adaptive = sampling_adaptive;
+	filetrack_unlock();
+	return true;
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_BACKTRACE
+bool filetrack_backtrace_depth_set (size_t depth) {
+	if (depth > FT_BACKTRACE_DEPTH_MAX) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_backtrace_depth_set";
+		return false;
+	}
+
+	filetrack_lock();
+	backtrace_depth = depth;
+	filetrack_unlock();
+	return true;
+}
+
+
+bool filetrack_backtrace_stats (FileTrackBacktraceStats* stats) {
+	if (stats == NULL) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_backtrace_stats";
+		return false;
+	}
+
+	filetrack_lock();
+	*stats = backtrace_stats;
+	stats->depth = backtrace_depth;
+	filetrack_unlock();
+	return true;
+}
+#endif
+
+
+#ifdef FT_POPEN_SUPPORTED
+/* 子プロセスを待つ間はロックを外すので、集計先は呼び出し元の場所で持っておく */
+typedef struct {
+	const char* site_file;  /* NULL なら記録されていない */
+	int site_line;
+	uint64_t popen_ns;
+} FileTrackChildReap;
+
+
+/*
+ * 子プロセスを待つ前に記録を閉じる
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static bool pclose_prepare (FILE* stream, FileTrackChildReap* reap, const char* file, int line) {
+	reap->site_file = NULL;
+	reap->site_line = 0;
+	reap->popen_ns = 0;
+
+	if (stream == NULL) {
+		fprintf(stderr, "No processing was done because the stream is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_pclose";
+		return false;
+	}
+
+	FileOpenType open_type = entry_open_type_get(stream);
+	if (open_type != FILE_NOT_OPEN && open_type != FILE_OPEN_POPEN) {
+		fprintf(stderr, "Stream not opened with popen must be closed with fclose!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_pclose";
+		return false;
+	}
+
+	if (open_type == FILE_NOT_OPEN) {
+#ifdef DEBUG
+		fprintf(stderr, "No entry found to close! The file might not be tracked.\nFile: %s   Line: %d\n", file, line);
+#endif
+		return true;
+	}
+
+	const FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+	if (entry->open_site != NULL) {
+		reap->site_file = entry->open_site->file;
+		reap->site_line = entry->open_site->line;
+	}
+	reap->popen_ns = entry->popen_ns;
+
+	/* 閉じた後はポインタを使えないので、子プロセスを待つ前に記録を閉じる */
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	int tmp_errno = errno;
+#endif
+	errno = 0;
+
+	filetrack_entry_close(stream, FILE_CLOSED_PCLOSE, file, line);
+
+	if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_pclose";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	else errno = tmp_errno;
+#endif
+	return true;
+}
+
+
+/*
+ * 子プロセスを回収した後に、実行時間と pclose の所要時間を記録する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void pclose_finish (const FileTrackChildReap* reap, int return_value, uint64_t begin_ns, uint64_t end_ns, const char* file, int line) {
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+	latency_record(file, line, FT_LATENCY_PCLOSE, begin_ns);
+#else
+	(void)begin_ns;
+#endif
+
+	if (reap->site_file != NULL) {
+		FileTrackSite* site = site_get(reap->site_file, reap->site_line);  /* 待っている間に終了処理が走っていれば NULL */
+		if (site != NULL) {
+			uint64_t wall_ns = (end_ns > reap->popen_ns) ? end_ns - reap->popen_ns : 0;
+			site->child_closed_cnt++;
+			site->child_wall_ns += wall_ns;
+			if (wall_ns > site->child_wall_max_ns) site->child_wall_max_ns = wall_ns;
+		}
+	}
+
+	if (return_value == -1) {
+		fprintf(stderr, "Failed to close pipe stream!\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_pclose";
+	}
+}
+
+
+static int filetrack_pclose_without_lock (FILE* stream, const char* file, int line) {
+	FileTrackChildReap reap;
+	if (!pclose_prepare(stream, &reap, file, line)) return -1;
+
+	uint64_t begin_ns = clock_ns();
+	int return_value = pclose(stream);  /* 子プロセスの終了状態 */
+	pclose_finish(&reap, return_value, begin_ns, clock_ns(), file, line);
+
+	return return_value;
+}
+
+
+/* 子プロセスを待つ間は他のスレッドを止めないようにロックを外す */
+int filetrack_pclose (FILE* stream, const char* file, int line) {
+	filetrack_lock();
+	FileTrackChildReap reap;
+	bool prepared = pclose_prepare(stream, &reap, file, line);
+	filetrack_unlock();
+	if (!prepared) return -1;
+
+	uint64_t begin_ns = clock_ns();
+	int return_value = pclose(stream);
+	uint64_t end_ns = clock_ns();
+	int tmp_errno = errno;
+
+	filetrack_lock();
+	pclose_finish(&reap, return_value, begin_ns, end_ns, file, line);
+	filetrack_unlock();
+
+	errno = tmp_errno;
+	return return_value;
+}
+#endif
+
+
+/* 終了時に、開き方に合った関数で閉じる */
+static int stream_close_without_lock (FILE* stream, FileOpenType open_type) {
+#ifdef FT_POPEN_SUPPORTED
+	if (open_type == FILE_OPEN_POPEN)
+		return filetrack_pclose_without_lock(stream, __FILE__, __LINE__);
+#else
+	(void)open_type;
+#endif
+	return filetrack_fclose_without_lock(stream, __FILE__, __LINE__);
+}
+
+
+#ifdef DEBUG
+static bool can_be_removed_check (const char* filename, size_t filename_len_max, const char* file, int line) {
+	size_t filename_len = mutils_strnlen(filename, filename_len_max);
+	if (UNLIKELY(filename_len == 0)) {  /* ファイル名の長さの取得に失敗した場合 */
+		fprintf(stderr, "Failed to retrieve the filename length.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_remove";
+		return true;  /* エラーではあるが続行 */
+	}
+
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	for (FileTrackCookie* cookie = cookies; cookie != NULL; cookie = cookie->next) {
+		if (strncmp(cookie->entry.filename, filename, filename_len) != 0 || cookie->entry.filename[filename_len] != '\0') continue;
+
+		fprintf(stderr, "File '%s' is still open and cannot be removed.\nFile: %s   Line: %d\n", filename, file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_remove";
+		return false;
+	}
+#endif
+
+	str_keyt filename_key = {
+		.ptr = filename,
+		.len = filename_len
+	};
+
+	FilenameStreamEntry* filename_stream_entry = mht_str_get(filename_stream_entries, filename_key);
+	if (filename_stream_entry == NULL) return true;  /* 同じファイル名が記録されていない場合 */
+
+	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)filename_stream_entry->stream);
+	if (UNLIKELY(entry == NULL)) {  /* 構造が破損してエントリが見つからない場合 */
+		fprintf(stderr, "The filename_stream_entry corresponding to file '%s' exists, but no corresponding entry is found.\nFile: %s   Line: %d\n", filename, file, line);
+		errno = EPROTO;
+		filetrack_errfunc = "filetrack_remove";
+		return true;  /* エラーではあるが続行 */
+	}
+
+	if (entry->is_closed) return true;  /* 過去に開かれていたが既にクローズされている場合 */
+
+	/* 削除しようとしたファイルがまだオープンされている場合 */
+	fprintf(stderr, "File '%s' is still open and cannot be removed.\nFile: %s   Line: %d\n", filename, file, line);
+	errno = EINVAL;
+	filetrack_errfunc = "filetrack_remove";
+	return false;
+}
+#endif
+
+
+#if defined (DEBUG) || defined (FILETRACK_ENABLE_STREAM_CACHE)
+int filetrack_remove (const char* filename, size_t filename_len_max, const char* file, int line) {
+	if (filename == NULL) {
+		fprintf(stderr, "No processing was done because the filename is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_remove";
+		return 1;
+	}
+
+	if (filename[0] == '\0') {
+		fprintf(stderr, "No processing was done because the filename is empty.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_remove";
+		return 1;
+	}
+
+	if (filename_len_max < 1) {
+		fprintf(stderr, "filename_len_max must be at least 1.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_remove";
+		return 1;
+	}
+
+	filetrack_lock();
+
+#ifdef DEBUG
+	if (filename_stream_entries != NULL) {
+		if (!can_be_removed_check(filename, filename_len_max, file, line)) {
+			filetrack_unlock();
+			return 1;  /* 削除不可を確認した場合、エラーを返して終了 */
+		}
+	}
+#endif
+
+#ifdef FILETRACK_ENABLE_STREAM_CACHE
+	stream_cache_invalidate(filename);  /* 削除されたファイルのストリームを使い回さない */
+#endif
+
+	filetrack_unlock();
+
+	int result = remove(filename);
+	if (result != 0)
+		filetrack_errfunc = "filetrack_remove";
+	return result;
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_IO_STATS
+size_t filetrack_fread (void* ptr, size_t size, size_t nmemb, FILE* stream) {
+	size_t result = fread(ptr, size, nmemb, stream);
+	io_count(stream, FT_IO_READ, (uint64_t)result * size);
+	return result;
+}
+
+
+size_t filetrack_fwrite (const void* ptr, size_t size, size_t nmemb, FILE* stream) {
+	size_t result = fwrite(ptr, size, nmemb, stream);
+	io_count(stream, FT_IO_WRITE, (uint64_t)result * size);
+	return result;
+}
+
+
+int filetrack_fputs (const char* str, FILE* stream) {
+	int result = fputs(str, stream);
+	io_count(stream, FT_IO_WRITE, (result != EOF) ? (uint64_t)strlen(str) : 0);
+	return result;
+}
+
+
+int filetrack_fprintf (FILE* stream, const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	int result = vfprintf(stream, format, args);
+	va_end(args);
+
+	io_count(stream, FT_IO_WRITE, (result > 0) ? (uint64_t)result : 0);
+	return result;
+}
+
+
+char* filetrack_fgets (char* str, int size, FILE* stream) {
+	char* result = fgets(str, size, stream);
+	io_count(stream, FT_IO_READ, (result != NULL) ? (uint64_t)strlen(result) : 0);
+	return result;
+}
+
+
+int filetrack_fflush (FILE* stream) {
+	int result = fflush(stream);
+	io_count(stream, FT_IO_FLUSH, 0);
+	return result;
+}
+
+
+int filetrack_fseek (FILE* stream, long offset, int whence) {
+#ifdef FILETRACK_ENABLE_FADVISE
+	/* 移動した距離を求めるため、SEEK_SET の場合のみ元の位置を取得する */
+	int tmp_errno = errno;
+	long before = (whence == SEEK_SET) ? ftell(stream) : 0;
+	errno = tmp_errno;
+#endif
+
+	int result = fseek(stream, offset, whence);
+
+#ifdef FILETRACK_ENABLE_FADVISE
+	uint64_t far = 0;
+	if (result == 0) {
+		if (whence == SEEK_END) {
+			far = 1;
+		} else if (before >= 0) {
+			long distance = (whence == SEEK_SET) ? offset - before : offset;
+			if (distance >= FT_FADVISE_NEAR_SEEK || distance <= -FT_FADVISE_NEAR_SEEK) far = 1;
+		}
+	}
+	io_count(stream, FT_IO_SEEK, far);
+#else
+	io_count(stream, FT_IO_SEEK, 0);
+#endif
+	return result;
+}
+
+
+bool filetrack_io_stats (FILE* stream, FileTrackIoStats* stats) {
+	if (stream == NULL || stats == NULL) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_io_stats";
+		return false;
+	}
+
+	filetrack_lock();
+
+	FileTrackEntry* entry = NULL;
+	if (filetrack_entries != NULL)
+		entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
+
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	if (entry == NULL) {
+		FileTrackCookie* cookie = cookie_find(stream);
+		if (cookie != NULL) entry = &cookie->entry;
+	}
+#endif
+
+	if (entry == NULL) {
+		filetrack_unlock();
+		errno = ENOENT;
+		filetrack_errfunc = "filetrack_io_stats";
+		return false;
+	}
+
+#ifdef DEBUG
+	if (!entry->is_closed)
+#endif
+		io_collect(stream, entry, false);
+
+	*stats = entry->io;
+
+	filetrack_unlock();
+	return true;
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+/*
+ * 開かれた記述子を呼び出し元と合わせて記録する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void fd_add (int fd, FileTrackFdType type, const char* path, const char* file, int line) {
+	if (UNLIKELY(filetrack_entries == NULL)) init();
+
+	FileTrackFdEntry* entry = fd_entry_get(fd, false);
+	if (entry != NULL && entry->type == FT_FD_STREAM) {  /* 追跡中のストリームの記述子が閉じられていた場合 */
+		fprintf(stderr, "Descriptor %d was reused while a tracked stream still refers to it.\nFile: %s   Line: %d\n", fd, file, line);
+		filetrack_errfunc = "filetrack_fd_register";
+	}
+
+	fd_register(fd, type, site_get(file, line), NULL, path);
+
+#ifdef FILETRACK_ENABLE_NOFILE_ALARM
+	nofile_check();
+#endif
+}
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static const char* fd_path_get (int fd) {
+#ifdef DEBUG
+	FileTrackFdEntry* entry = fd_entry_get(fd, false);
+	if (entry != NULL && entry->path != NULL) return entry->path;
+#else
+	(void)fd;
+#endif
+	return NULL;
+}
+
+
+int filetrack_open (const char* path, int flags, mode_t mode, const char* file, int line) {
+	if (path == NULL) {
+		fprintf(stderr, "No processing was done because the path is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_open";
+		return -1;
+	}
+
+	filetrack_lock();
+
+	int fd = open(path, flags, mode);
+	if (UNLIKELY(fd < 0)) {
+		fprintf(stderr, "Failed to open file '%s'.\nFile: %s   Line: %d\n", path, file, line);
+		filetrack_errfunc = "filetrack_open";
+	} else {
+		fd_add(fd, FT_FD_OPEN, path, file, line);
+	}
+
+	filetrack_unlock();
+	return fd;
+}
+
+
+int filetrack_openat (int dirfd, const char* path, int flags, mode_t mode, const char* file, int line) {
+	if (path == NULL) {
+		fprintf(stderr, "No processing was done because the path is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_openat";
+		return -1;
+	}
+
+	filetrack_lock();
+
+	int fd = openat(dirfd, path, flags, mode);
+	if (UNLIKELY(fd < 0)) {
+		fprintf(stderr, "Failed to open file '%s'.\nFile: %s   Line: %d\n", path, file, line);
+		filetrack_errfunc = "filetrack_openat";
+	} else {
+		fd_add(fd, FT_FD_OPENAT, path, file, line);
+	}
+
+	filetrack_unlock();
+	return fd;
+}
+
+
+int filetrack_close (int fd, const char* file, int line) {
+	filetrack_lock();
+
+	FileTrackFdEntry* entry = fd_entry_get(fd, false);
+	if (entry != NULL && entry->type == FT_FD_STREAM) {
+		fprintf(stderr, "Descriptor %d belongs to a tracked stream and should be closed with fclose.\nFile: %s   Line: %d\n", fd, file, line);
+		filetrack_errfunc = "filetrack_close";
+	}
+#ifdef DEBUG
+	else if (entry == NULL || entry->type == FT_FD_NONE) {
+		fprintf(stderr, "No entry found to close! The descriptor might not be tracked.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_close";
+	}
+#endif
+
+	int result = close(fd);
+	int close_errno = errno;
+	if (result != 0) {
+		fprintf(stderr, "Failed to close descriptor %d.\nFile: %s   Line: %d\n", fd, file, line);
+		filetrack_errfunc = "filetrack_close";
+	}
+
+	/* EINTR でも記述子は解放されているので、失敗しても記録は消す (ストリームの分は fclose で消す) */
+	if (entry != NULL && entry->type != FT_FD_STREAM && !(result != 0 && close_errno == EBADF))
+		fd_release(entry);
+
+	errno = close_errno;
+
+	filetrack_unlock();
+	return result;
+}
+
+
+int filetrack_dup (int fd, const char* file, int line) {
+	filetrack_lock();
+
+	int new_fd = dup(fd);
+	if (UNLIKELY(new_fd < 0)) {
+		fprintf(stderr, "Failed to duplicate descriptor %d.\nFile: %s   Line: %d\n", fd, file, line);
+		filetrack_errfunc = "filetrack_dup";
+	} else {
+		fd_add(new_fd, FT_FD_DUP, fd_path_get(fd), file, line);
+	}
+
+	filetrack_unlock();
+	return new_fd;
+}
+
+
+int filetrack_dup2 (int oldfd, int newfd, const char* file, int line) {
+	filetrack_lock();
+
+	int result = dup2(oldfd, newfd);
+	if (UNLIKELY(result < 0)) {
+		fprintf(stderr, "Failed to duplicate descriptor %d onto %d.\nFile: %s   Line: %d\n", oldfd, newfd, file, line);
+		filetrack_errfunc = "filetrack_dup2";
+	} else if (oldfd != newfd) {  /* 同じ番号なら何も起こらない */
+		fd_add(newfd, FT_FD_DUP2, fd_path_get(oldfd), file, line);
+	}
+
+	filetrack_unlock();
+	return result;
+}
+
+
+int filetrack_pipe (int fds[2], const char* file, int line) {
+	if (fds == NULL) {
+		fprintf(stderr, "No processing was done because fds is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_pipe";
+		return -1;
+	}
+
+	filetrack_lock();
+
+	int result = pipe(fds);
+	if (UNLIKELY(result != 0)) {
+		fprintf(stderr, "Failed to create a pipe.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_pipe";
+	} else {
+		fd_add(fds[0], FT_FD_PIPE, "(pipe read end)", file, line);
+		fd_add(fds[1], FT_FD_PIPE, "(pipe write end)", file, line);
+	}
+
+	filetrack_unlock();
+	return result;
+}
+
+
+int filetrack_socket (int domain, int type, int protocol, const char* file, int line) {
+	filetrack_lock();
+
+	int fd = socket(domain, type, protocol);
+	if (UNLIKELY(fd < 0)) {
+		fprintf(stderr, "Failed to create a socket.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_socket";
+	} else {
+		fd_add(fd, FT_FD_SOCKET, "(socket)", file, line);
+	}
+
+	filetrack_unlock();
+	return fd;
+}
+
+
+int filetrack_mkstemp (char* tmpl, const char* file, int line) {
+	if (tmpl == NULL) {
+		fprintf(stderr, "No processing was done because the template is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_mkstemp";
+		return -1;
+	}
+
+	filetrack_lock();
+
+	int fd = mkstemp(tmpl);
+	if (UNLIKELY(fd < 0)) {
+		fprintf(stderr, "Failed to create a temporary file from '%s'.\nFile: %s   Line: %d\n", tmpl, file, line);
+		filetrack_errfunc = "filetrack_mkstemp";
+	} else {
+		fd_add(fd, FT_FD_MKSTEMP, tmpl, file, line);  /* 作成されたファイル名に置き換わっている */
+	}
+
+	filetrack_unlock();
+	return fd;
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+/*
+ * ディレクトリが閉じられる際の集計と後始末
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void dir_release (FileTrackDirEntry* entry) {
+	if (LIKELY(dir_live_total > 0)) dir_live_total--;
+
+	if (entry->open_site != NULL) {
+		if (LIKELY(entry->open_site->dir_live_cnt > 0))
+			entry->open_site->dir_live_cnt--;
+#ifdef FILETRACK_ENABLE_READDIR_STATS
+		entry->open_site->dir_read_cnt += entry->read_cnt;
+		if (entry->read_cnt > entry->open_site->dir_read_max)
+			entry->open_site->dir_read_max = entry->read_cnt;
+#endif
+	}
+
+#ifdef DEBUG
+	free(entry->path);
+	entry->path = NULL;
+#endif
+}
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void dir_add (DIR* dir, const char* path, const char* file, int line) {
+	if (UNLIKELY(filetrack_entries == NULL)) init();
+
+	if (UNLIKELY(filetrack_dirs == NULL)) {
+		filetrack_dirs = mht_uint_create(FILETRACK_ENTRIES_COUNT);
+		if (UNLIKELY(filetrack_dirs == NULL)) {
+			fprintf(stderr, "Failed to initialize directory tracking.\nFile: %s   Line: %d\n", file, line);
+			filetrack_errfunc = "filetrack_opendir";
+			return;
+		}
+	}
+
+	/* 追跡外で閉じられたディレクトリのアドレスが再利用された場合 */
+	FileTrackDirEntry* old_entry = mht_uint_get(filetrack_dirs, (uint_keyt)dir);
+	if (old_entry != NULL)
+		dir_release(old_entry);
+
+	FileTrackDirEntry entry = {
+		.dir = dir,
+		.open_site = site_get(file, line)
+	};
+
+#ifdef DEBUG
+	if (path != NULL) {
+		entry.path = mutils_strndup(path, FT_FILENAME_LEN_MAX);
+		if (UNLIKELY(entry.path == NULL))
+			filetrack_errfunc = "filetrack_opendir";
+	}
+#else
+	(void)path;
+#endif
+
+	if (UNLIKELY(!mht_uint_set(filetrack_dirs, (uint_keyt)dir, &entry, sizeof(FileTrackDirEntry)))) {
+		fprintf(stderr, "Failed to add entry to directory tracking.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_opendir";
+#ifdef DEBUG
+		free(entry.path);
+#endif
+		return;
+	}
+
+	dir_live_total++;
+	if (entry.open_site != NULL) {
+		entry.open_site->dir_open_cnt++;
+		entry.open_site->dir_live_cnt++;
+	}
+
+#ifdef FILETRACK_ENABLE_NOFILE_ALARM
+	nofile_check();
+#endif
+}
+
+
+DIR* filetrack_opendir (const char* path, const char* file, int line) {
+	if (path == NULL) {
+		fprintf(stderr, "No processing was done because the path is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_opendir";
+		return NULL;
+	}
+
+	filetrack_lock();
+
+	DIR* dir = opendir(path);
+	if (UNLIKELY(dir == NULL)) {
+		fprintf(stderr, "Failed to open directory '%s'.\nFile: %s   Line: %d\n", path, file, line);
+		filetrack_errfunc = "filetrack_opendir";
+	} else {
+		dir_add(dir, path, file, line);
+	}
+
+	filetrack_unlock();
+	return dir;
+}
+
+
+DIR* filetrack_fdopendir (int fd, const char* file, int line) {
+	filetrack_lock();
+
+	DIR* dir = fdopendir(fd);
+	if (UNLIKELY(dir == NULL)) {
+		fprintf(stderr, "Failed to open directory from descriptor %d.\nFile: %s   Line: %d\n", fd, file, line);
+		filetrack_errfunc = "filetrack_fdopendir";
+	} else {
+		const char* path = NULL;
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+		/* 記述子は closedir で閉じられるので、ここからはディレクトリとして追跡する */
+		FileTrackFdEntry* fd_entry = fd_entry_get(fd, false);
+		if (fd_entry != NULL && fd_entry->type != FT_FD_STREAM) {
+#ifdef DEBUG
+			path = fd_entry->path;
+#endif
+			dir_add(dir, path, file, line);
+			fd_release(fd_entry);
+		} else {
+			dir_add(dir, path, file, line);
+		}
+#else
+		dir_add(dir, path, file, line);
+#endif
+	}
+
+	filetrack_unlock();
+	return dir;
+}
+
+
+int filetrack_closedir (DIR* dir, const char* file, int line) {
+	if (dir == NULL) {
+		fprintf(stderr, "No processing was done because the directory is NULL!\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_closedir";
+		return -1;
+	}
+
+	filetrack_lock();
+
+	FileTrackDirEntry* entry = (filetrack_dirs != NULL) ? mht_uint_get(filetrack_dirs, (uint_keyt)dir) : NULL;
+	if (entry == NULL) {
+		fprintf(stderr, "No entry found to close! The directory might not be tracked.\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_closedir";
+	} else {
+		dir_release(entry);
+		if (!mht_uint_delete(filetrack_dirs, (uint_keyt)dir))
+			filetrack_errfunc = "filetrack_closedir";
+	}
+
+	int result = closedir(dir);  /* 記録を消した後なら、同じアドレスが再利用されても問題ない */
+	if (result != 0) {
+		fprintf(stderr, "Failed to close directory!\nFile: %s   Line: %d\n", file, line);
+		filetrack_errfunc = "filetrack_closedir";
+	}
+
+	filetrack_unlock();
+	return result;
+}
+
+
+#ifdef FILETRACK_ENABLE_READDIR_STATS
+struct dirent* filetrack_readdir (DIR* dir) {
+	struct dirent* dirent = readdir(dir);
+	if (dirent == NULL) return NULL;  /* 終端またはエラー */
+
+	int tmp_errno = errno;  /* 読み終わりの判定に errno を使うプログラムのため */
+
+	filetrack_lock();
+	FileTrackDirEntry* entry = (filetrack_dirs != NULL) ? mht_uint_get(filetrack_dirs, (uint_keyt)dir) : NULL;
+	if (entry != NULL) entry->read_cnt++;
+	filetrack_unlock();
+
+	errno = tmp_errno;
+	return dirent;
+}
+#endif
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void dir_all_print (void) {
+	if (filetrack_dirs == NULL) return;
+
+	size_t dirs_arr_cnt;
+	FileTrackDirEntry** dirs_arr = (FileTrackDirEntry**)mht_all_get(filetrack_dirs, &dirs_arr_cnt);
+	if (UNLIKELY(dirs_arr == NULL)) {
+		fprintf(stderr, "Failed to get all entries from directory tracking.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+		filetrack_errfunc = "filetrack_all_check";
+		return;
+	}
+
+	for (size_t i = 0; i < dirs_arr_cnt; i++) {
+		const FileTrackDirEntry* entry = dirs_arr[i];
+		if (UNLIKELY(entry == NULL)) continue;
+
+		const char* open_file = (entry->open_site != NULL) ? entry->open_site->file : "unknown";
+		int open_line = (entry->open_site != NULL) ? entry->open_site->line : 0;
+#ifdef DEBUG
+		printf("\nDirectory: %p\nDirectory Name: %s\nopen File: %s   Line: %d\n", (void*)entry->dir, (entry->path != NULL) ? entry->path : "unknown", open_file, open_line);
+#else
+		printf("\nDirectory: %p\nopen File: %s   Line: %d\n", (void*)entry->dir, open_file, open_line);
+#endif
+#ifdef FILETRACK_ENABLE_READDIR_STATS
+		printf("Entries Read: %llu\n", (unsigned long long)entry->read_cnt);
+#endif
+	}
+
+	if (!mht_all_release_arr(dirs_arr))
+		filetrack_errfunc = "filetrack_all_check";
+}
+
+
+/*
+ * 開いているディレクトリの分を呼び出し元ごとに集計し直す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void dirs_collect_live (void) {
+#ifdef FILETRACK_ENABLE_READDIR_STATS
+	for (FileTrackSite* site = filetrack_sites_list; site != NULL; site = site->next)
+		site->dir_read_live_cnt = 0;
+
+	if (filetrack_dirs == NULL) return;
+
+	size_t dirs_arr_cnt;
+	FileTrackDirEntry** dirs_arr = (FileTrackDirEntry**)mht_all_get(filetrack_dirs, &dirs_arr_cnt);
+	if (UNLIKELY(dirs_arr == NULL)) {
+		filetrack_errfunc = "filetrack_site_report";
+		return;
+	}
+
+	for (size_t i = 0; i < dirs_arr_cnt; i++) {
+		if (UNLIKELY(dirs_arr[i] == NULL || dirs_arr[i]->open_site == NULL)) continue;
+		dirs_arr[i]->open_site->dir_read_live_cnt += dirs_arr[i]->read_cnt;
+	}
+
+	if (!mht_all_release_arr(dirs_arr))
+		filetrack_errfunc = "filetrack_site_report";
+#endif
+}
+
+
+/* 開いたままのディレクトリを閉じる */
+static void dir_quit (void) {
+	if (filetrack_dirs == NULL) return;
+
+	size_t dirs_arr_cnt;
+	FileTrackDirEntry** dirs_arr = (FileTrackDirEntry**)mht_all_get(filetrack_dirs, &dirs_arr_cnt);
+	if (UNLIKELY(dirs_arr == NULL)) {
+		fprintf(stderr, "Failed to get all entries from directory tracking.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+		filetrack_errfunc = "quit";
+	} else {
+		for (size_t i = 0; i < dirs_arr_cnt; i++) {
+			FileTrackDirEntry* entry = dirs_arr[i];
+			if (UNLIKELY(entry == NULL)) continue;
+
+#ifdef DEBUG
+			fprintf(stderr, "\nDirectory not closed!\nDirectory: %p\nDirectory Name: %s\nopen File: %s   Line: %d\n", (void*)entry->dir, (entry->path != NULL) ? entry->path : "unknown", (entry->open_site != NULL) ? entry->open_site->file : "unknown", (entry->open_site != NULL) ? entry->open_site->line : 0);
+			errno = EPERM;
+			filetrack_errfunc = "quit";
+#endif
+			dir_release(entry);
+			if (closedir(entry->dir) != 0)
+				filetrack_errfunc = "quit";
+		}
+		if (!mht_all_release_arr(dirs_arr))
+			filetrack_errfunc = "quit";
+	}
+
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	int tmp_errno = errno;
+#endif
+	errno = 0;
+
+	mht_destroy(filetrack_dirs);
+
+	if (UNLIKELY(errno != 0)) filetrack_errfunc = "quit";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	else errno = tmp_errno;
+#endif
+	filetrack_dirs = NULL;
+}
+#endif
+
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void entry_print (const FileTrackEntry* entry) {
+#ifndef DEBUG
+	printf("\nAlready Closed: false   Stream: %p\nPlease use debug mode if you need more detailed information.\n", entry->stream);
+#else
+	if (entry->is_closed) {
+		if (entry->last_change_mode_file != NULL)
+			printf("\nAlready Closed: true\nStream: %p   Mode: %s\nFile Name: %s\nclosed Type: %s\nclose File: %s   Line: %d\nopen Type: %s\nopen File: %s   Line: %d\nLast change mode File: %s   Line: %d\n", entry->stream, entry->mode, entry->filename, FileClosedTypeNames[entry->closed_type], entry->close_file, entry->close_line, FileOpenTypeNames[entry->open_type], entry->open_file, entry->open_line, entry->last_change_mode_file, entry->last_change_mode_line);
+		else
+			printf("\nAlready Closed: true\nStream: %p   Mode: %s\nFile Name: %s\nclosed Type: %s\nclose File: %s   Line: %d\nopen Type: %s\nopen File: %s   Line: %d\n", entry->stream, entry->mode, entry->filename, FileClosedTypeNames[entry->closed_type], entry->close_file, entry->close_line, FileOpenTypeNames[entry->open_type], entry->open_file, entry->open_line);
+	} else {
+		if (entry->last_change_mode_file != NULL)
+			printf("\nAlready Closed: false\nStream: %p   Mode: %s\nFile Name: %s\nopen Type: %s\nopen File: %s   Line: %d\nLast change mode File: %s   Line: %d\n", entry->stream, entry->mode, entry->filename, FileOpenTypeNames[entry->open_type], entry->open_file, entry->open_line, entry->last_change_mode_file, entry->last_change_mode_line);
+		else
+			printf("\nAlready Closed: false\nStream: %p   Mode: %s\nFile Name: %s\nopen Type: %s\nopen File: %s   Line: %d\n", entry->stream, entry->mode, entry->filename, FileOpenTypeNames[entry->open_type], entry->open_file, entry->open_line);
+	}
+#endif
+}
+
+
+#ifdef FILETRACK_ENABLE_LIFETIME_STATS
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void entry_lifetime_report (const FileTrackEntry* entry) {
+	uint64_t now_ns = coarse_clock_ns();
+
+#ifdef DEBUG
+	if (entry->is_closed) {
+		uint64_t lifetime = lifetime_us(entry->open_ns, entry->close_ns);
+		printf("Lifetime: " FT_DURATION_FMT "\n", FT_DURATION_ARGS(lifetime));
+		return;
+	}
+#endif
+
+	uint64_t age = lifetime_us(entry->open_ns, now_ns);
+	if (entry->mode_change_ns != 0) {
+		uint64_t since_mode_change = lifetime_us(entry->mode_change_ns, now_ns);
+		printf("Age: " FT_DURATION_FMT "   Mode Changed: " FT_DURATION_FMT " ago\n", FT_DURATION_ARGS(age), FT_DURATION_ARGS(since_mode_change));
+	} else {
+		printf("Age: " FT_DURATION_FMT "\n", FT_DURATION_ARGS(age));
+	}
+
+	/* 同じ呼び出し元で開かれた他のストリームと比べて長く開かれたままのもの */
+	const FileTrackHist* lifetime = (entry->open_site != NULL) ? entry->open_site->lifetime : NULL;
+	if (lifetime != NULL && lifetime->count >= FT_LIFETIME_MIN_SAMPLES) {
+		uint64_t p99 = hist_percentile(lifetime, 990);
+		if (age > p99 + FT_LIFETIME_SLACK_US)
+			printf("Held longer than 99%% of the streams closed at its call site (p99: " FT_DURATION_FMT ")\n", FT_DURATION_ARGS(p99));
+	}
+}
+#endif
+
+
+/*
+ * ストリームごとの追加情報を出力する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void entry_report (FileTrackEntry* entry) {
+	(void)entry;  /* 有効な機能によっては使われない */
+
+#ifdef FILETRACK_ENABLE_IO_STATS
+#ifdef DEBUG
+	if (!entry->is_closed)
+#endif
+		io_collect(entry->stream, entry, false);
+
+	printf("Bytes Read: %llu (%llu calls)   Bytes Written: %llu (%llu calls)   Flush: %llu   Seek: %llu\n", (unsigned long long)entry->io.bytes_read, (unsigned long long)entry->io.read_calls, (unsigned long long)entry->io.bytes_written, (unsigned long long)entry->io.write_calls, (unsigned long long)entry->io.flush_calls, (unsigned long long)entry->io.seek_calls);
+#endif
+
+#ifdef FILETRACK_ENABLE_LIFETIME_STATS
+	entry_lifetime_report(entry);
+#endif
+
+#ifdef FT_MEMSTREAM_SUPPORTED
+	memstream_report(entry);
+#endif
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+#ifdef DEBUG
+	if (!entry->is_closed && entry->fd >= 0)
+#else
+	if (entry->fd >= 0)
+#endif
+		printf("Descriptor: %d\n", entry->fd);
+#endif
+
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	FileTrackCookie* cookie = cookie_find(entry->stream);
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+	if (cookie != NULL && cookie->path != NULL) {
+		if (cookie->real == NULL)
+			printf("Virtual Handle: parked at offset %lld\n", (long long)cookie->offset);
+		else
+			printf("Virtual Handle: open\n");
+	}
+#endif
+	if (cookie != NULL)
+		printf("Syscall Bytes Read: %llu (%llu calls)   Syscall Bytes Written: %llu (%llu calls)   Syscall Seek: %llu\n", (unsigned long long)cookie->io.bytes_read, (unsigned long long)cookie->io.read_calls, (unsigned long long)cookie->io.bytes_written, (unsigned long long)cookie->io.write_calls, (unsigned long long)cookie->io.seek_calls);
+#endif
+
+#ifdef FILETRACK_ENABLE_BACKTRACE
+	FileTrackStack* stack = backtrace_stack_get(entry->stack_id);
+	if (stack != NULL) {
+		printf("Backtrace: #%lu\n", (unsigned long)stack->id);
+		backtrace_print(stack);
+	}
+#endif
+}
+
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+/*
+ * ストリームのものを除いた記述子を出力する (ストリームの記述子はストリームと一緒に出力される)
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void fd_all_print (void) {
+	for (size_t i = 0; i < fd_entries_cnt; i++) {
+		const FileTrackFdEntry* entry = &fd_entries[i];
+		if (entry->type == FT_FD_NONE || entry->type == FT_FD_STREAM) continue;
+
+		const char* open_file = (entry->open_site != NULL) ? entry->open_site->file : "unknown";
+		int open_line = (entry->open_site != NULL) ? entry->open_site->line : 0;
+#ifdef DEBUG
+		printf("\nDescriptor: %zu   Type: %s\nFile Name: %s\nopen File: %s   Line: %d\n", i, FileTrackFdTypeNames[entry->type], (entry->path != NULL) ? entry->path : "unknown", open_file, open_line);
+#else
+		printf("\nDescriptor: %zu   Type: %s\nopen File: %s   Line: %d\n", i, FileTrackFdTypeNames[entry->type], open_file, open_line);
+#endif
+	}
+}
+#endif
+
+
+void filetrack_all_check (void) {
+	filetrack_lock();
+
+	size_t filetrack_entries_arr_cnt;
+	FileTrackEntry** filetrack_entries_arr = (FileTrackEntry**)mht_all_get(filetrack_entries, &filetrack_entries_arr_cnt);
+	if (UNLIKELY(filetrack_entries_arr == NULL)) {
+		fprintf(stderr, "Failed to get all entries from file tracking.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+		filetrack_errfunc = "filetrack_all_check";
+
+	} else {
+		printf("\n");
+		for (size_t i = 0; i < filetrack_entries_arr_cnt; i++) {
+			if (UNLIKELY(filetrack_entries_arr[i] == NULL)) {
+				fprintf(stderr, "Entry is NULL!\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+				errno = EPROTO;
+				filetrack_errfunc = "filetrack_all_check";
+			} else if (UNLIKELY(filetrack_entries_arr[i]->stream == NULL)) {
+				fprintf(stderr, "Entry stream is NULL!\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+				errno = EPROTO;
+				filetrack_errfunc = "filetrack_all_check";
+			} else {
+				entry_print(filetrack_entries_arr[i]);
+				entry_report(filetrack_entries_arr[i]);
+			}
+		}
+		if (!mht_all_release_arr(filetrack_entries_arr))
+			filetrack_errfunc = "filetrack_all_check";
+
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+		for (FileTrackCookie* cookie = cookies; cookie != NULL; cookie = cookie->next) {
+			entry_print(&cookie->entry);
+			entry_report(&cookie->entry);
+		}
+#endif
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+		fd_all_print();
+#endif
+
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+		dir_all_print();
+#endif
+
+		printf("\n\n");
+	}
+
+	filetrack_unlock();
+}
+
+
+/*
+ * 開いているストリームの分を呼び出し元に加える
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void entry_collect_live (FileTrackEntry* entry) {
+	(void)entry;  /* 有効な機能によっては使われない */
+
+#ifdef FILETRACK_ENABLE_IO_STATS
+	io_collect(entry->stream, entry, false);
+	io_stats_add(&entry->open_site->io_live, &entry->io);
+#endif
+
+#ifdef FILETRACK_ENABLE_LIFETIME_STATS
+	if (entry->open_ns < entry->open_site->oldest_open_ns)
+		entry->open_site->oldest_open_ns = entry->open_ns;
+#endif
+}
+
+
+/*
+ * 開いているストリームの分を呼び出し元ごとに集計し直す
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void sites_collect_live (void) {
+#if defined (FILETRACK_ENABLE_IO_STATS) || defined (FILETRACK_ENABLE_COOKIE_ENGINE) || defined (FILETRACK_ENABLE_LIFETIME_STATS)
+	for (FileTrackSite* site = filetrack_sites_list; site != NULL; site = site->next) {
+#ifdef FILETRACK_ENABLE_IO_STATS
+		memset(&site->io_live, 0, sizeof(FileTrackIoStats));
+#endif
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+		memset(&site->sys_io_live, 0, sizeof(FileTrackIoStats));
+#endif
+#ifdef FILETRACK_ENABLE_LIFETIME_STATS
+		site->oldest_open_ns = UINT64_MAX;
+#endif
+	}
+#endif
+
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	for (FileTrackCookie* cookie = cookies; cookie != NULL; cookie = cookie->next) {
+		if (UNLIKELY(cookie->entry.open_site == NULL)) continue;
+
+		io_stats_add(&cookie->entry.open_site->sys_io_live, &cookie->io);
+		entry_collect_live(&cookie->entry);
+	}
+#endif
+
+	if (filetrack_entries == NULL) return;
+
+	size_t filetrack_entries_arr_cnt;
+	FileTrackEntry** filetrack_entries_arr = (FileTrackEntry**)mht_all_get(filetrack_entries, &filetrack_entries_arr_cnt);
+	if (UNLIKELY(filetrack_entries_arr == NULL)) {
+		fprintf(stderr, "Failed to get all entries from file tracking.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+		filetrack_errfunc = "filetrack_site_report";
+		return;
+	}
+
+	for (size_t i = 0; i < filetrack_entries_arr_cnt; i++) {
+		FileTrackEntry* entry = filetrack_entries_arr[i];
+		if (UNLIKELY(entry == NULL || entry->open_site == NULL)) continue;
+#ifdef DEBUG
+		if (entry->is_closed) continue;
+#endif
+
+		entry_collect_live(entry);
+	}
+
+	if (!mht_all_release_arr(filetrack_entries_arr))
+		filetrack_errfunc = "filetrack_site_report";
+}
+
+
+/*
+ * 呼び出し元で開かれたストリームの入出力を出力する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void site_io_report (const FileTrackSite* site) {
+	(void)site;  /* 有効な機能によっては使われない */
+
+#ifdef FILETRACK_ENABLE_IO_STATS
+	FileTrackIoStats io = site->io;
+	io_stats_add(&io, &site->io_live);
+
+	printf("Bytes Read: %llu (%llu calls)   Bytes Written: %llu (%llu calls)   Flush: %llu   Seek: %llu\n", (unsigned long long)io.bytes_read, (unsigned long long)io.read_calls, (unsigned long long)io.bytes_written, (unsigned long long)io.write_calls, (unsigned long long)io.flush_calls, (unsigned long long)io.seek_calls);
+#endif
+
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	FileTrackIoStats sys_io = site->sys_io;
+	io_stats_add(&sys_io, &site->sys_io_live);
+
+	printf("Syscall Bytes Read: %llu (%llu calls)   Syscall Bytes Written: %llu (%llu calls)   Syscall Seek: %llu\n", (unsigned long long)sys_io.bytes_read, (unsigned long long)sys_io.read_calls, (unsigned long long)sys_io.bytes_written, (unsigned long long)sys_io.write_calls, (unsigned long long)sys_io.seek_calls);
+#endif
+
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+	if (site->virtual_park_cnt > 0)
+		printf("Virtual Handles Parked: %llu   Reopened: %llu\n", (unsigned long long)site->virtual_park_cnt, (unsigned long long)site->virtual_reopen_cnt);
+#endif
+}
+
+
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+/* 閉じられたストリームの書き込みの分布と、write を減らせる場合はその方法を出力する */
+static void write_advice_report (const FileTrackSite* site) {
+	const FileTrackWriteProfile* profile = site->write_profile;
+	if (profile == NULL) return;
+
+	printf("Write Sizes p50: %llu bytes   p90: %llu bytes   Flush Intervals p50: %llu bytes   p90: %llu bytes   (%llu closed streams)\n", (unsigned long long)size_percentile(profile->write_sizes, 500), (unsigned long long)size_percentile(profile->write_sizes, 900), (unsigned long long)size_percentile(profile->flush_sizes, 500), (unsigned long long)size_percentile(profile->flush_sizes, 900), (unsigned long long)site->write_closed_cnt);
+
+	FileTrackWriteAdvice advice;
+	if (!advisor_evaluate(site, &advice)) return;
+
+	if (advice.buffer_size > advice.current_size && advisor_worth(advice.current_calls, advice.buffer_calls)) {
+		printf("Advice: a %llu byte buffer (setvbuf) would cut write calls from about %llu to %llu", (unsigned long long)advice.buffer_size, (unsigned long long)advice.current_calls, (unsigned long long)advice.buffer_calls);
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+		if (site->buffer_autotune_cnt > 0) printf(" (applied to later opens)");
+#endif
+		printf("\n");
+	}
+
+	if (advice.explicit_flushes >= FT_WRITE_ADVISOR_MIN_SAVED && advisor_worth(advice.buffer_calls, advice.noflush_calls))
+		printf("Advice: fflush writes out about %llu bytes at a time; flushing less often would cut write calls from about %llu to %llu\n", (unsigned long long)advice.flush_interval, (unsigned long long)advice.buffer_calls, (unsigned long long)advice.noflush_calls);
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_FADVISE
+static const char* FileTrackAccessPatternNames[] = {
+	"mixed",
+	"sequential",
+	"random",
+	"write-once"
+};
+
+
+/* 学習した使われ方と、それに基づいて与えたヒントの回数を出力する */
+static void fadvise_report (const FileTrackSite* site) {
+	if (site->pattern_observed_cnt == 0) return;
+
+	const char* pattern = (site->pattern_observed_cnt < FT_FADVISE_LEARN_MIN) ? "learning" : FileTrackAccessPatternNames[fadvise_site_pattern(site)];
+	printf("Access Pattern: %s   Sequential: %llu (%llu mostly read)   Random: %llu   Write-Once: %llu   Hints Applied: %llu\n", pattern, (unsigned long long)site->pattern_seq_cnt, (unsigned long long)site->pattern_full_read_cnt, (unsigned long long)site->pattern_random_cnt, (unsigned long long)site->pattern_write_once_cnt, (unsigned long long)site->fadvise_hint_cnt);
+}
+#endif
+
+
+#ifdef FILETRACK_ENABLE_BACKTRACE
+/*
+ * 呼び出し元で開かれたまま閉じられていないストリームを、開いた時の呼び出し履歴ごとに出力する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void backtrace_site_report (const FileTrackSite* site) {
+	if (site->live_cnt == 0) return;
+
+	for (size_t i = 0; i < backtrace_stacks_cnt; i++) {
+		FileTrackStack* stack = backtrace_stacks[i];
+		if (stack->site != site || stack->live_cnt == 0) continue;
+
+		printf("Backtrace: #%lu   Opened: %llu   Still Open: %llu\n", (unsigned long)stack->id, (unsigned long long)stack->open_cnt, (unsigned long long)stack->live_cnt);
+		backtrace_print(stack);
+	}
+}
+#endif
+
+
+/*
+ * 呼び出し元ごとの追加情報を出力する
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ */
+static void site_report (const FileTrackSite* site) {
+	(void)site;  /* 有効な機能によっては使われない */
+
+	if (site->open_cnt > 0)
+		site_io_report(site);
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+	if (site->sample_open_est > site->open_cnt) {  /* 間引いた分を重みで補った推定 */
+		printf("Estimated Opened: %llu   Estimated Still Open: %llu", (unsigned long long)site->sample_open_est, (unsigned long long)site->sample_live_est);
+		if (site->sample_seen_cnt > 0) printf("   Opened Exactly: %llu", (unsigned long long)site->sample_seen_cnt);
+		printf("\n");
+	}
+#endif
+
+#ifdef FT_POPEN_SUPPORTED
+	if (site->child_closed_cnt > 0) {
+		uint64_t avg_us = site->child_wall_ns / site->child_closed_cnt / 1000u;
+		printf("Child Processes: %llu   Reaped: %llu   Wall Time Avg: %llu us   Max: %llu us\n", (unsigned long long)site->child_cnt, (unsigned long long)site->child_closed_cnt, (unsigned long long)avg_us, (unsigned long long)(site->child_wall_max_ns / 1000u));
+	} else if (site->child_cnt > 0) {
+		printf("Child Processes: %llu   Reaped: 0\n", (unsigned long long)site->child_cnt);
+	}
+#endif
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	if (site->fd_open_cnt > 0)
+		printf("Descriptors Opened: %llu   Still Open: %llu\n", (unsigned long long)site->fd_open_cnt, (unsigned long long)site->fd_live_cnt);
+#endif
+
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+	if (site->dir_open_cnt > 0) {
+		printf("Directories Opened: %llu   Still Open: %llu\n", (unsigned long long)site->dir_open_cnt, (unsigned long long)site->dir_live_cnt);
+#ifdef FILETRACK_ENABLE_READDIR_STATS
+		printf("Entries Read: %llu   Largest Closed Walk: %llu\n", (unsigned long long)(site->dir_read_cnt + site->dir_read_live_cnt), (unsigned long long)site->dir_read_max);
+#endif
+	}
+#endif
+
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+	for (size_t i = 0; i < FT_LATENCY_OP_COUNT; i++) {
+		const FileTrackHist* hist = site->latency[i];
+		if (hist == NULL || hist->count == 0) continue;
+
+		printf("%s Latency: %llu calls   p50: %llu ns   p99: %llu ns   Max: %llu ns\n", FileTrackLatencyOpNames[i], (unsigned long long)hist->count, (unsigned long long)hist_percentile(hist, 500), (unsigned long long)hist_percentile(hist, 990), (unsigned long long)hist->max);
+	}
 #endif
-	} else {                 /* 閉じて開き直す場合 */
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		int tmp_errno = errno;
+
+#ifdef FILETRACK_ENABLE_STREAM_CACHE
+	if (site->cache_hit_cnt > 0 || site->cache_miss_cnt > 0)
+		printf("Cache Hits: %llu   Misses: %llu\n", (unsigned long long)site->cache_hit_cnt, (unsigned long long)site->cache_miss_cnt);
 #endif
-		errno = 0;
 
-		filetrack_entry_close(stream, FILE_CLOSED_FREOPEN, file, line);
+#ifdef FILETRACK_ENABLE_MEMFD_TMPFILE
+	uint64_t memfd_cnt = 0;
+	uint64_t memfd_bytes = memfd_ram_bytes(site, &memfd_cnt);
+	if (memfd_cnt > 0)
+		printf("Memfd Tmpfiles Open: %llu   RAM: %llu bytes\n", (unsigned long long)memfd_cnt, (unsigned long long)memfd_bytes);
+#endif
 
-		if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_freopen";
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		else errno = tmp_errno;
+#ifdef FILETRACK_ENABLE_NEGATIVE_CACHE
+	if (site->negative_hit_cnt > 0)
+		printf("Negative Cache Hits: %llu\n", (unsigned long long)site->negative_hit_cnt);
+#endif
 
-		tmp_errno = errno;
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+	write_advice_report(site);
 #endif
-		errno = 0;
 
-		filetrack_entry_add(new_stream, FILE_OPEN_FREOPEN, filename, mode, filename_len_max, file, line);
+#ifdef FILETRACK_ENABLE_FADVISE
+	fadvise_report(site);
+#endif
 
-		if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_freopen";
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		else errno = tmp_errno;
+#ifdef FILETRACK_ENABLE_PREFETCH
+	if (site->prefetch_cnt > 0)
+		printf("Prefetched Opens: %llu   Prefetched: %llu bytes   Read: %llu bytes   Hit Ratio: %.1f%%\n", (unsigned long long)site->prefetch_cnt, (unsigned long long)site->prefetch_bytes, (unsigned long long)site->prefetch_used_bytes, (site->prefetch_bytes > 0) ? (double)site->prefetch_used_bytes * 100 / (double)site->prefetch_bytes : (double)0);
 #endif
-	}
-	return new_stream;
-}
 
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	if (site->buffer_hit_cnt > 0 || site->buffer_miss_cnt > 0)
+		printf("Buffer: %zu bytes   Pool Hits: %llu   Misses: %llu\n", site->buffer_size_set ? site->buffer_size : buffer_default_size, (unsigned long long)site->buffer_hit_cnt, (unsigned long long)site->buffer_miss_cnt);
+#endif
 
-FILE* filetrack_freopen (const char* filename, const char* mode, FILE* stream, size_t filename_len_max, const char* file, int line) {
-	filetrack_lock();
-	FILE* new_stream = filetrack_freopen_without_lock(filename, mode, stream, filename_len_max, file, line);
-	filetrack_unlock();
-	return new_stream;
-}
+#ifdef FILETRACK_ENABLE_ASYNC_CLOSE
+	const FileTrackHist* async_close = site->async_close;
+	if (async_close != NULL && async_close->count > 0)
+		printf("Async Close: %llu calls   p50: %llu ns   p99: %llu ns   Max: %llu ns   Failures: %llu\n", (unsigned long long)async_close->count, (unsigned long long)hist_percentile(async_close, 500), (unsigned long long)hist_percentile(async_close, 990), (unsigned long long)async_close->max, (unsigned long long)site->async_close_fail_cnt);
+#endif
 
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+	const FileTrackHist* wait = site->admission_wait;
+	if (wait != NULL && wait->count > 0)
+		printf("Admission Wait: %llu calls   p50: %llu ns   p99: %llu ns   Max: %llu ns   Timeouts: %llu\n", (unsigned long long)wait->count, (unsigned long long)hist_percentile(wait, 500), (unsigned long long)hist_percentile(wait, 990), (unsigned long long)wait->max, (unsigned long long)site->admission_timeout_cnt);
+#endif
 
-static int filetrack_fclose_without_lock (FILE* stream, const char* file, int line) {
-	if (stream == NULL) {
-		fprintf(stderr, "No processing was done because the stream is NULL!\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_fclose";
-		return EOF;
+#ifdef FILETRACK_ENABLE_LIFETIME_STATS
+	const FileTrackHist* lifetime = site->lifetime;
+	if (lifetime != NULL && lifetime->count > 0) {
+		uint64_t p50 = hist_percentile(lifetime, 500);
+		uint64_t p99 = hist_percentile(lifetime, 990);
+		printf("Lifetime: %llu closed   p50: " FT_DURATION_FMT "   p99: " FT_DURATION_FMT "   Max: " FT_DURATION_FMT "\n", (unsigned long long)lifetime->count, FT_DURATION_ARGS(p50), FT_DURATION_ARGS(p99), FT_DURATION_ARGS(lifetime->max));
 	}
 
-	if (stream == stdin) {
-		fprintf(stderr, "Cannot close stdin stream! Because it is a standard input stream.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_fclose";
-		return EOF;
-	} else if (stream == stdout) {
-		fprintf(stderr, "Cannot close stdout stream! Because it is a standard output stream.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_fclose";
-		return EOF;
-	} else if (stream == stderr) {
-		fprintf(stderr, "Cannot close stderr stream! Because it is a standard error stream.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_fclose";
-		return EOF;
+	if (site->live_cnt > 0 && site->oldest_open_ns != UINT64_MAX) {
+		uint64_t oldest = lifetime_us(site->oldest_open_ns, coarse_clock_ns());
+		printf("Oldest Open: " FT_DURATION_FMT "\n", FT_DURATION_ARGS(oldest));
 	}
+#endif
 
-	int return_value = 0;
-
-#ifdef DEBUG
-	if (UNLIKELY(filetrack_entries == NULL)) {
-		init();
+#ifdef FILETRACK_ENABLE_BACKTRACE
+	backtrace_site_report(site);
+#endif
+}
 
-		fprintf(stderr, "No entry found to close! The file might not be tracked.\nFile: %s   Line: %d\n", file, line);
-		errno = EPERM;
-		filetrack_errfunc = "filetrack_fclose";
 
-		return_value = fclose(stream);
-		if (return_value != 0) {
-			fprintf(stderr, "Failed to close file stream!\nFile: %s   Line: %d\n", file, line);
-			filetrack_errfunc = "filetrack_fclose";
-		}
+/* ストリーム以外のものを開いた呼び出し元なら true を返す */
+static bool site_has_other_handles (const FileTrackSite* site) {
+	(void)site;  /* 有効な機能によっては使われない */
 
-		return return_value;
-	}
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	if (site->fd_open_cnt > 0) return true;
+#endif
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+	if (site->dir_open_cnt > 0) return true;
+#endif
+	return false;
+}
 
-	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)stream);
-	if (entry == NULL) {
-		fprintf(stderr, "No entry found to close! The file might not be tracked.\nFile: %s   Line: %d\n", file, line);
-		filetrack_errfunc = "filetrack_fclose";
 
-		return_value = fclose(stream);
-		if (return_value != 0) {
-			fprintf(stderr, "Failed to close file stream!\nFile: %s   Line: %d\n", file, line);
-			filetrack_errfunc = "filetrack_fclose";
-		}
+/* ストリームを開いていない呼び出し元も、報告する内容があれば true を返す */
+static bool site_has_report (const FileTrackSite* site) {
+	if (site->open_cnt > 0) return true;
 
-		return return_value;
-	}
+	if (site_has_other_handles(site)) return true;
 
-	if (entry->is_closed) {
-		fprintf(stderr, "File already closed!\nreclose File: %s   Line: %d\nclose File: %s   Line: %d\n", file, line, entry->close_file, entry->close_line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_fclose";
-		return EOF;
-	}
+#ifdef FILETRACK_ENABLE_NEGATIVE_CACHE
+	if (site->negative_hit_cnt > 0) return true;
 #endif
 
-	return_value = fclose(stream);
-	if (return_value != 0) {
-		fprintf(stderr, "Failed to close file stream!\nFile: %s   Line: %d\n", file, line);
-		filetrack_errfunc = "filetrack_fclose";
-	}
-
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-	int tmp_errno = errno;
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+	if (site->admission_wait != NULL && site->admission_wait->count > 0) return true;
 #endif
-	errno = 0;
-
-	filetrack_entry_close(stream, FILE_CLOSED_FCLOSE, file, line);
 
-	if (UNLIKELY(errno != 0)) filetrack_errfunc = "filetrack_fclose";
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-	else errno = tmp_errno;
+#ifdef FILETRACK_ENABLE_ASYNC_CLOSE
+	if (site->async_close != NULL && site->async_close->count > 0) return true;
 #endif
 
-	return return_value;
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+	for (size_t i = 0; i < FT_LATENCY_OP_COUNT; i++) {
+		if (site->latency[i] != NULL && site->latency[i]->count > 0) return true;
+	}
+#endif
+	return false;
 }
 
 
-int filetrack_fclose (FILE* stream, const char* file, int line) {
+void filetrack_site_report (void) {
 	filetrack_lock();
-	int return_value = filetrack_fclose_without_lock(stream, file, line);
-	filetrack_unlock();
-	return return_value;
-}
 
+	sites_collect_live();
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+	dirs_collect_live();
+#endif
 
-#ifdef DEBUG
-static bool can_be_removed_check (const char* filename, size_t filename_len_max, const char* file, int line) {
-	size_t filename_len = mutils_strnlen(filename, filename_len_max);
-	if (UNLIKELY(filename_len == 0)) {  /* ファイル名の長さの取得に失敗した場合 */
-		fprintf(stderr, "Failed to retrieve the filename length.\nFile: %s   Line: %d\n", file, line);
-		filetrack_errfunc = "filetrack_remove";
-		return true;  /* エラーではあるが続行 */
+	printf("\n");
+	if (stream_peak_cnt > 0)
+		printf("\nStreams Open: %llu   Peak: %llu   Interval Peak: %llu\n", (unsigned long long)stream_live_cnt, (unsigned long long)stream_peak_cnt, (unsigned long long)stream_interval_peak_cnt);
+#ifdef FILETRACK_ENABLE_SAMPLING
+	if (sampling_stats.skipped > 0)  /* 上の数は標本に選ばれたストリームのみ */
+		printf("Sampling: 1 in %lu%s   Sampled Opens: %llu   Skipped: %llu   Estimated Open: %llu\n", (unsigned long)sampling_period, sampling_adaptive ? " (adaptive)" : "", (unsigned long long)sampling_stats.sampled, (unsigned long long)sampling_stats.skipped, (unsigned long long)sampling_stats.live_estimate);
+#endif
+#ifdef FILETRACK_ENABLE_MEMFD_TMPFILE
+	if (memfd_created_cnt > 0 || memfd_fallback_cnt > 0)
+		printf("\nMemfd Tmpfiles Open: %zu   RAM: %llu bytes   Cap: %llu bytes   Created: %llu   Disk Fallbacks: %llu\n", memfds_cnt, (unsigned long long)memfd_ram_bytes(NULL, NULL), (unsigned long long)memfd_ram_max, (unsigned long long)memfd_created_cnt, (unsigned long long)memfd_fallback_cnt);
+#endif
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	if (buffer_pool_stats.hits > 0 || buffer_pool_stats.misses > 0)
+		printf("\nBuffer Pool Hits: %llu   Misses: %llu   Hit Rate: %.1f%%   Pooled: %zu bytes   Huge Page Backed: %zu bytes\n", (unsigned long long)buffer_pool_stats.hits, (unsigned long long)buffer_pool_stats.misses, (double)buffer_pool_stats.hits * 100 / (double)(buffer_pool_stats.hits + buffer_pool_stats.misses), buffer_pool_stats.pooled_bytes, buffer_pool_stats.hugepage_bytes);
+#endif
+#ifdef FILETRACK_ENABLE_FADVISE
+	if (fadvise_stats.sequential_hints > 0 || fadvise_stats.random_hints > 0 || fadvise_stats.noreuse_hints > 0 || fadvise_stats.dontneed_calls > 0)
+		printf("\nFadvise Hints Sequential: %llu   Random: %llu   Noreuse: %llu   Readahead: %llu bytes\nDontneed on Close: %llu (%llu bytes)   Pages Dropped: %llu\n", (unsigned long long)fadvise_stats.sequential_hints, (unsigned long long)fadvise_stats.random_hints, (unsigned long long)fadvise_stats.noreuse_hints, (unsigned long long)fadvise_stats.readahead_bytes, (unsigned long long)fadvise_stats.dontneed_calls, (unsigned long long)fadvise_stats.dontneed_bytes, (unsigned long long)fadvise_stats.pages_dropped);
+#endif
+#ifdef FILETRACK_ENABLE_PREFETCH
+	if (prefetch_stats.files > 0)
+		printf("\nPrefetched Opens: %llu   Prefetched: %llu bytes   Read: %llu bytes   Hit Ratio: %.1f%%   Cancelled: %llu   Overtaken: %llu\n", (unsigned long long)prefetch_stats.files, (unsigned long long)prefetch_stats.bytes, (unsigned long long)prefetch_stats.used_bytes, (prefetch_stats.bytes > 0) ? (double)prefetch_stats.used_bytes * 100 / (double)prefetch_stats.bytes : (double)0, (unsigned long long)prefetch_stats.cancelled, (unsigned long long)prefetch_stats.overtaken);
+#endif
+#ifdef FILETRACK_ENABLE_BACKTRACE
+	if (backtrace_stats.captured > 0)
+		printf("\nBacktraces Captured: %llu   Unique: %llu   Table: %llu bytes\n", (unsigned long long)backtrace_stats.captured, (unsigned long long)backtrace_stats.unique, (unsigned long long)backtrace_stats.bytes);
+#endif
+#ifdef FILETRACK_ENABLE_GROUP_COMMIT
+	if (durable_batches_cnt > 0)
+		printf("\nDurable Closes: %llu   Batches: %llu   Sync Calls: %llu   Largest Batch: %llu\nBatch Latency p50: %llu ns   p99: %llu ns   Max: %llu ns\n", (unsigned long long)durable_files_cnt, (unsigned long long)durable_batches_cnt, (unsigned long long)durable_sync_cnt, (unsigned long long)durable_largest_batch, (unsigned long long)hist_percentile(&durable_hist, 500), (unsigned long long)hist_percentile(&durable_hist, 990), (unsigned long long)durable_hist.max);
+#endif
+#ifdef FT_POPEN_SUPPORTED
+	if (popen_peak_cnt > 0)
+		printf("\nChild Pipes Open: %llu   Peak: %llu\n", (unsigned long long)popen_live_cnt, (unsigned long long)popen_peak_cnt);
+#endif
+	for (FileTrackSite* site = filetrack_sites_list; site != NULL; site = site->next) {
+		if (!site_has_report(site)) continue;
+
+		if (site->open_cnt > 0)
+			printf("\nopen File: %s   Line: %d\nOpened: %llu   Still Open: %llu\n", site->file, site->line, (unsigned long long)site->open_cnt, (unsigned long long)site->live_cnt);
+		else if (site_has_other_handles(site))
+			printf("\nopen File: %s   Line: %d\n", site->file, site->line);
+		else  /* 何も開いていない呼び出し元 */
+			printf("\nFile: %s   Line: %d\n", site->file, site->line);
+		site_report(site);
 	}
+	printf("\n\n");
 
-	str_keyt filename_key = {
-		.ptr = filename,
-		.len = filename_len
-	};
+	filetrack_unlock();
+}
 
-	FilenameStreamEntry* filename_stream_entry = mht_str_get(filename_stream_entries, filename_key);
-	if (filename_stream_entry == NULL) return true;  /* 同じファイル名が記録されていない場合 */
 
-	FileTrackEntry* entry = mht_uint_get(filetrack_entries, (uint_keyt)filename_stream_entry->stream);
-	if (UNLIKELY(entry == NULL)) {  /* 構造が破損してエントリが見つからない場合 */
-		fprintf(stderr, "The filename_stream_entry corresponding to file '%s' exists, but no corresponding entry is found.\nFile: %s   Line: %d\n", filename, file, line);
-		errno = EPROTO;
-		filetrack_errfunc = "filetrack_remove";
-		return true;  /* エラーではあるが続行 */
+bool filetrack_watermark (FileTrackWatermark* watermark, bool reset_interval) {
+	if (watermark == NULL) {
+		errno = EINVAL;
+		filetrack_errfunc = "filetrack_watermark";
+		return false;
 	}
 
-	if (entry->is_closed) return true;  /* 過去に開かれていたが既にクローズされている場合 */
+	filetrack_lock();
 
-	/* 削除しようとしたファイルがまだオープンされている場合 */
-	fprintf(stderr, "File '%s' is still open and cannot be removed.\nFile: %s   Line: %d\n", filename, file, line);
-	errno = EINVAL;
-	filetrack_errfunc = "filetrack_remove";
-	return false;
+	*watermark = (FileTrackWatermark){
+		.open_cnt = stream_live_cnt,
+		.peak_cnt = stream_peak_cnt,
+		.interval_peak_cnt = stream_interval_peak_cnt
+	};
+
+	if (reset_interval)
+		stream_interval_peak_cnt = stream_live_cnt;
+
+	filetrack_unlock();
+	return true;
 }
 
 
-int filetrack_remove (const char* filename, size_t filename_len_max, const char* file, int line) {
-	if (filename == NULL) {
-		fprintf(stderr, "No processing was done because the filename is NULL!\nFile: %s   Line: %d\n", file, line);
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+bool filetrack_latency (const char* file, int line, FileTrackLatencyOp op, FileTrackLatency* latency) {
+	if (file == NULL || latency == NULL || (unsigned int)op >= FT_LATENCY_OP_COUNT) {
 		errno = EINVAL;
-		filetrack_errfunc = "filetrack_remove";
-		return 1;
+		filetrack_errfunc = "filetrack_latency";
+		return false;
 	}
 
-	if (filename[0] == '\0') {
-		fprintf(stderr, "No processing was done because the filename is empty.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_remove";
-		return 1;
-	}
+	filetrack_lock();
 
-	if (filename_len_max < 1) {
-		fprintf(stderr, "filename_len_max must be at least 1.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		filetrack_errfunc = "filetrack_remove";
-		return 1;
-	}
+	FileTrackSite* site = NULL;
+	if (filetrack_sites != NULL)
+		site = site_find(mht_uint_get(filetrack_sites, site_hash(file, line)), file, line);
 
-	if (filename_stream_entries != NULL) {
-		if (!can_be_removed_check(filename, filename_len_max, file, line))
-			return 1;  /* 削除不可を確認した場合、エラーを返して終了 */
+	const FileTrackHist* hist = (site != NULL) ? site->latency[op] : NULL;
+	if (hist == NULL || hist->count == 0) {
+		filetrack_unlock();
+		errno = ENOENT;
+		filetrack_errfunc = "filetrack_latency";
+		return false;
 	}
 
-	int result = remove(filename);
-	if (result != 0)
-		filetrack_errfunc = "filetrack_remove";
-	return result;
+	latency->count = hist->count;
+	latency->p50_ns = hist_percentile(hist, 500);
+	latency->p99_ns = hist_percentile(hist, 990);
+	latency->max_ns = hist->max;
+
+	filetrack_unlock();
+	return true;
 }
 #endif
 
 
-void filetrack_all_check (void) {
-	size_t filetrack_entries_arr_cnt;
-	FileTrackEntry** filetrack_entries_arr = (FileTrackEntry**)mht_all_get(filetrack_entries, &filetrack_entries_arr_cnt);
-	if (UNLIKELY(filetrack_entries_arr == NULL)) {
-		fprintf(stderr, "Failed to get all entries from file tracking.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
-		filetrack_errfunc = "filetrack_all_check";
-
-	} else {
-		printf("\n");
-		for (size_t i = 0; i < filetrack_entries_arr_cnt; i++) {
-			if (UNLIKELY(filetrack_entries_arr[i] == NULL)) {
-				fprintf(stderr, "Entry is NULL!\nFile: %s   Line: %d\n", __FILE__, __LINE__);
-				errno = EPROTO;
-				filetrack_errfunc = "filetrack_all_check";
-			} else if (UNLIKELY(filetrack_entries_arr[i]->stream == NULL)) {
-				fprintf(stderr, "Entry stream is NULL!\nFile: %s   Line: %d\n", __FILE__, __LINE__);
-				errno = EPROTO;
-				filetrack_errfunc = "filetrack_all_check";
-			} else {
-#ifndef DEBUG
-				printf("\nAlready Closed: false   Stream: %p\nPlease use debug mode if you need more detailed information.\n", filetrack_entries_arr[i]->stream);
-#else
-				if (filetrack_entries_arr[i]->is_closed) {
-					if (filetrack_entries_arr[i]->last_change_mode_file != NULL)
-						printf("\nAlready Closed: true\nStream: %p   Mode: %s\nFile Name: %s\nclosed Type: %s\nclose File: %s   Line: %d\nopen Type: %s\nopen File: %s   Line: %d\nLast change mode File: %s   Line: %d\n", filetrack_entries_arr[i]->stream, filetrack_entries_arr[i]->mode, filetrack_entries_arr[i]->filename, FileClosedTypeNames[filetrack_entries_arr[i]->closed_type], filetrack_entries_arr[i]->close_file, filetrack_entries_arr[i]->close_line, FileOpenTypeNames[filetrack_entries_arr[i]->open_type], filetrack_entries_arr[i]->open_file, filetrack_entries_arr[i]->open_line, filetrack_entries_arr[i]->last_change_mode_file, filetrack_entries_arr[i]->last_change_mode_line);
-					else
-						printf("\nAlready Closed: true\nStream: %p   Mode: %s\nFile Name: %s\nclosed Type: %s\nclose File: %s   Line: %d\nopen Type: %s\nopen File: %s   Line: %d\n", filetrack_entries_arr[i]->stream, filetrack_entries_arr[i]->mode, filetrack_entries_arr[i]->filename, FileClosedTypeNames[filetrack_entries_arr[i]->closed_type], filetrack_entries_arr[i]->close_file, filetrack_entries_arr[i]->close_line, FileOpenTypeNames[filetrack_entries_arr[i]->open_type], filetrack_entries_arr[i]->open_file, filetrack_entries_arr[i]->open_line);
-				} else {
-					if (filetrack_entries_arr[i]->last_change_mode_file != NULL)
-						printf("\nAlready Closed: false\nStream: %p   Mode: %s\nFile Name: %s\nopen Type: %s\nopen File: %s   Line: %d\nLast change mode File: %s   Line: %d\n", filetrack_entries_arr[i]->stream, filetrack_entries_arr[i]->mode, filetrack_entries_arr[i]->filename, FileOpenTypeNames[filetrack_entries_arr[i]->open_type], filetrack_entries_arr[i]->open_file, filetrack_entries_arr[i]->open_line, filetrack_entries_arr[i]->last_change_mode_file, filetrack_entries_arr[i]->last_change_mode_line);
-					else
-						printf("\nAlready Closed: false\nStream: %p   Mode: %s\nFile Name: %s\nopen Type: %s\nopen File: %s   Line: %d\n", filetrack_entries_arr[i]->stream, filetrack_entries_arr[i]->mode, filetrack_entries_arr[i]->filename, FileOpenTypeNames[filetrack_entries_arr[i]->open_type], filetrack_entries_arr[i]->open_file, filetrack_entries_arr[i]->open_line);
-				}
+static void quit (void) {
+#ifdef FILETRACK_ENABLE_ASYNC_CLOSE
+	async_close_quit();  /* ワーカーがグローバルロックを使うので最初に止める */
 #endif
-			}
-		}
-		if (!mht_all_release_arr(filetrack_entries_arr))
-			filetrack_errfunc = "filetrack_all_check";
 
-		printf("\n\n");
+#ifdef FILETRACK_ENABLE_COOKIE_ENGINE
+	while (cookies != NULL) {
+		FileTrackCookie* cookie = cookies;
+#ifdef DEBUG
+		fprintf(stderr, "\nFile not closed!\nStream: %p   Mode: %s\nFile Name: %s\nopen Type: %s\nopen File: %s   Line: %d\n", cookie->entry.stream, cookie->entry.mode, cookie->entry.filename, FileOpenTypeNames[cookie->entry.open_type], cookie->entry.open_file, cookie->entry.open_line);
+		errno = EPERM;
+		filetrack_errfunc = "quit";
+#endif
+		if (filetrack_fclose_without_lock(cookie->entry.stream, __FILE__, __LINE__) != 0)
+			filetrack_errfunc = "quit";
+		if (UNLIKELY(cookies == cookie))  /* コールバックが呼ばれずに残った場合 */
+			cookie_unlink(cookie);
 	}
-}
 
+	if (cookie_table != NULL) {
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		int tmp_errno = errno;
+#endif
+		errno = 0;
+
+		mht_destroy(cookie_table);
+
+		if (UNLIKELY(errno != 0)) filetrack_errfunc = "quit";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		else errno = tmp_errno;
+#endif
+		cookie_table = NULL;
+	}
+#endif
 
-static void quit (void) {
 	size_t filetrack_entries_arr_cnt;
 	FileTrackEntry** filetrack_entries_arr;
 	for (size_t i = 0; i < FILETRACK_ENTRIES_TRIAL; i++) {
@@ -783,14 +8799,14 @@ static void quit (void) {
 #endif
 			} else {
 #ifndef DEBUG
-				if (filetrack_fclose_without_lock(filetrack_entries_arr[i]->stream, __FILE__, __LINE__) != 0)
+				if (stream_close_without_lock(filetrack_entries_arr[i]->stream, filetrack_entries_arr[i]->open_type) != 0)
 					filetrack_errfunc = "quit";
 #else
 				if (UNLIKELY(!filetrack_entries_arr[i]->is_closed)) {
-					fprintf(stderr, "\nFile not closed!\nStream: %p   Mode: %s\nFile Name: %s\nopen Type: %s\nopen File: %s   Line: %d\nLast change mode File: %s   Line: %d\n", filetrack_entries_arr[i]->stream, filetrack_entries_arr[i]->mode, filetrack_entries_arr[i]->filename, FileClosedTypeNames[filetrack_entries_arr[i]->open_type], filetrack_entries_arr[i]->open_file, filetrack_entries_arr[i]->open_line, filetrack_entries_arr[i]->last_change_mode_file, filetrack_entries_arr[i]->last_change_mode_line);
+					fprintf(stderr, "\nFile not closed!\nStream: %p   Mode: %s\nFile Name: %s\nopen Type: %s\nopen File: %s   Line: %d\nLast change mode File: %s   Line: %d\n", filetrack_entries_arr[i]->stream, filetrack_entries_arr[i]->mode, filetrack_entries_arr[i]->filename, FileOpenTypeNames[filetrack_entries_arr[i]->open_type], filetrack_entries_arr[i]->open_file, filetrack_entries_arr[i]->open_line, filetrack_entries_arr[i]->last_change_mode_file, filetrack_entries_arr[i]->last_change_mode_line);
 					errno = EPERM;
 
-					filetrack_fclose_without_lock(filetrack_entries_arr[i]->stream, __FILE__, __LINE__);
+					stream_close_without_lock(filetrack_entries_arr[i]->stream, filetrack_entries_arr[i]->open_type);
 
 					filetrack_errfunc = "quit";
 				}
@@ -833,6 +8849,56 @@ static void quit (void) {
 	}
 #endif
 
+#ifdef FILETRACK_ENABLE_PREFETCH
+	prefetch_quit();  /* 全てのストリームを閉じた後 */
+#endif
+
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+	dir_quit();  /* fdopendir で記述子の記録を引き継いでいるので先に閉じる */
+#endif
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	fd_quit();
+#endif
+
+#ifdef FILETRACK_ENABLE_STREAM_CACHE
+	stream_cache_quit();
+#endif
+
+#ifdef FILETRACK_ENABLE_NEGATIVE_CACHE
+	negative_quit();
+#endif
+
+#ifdef FILETRACK_ENABLE_TMPFILE_POOL
+	tmpfile_pool_stop();
+#endif
+
+#ifdef FILETRACK_ENABLE_MEMFD_TMPFILE
+	memfd_quit();
+#endif
+
+#ifdef FILETRACK_ENABLE_IO_URING
+	uring_quit();
+#endif
+
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+	buffer_pool_quit();  /* 開いていたストリームは全て閉じた後 */
+#endif
+
+#ifdef FILETRACK_ENABLE_BACKTRACE
+	backtrace_quit();
+#endif
+
+	sites_quit();
+
+#ifdef FILETRACK_ENABLE_IO_STATS
+	io_quit();
+#endif
+
+#ifdef FILETRACK_ENABLE_SHM_REGISTRY
+	shm_quit();
+#endif
+
 	global_lock_quit();
 }
 
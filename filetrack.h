@@ -49,6 +49,11 @@
  * functions by defining the FILETRACK_DISABLE_REPLACE_STANDARD_FUNC macro before
  * including this file.
  *
+ * On POSIX systems popen and pclose are replaced as well. A stream opened with popen
+ * must be closed with pclose; filetrack_fclose refuses it, because the child process
+ * would never be reaped. fdopen, fmemopen and open_memstream are replaced too, and the
+ * reports show how large the buffer of each open memstream was at its last fflush.
+ *
  *
  * Note:
  * This library uses a global lock to ensure thread safety. As a result, performance
@@ -58,6 +63,207 @@
  *
  * To enable debug mode, define DEBUG macro before including this file.
  *
+ * To mirror the registry into a shared-memory segment named "/filetrack.<pid>", define
+ * FILETRACK_ENABLE_SHM_REGISTRY when building this library (POSIX only). The
+ * filetrack-inspect tool (make inspect) attaches to it read-only and lists the open
+ * streams of a running process without stopping or signaling it. At most
+ * FT_SHM_RECORDS_MAX streams (1024 by default) are mirrored at a time. A child created
+ * with fork stops mirroring and leaves the registry of its parent in place.
+ *
+ * To count the bytes and calls that go through each stream, define
+ * FILETRACK_ENABLE_IO_STATS both when building this library and before including this
+ * file (POSIX only). fread, fwrite, fputs, fprintf, fgets, fflush and fseek are then
+ * also replaced by macros. The counters live in per-thread slots that are updated
+ * without taking the global lock and are merged when the stream is closed or reported.
+ *
+ * To count the reads, writes and seeks that actually reach the underlying file, define
+ * FILETRACK_ENABLE_COOKIE_ENGINE when building this library (glibc only). fopen and
+ * tmpfile then return a fopencookie stream wrapping the real one, which is unbuffered so
+ * that every callback is one system call. Such streams cannot be passed to freopen.
+ *
+ * Defining FILETRACK_ENABLE_VIRTUAL_HANDLES together with the cookie engine turns
+ * streams that fopen opens read-only into virtual handles. When descriptors run out, or
+ * more of them are open than filetrack_virtual_handles_set allows, the least recently
+ * used idle one has its underlying file closed. The file is reopened and repositioned
+ * on its next read, so the FILE* stays valid. The file must not be renamed or replaced
+ * while it is parked. If the path no longer leads to the same file when it is reopened,
+ * for example a relative path after chdir, the read fails with errno set to ESTALE.
+ *
+ * To reuse streams of files that are opened over and over, define
+ * FILETRACK_ENABLE_STREAM_CACHE both when building this library and before including
+ * this file (POSIX only), and open them with fopen_cached. When such a read-only stream
+ * is closed, it stays open in a cache of FT_STREAM_CACHE_MAX streams (16 by default).
+ * The next fopen_cached of the same filename and mode rewinds it instead of calling
+ * fopen; when none is cached, the file is opened the same way as with fopen. A cached
+ * stream is dropped if its file's inode, size or mtime has changed, or when the file is
+ * removed with remove, which is wrapped in release builds as well. Cached streams keep
+ * their descriptors open.
+ *
+ * To stop probing for files that do not exist, define FILETRACK_ENABLE_NEGATIVE_CACHE
+ * both when building this library and before including this file (POSIX only). When
+ * fopen fails with ENOENT, the filename is remembered for FT_NEGATIVE_CACHE_TTL_MS
+ * milliseconds (1000 by default, see filetrack_negative_cache_ttl_set), and fopen of it
+ * with a mode that does not create the file fails with ENOENT at once and without
+ * printing the diagnostic again. A tracked fopen or freopen with a "w" or "a" mode
+ * forgets the filename. Files created in any other way are noticed when the TTL expires.
+ *
+ * To take the creation of temporary files off the calling thread, define
+ * FILETRACK_ENABLE_TMPFILE_POOL both when building this library and before including
+ * this file (POSIX only), and start the pool with filetrack_tmpfile_pool_set. A
+ * background thread keeps that many unnamed files ready in TMPDIR (with O_TMPFILE where
+ * the file system supports it) and tmpfile hands them out, falling back to the real
+ * tmpfile when the pool is empty. If recycling is enabled, temporary files closed with
+ * fclose are truncated and put back into the pool instead of being destroyed.
+ *
+ * To keep small temporary files off the disk, define FILETRACK_ENABLE_MEMFD_TMPFILE both
+ * when building this library and before including this file (Linux only). tmpfile then
+ * creates the file with memfd_create while all open memfd temporary files together use
+ * less than FT_MEMFD_RAM_MAX bytes of memory (64 MiB by default, see
+ * filetrack_memfd_tmpfile_cap_set), and on the disk otherwise. The cap is checked when a
+ * file is created; a memfd file that grows afterwards stays in memory. Such streams are
+ * recorded with the filename "(memfd)", and the report shows the memory they use.
+ *
+ * To move the flush and close of streams off the calling thread, define
+ * FILETRACK_ENABLE_ASYNC_CLOSE both when building this library and before including
+ * this file (POSIX only), and close them with fclose_async. The stream is marked as
+ * closing and handed to one of FT_ASYNC_CLOSE_WORKERS background threads, which flushes
+ * it without holding the global lock and then closes it and updates the records. The
+ * stream must not be used after fclose_async. Failures are passed to the callback set
+ * with filetrack_fclose_async_callback_set and kept for filetrack_fclose_async_poll,
+ * and filetrack_fclose_async_drain waits until every queued stream has been closed.
+ *
+ * To open many files at once, define FILETRACK_ENABLE_IO_URING both when building this
+ * library and before including this file (Linux only), and use fopen_batch. The files
+ * are opened with IORING_OP_OPENAT in batches of FT_IO_URING_ENTRIES and wrapped with
+ * fdopen, and the records of a whole batch are updated under one lock. Where io_uring
+ * is not available, or for modes it cannot express, the files are opened one by one
+ * with fopen. fclose_batch closes streams under one lock, but each stream is still
+ * closed by fclose, since stdio cannot release a FILE without closing its descriptor.
+ * FILETRACK_ENABLE_IO_URING has no effect together with FILETRACK_ENABLE_ADMISSION_CONTROL,
+ * and building the library with both emits a warning: fopen_batch then opens files one by
+ * one so that each can wait for a slot, because reserving slots for a whole batch could
+ * wait forever when the batch is larger than the budget.
+ *
+ * To close streams durably, define FILETRACK_ENABLE_GROUP_COMMIT both when building this
+ * library and before including this file (POSIX only), and use fclose_durable. The
+ * stream is flushed and queued; the first waiting thread takes every queued stream,
+ * calls fsync on each of them and then closes them all under one lock, while the other
+ * threads wait for the result, so concurrent callers share one round of syncing. When
+ * a batch holds at least the number of files set with
+ * filetrack_fclose_durable_syncfs_min_set on one file system, a single syncfs is issued
+ * for them instead (Linux only; note that syncfs reports write errors only since Linux
+ * 5.8). The report shows the batch sizes and the latency of each batch. Streams that are
+ * not tracked, such as those skipped by sampling, are synced as well.
+ *
+ * To give streams opened with fopen a larger stdio buffer without a malloc per stream,
+ * define FILETRACK_ENABLE_BUFFER_POOL when building this library. Each new stream gets a
+ * buffer of FT_BUFFER_POOL_DEFAULT_SIZE bytes (64 KiB by default), or of the size set for
+ * its call site with filetrack_buffer_size_set, taken from a pool of power-of-two size
+ * classes and returned to it when the stream is closed. With cookie streams the buffer
+ * is given to the underlying file, since that decides the size of each read and write.
+ * On Linux, filetrack_buffer_pool_hugepages_set backs new buffers with memory aligned to
+ * 2 MiB and advised for transparent huge pages. The report shows the pool hit rate.
+ *
+ * To find streams that make too many small write calls, define
+ * FILETRACK_ENABLE_WRITE_ADVISOR together with FILETRACK_ENABLE_IO_STATS. The size of
+ * every fwrite, fputs and fprintf and the number of bytes written out by each fflush,
+ * fseek or close are kept per stream and added to the call site when the stream is
+ * closed. From these the report estimates the write calls of each site and points out
+ * where a larger setvbuf buffer or less frequent fflush would cut them (the stdio
+ * default is assumed to be BUFSIZ bytes). With FILETRACK_ENABLE_BUFFER_POOL,
+ * filetrack_write_advisor_autotune_set applies the suggested buffer size to streams
+ * that are opened later at the same site.
+ *
+ * To let the kernel cache files the way each call site uses them, define
+ * FILETRACK_ENABLE_FADVISE together with FILETRACK_ENABLE_IO_STATS (POSIX only; not on
+ * macOS, which lacks posix_fadvise). When a stream opened with fopen is closed, its
+ * reads, writes and fseek distances classify it as sequential, random or write-once,
+ * and the result is added to the call site. Once FT_FADVISE_LEARN_MIN streams (3 by
+ * default) have been closed there and three quarters of them agree, later opens at the
+ * site get POSIX_FADV_SEQUENTIAL, POSIX_FADV_RANDOM or POSIX_FADV_NOREUSE. On Linux a
+ * site whose files are usually read through also has up to FT_FADVISE_READAHEAD_MAX
+ * bytes (8 MiB by default) read ahead with readahead, which
+ * filetrack_fadvise_readahead_set turns off. Files that were only written are flushed
+ * and given POSIX_FADV_DONTNEED on close so that they do not push other data out of the
+ * page cache; pages still waiting for writeback stay cached until they are written. When
+ * built with headers that define __NR_cachestat (Linux 6.5 or later), the number of
+ * pages actually dropped is measured as well. The report shows the pattern learned for
+ * each site.
+ *
+ * To warm the page cache for files that are about to be read, define
+ * FILETRACK_ENABLE_PREFETCH when building this library (POSIX only). A stream opened
+ * read-only with fopen at a call site given a size with filetrack_prefetch_set, or, with
+ * FILETRACK_ENABLE_FADVISE, at a site learned to read its files through, has its first
+ * bytes read into the page cache by a background thread, in steps of 1 MiB (with
+ * readahead on Linux, and with pread elsewhere). The thread works on a duplicate of the
+ * descriptor, so fopen does not wait for it, and a stream closed before the prefetch is
+ * done cancels the rest. On close, the position of the stream shows how much of the
+ * prefetched data was read; the report gives this as the hit ratio, and counts the
+ * streams that read past the prefetcher before it finished.
+ *
+ * To keep tracking cheap enough for production, define FILETRACK_ENABLE_SAMPLING when
+ * building this library (not in debug mode). Only about one in FT_SAMPLING_PERIOD opens
+ * (64 by default, changed with filetrack_sampling_set) is then tracked, and each tracked
+ * stream stands for that many. In the default adaptive mode the period is chosen per
+ * call site: the first FT_SAMPLING_FULL_OPENS opens of a site (64 by default) are all
+ * tracked, and the period doubles as the site gets hotter until it reaches the maximum,
+ * so rare sites stay fully visible. The other streams are never added to the table; a
+ * small counting Bloom filter of the tracked streams lets fclose skip them without a
+ * lookup, so closing an untracked stream is no longer reported. The report extrapolates
+ * the open and still-open counts from the weights of the tracked streams, while the
+ * other statistics cover the tracked streams only. Untracked streams are not counted
+ * against the FILETRACK_ENABLE_ADMISSION_CONTROL budget.
+ *
+ * To tell apart the code paths that open files through a shared helper, define
+ * FILETRACK_ENABLE_BACKTRACE when building this library (glibc or macOS). Each tracked
+ * stream then records the return addresses of its callers, up to FT_BACKTRACE_DEPTH of
+ * them (16 by default, at most 64, changed with filetrack_backtrace_depth_set). With glibc
+ * on x86-64 and AArch64 they are found by following frame pointers, which is much cheaper
+ * than backtrace but needs the program to be built with -fno-omit-frame-pointer; callers
+ * built without it are skipped or end the walk. Elsewhere backtrace is used. The same
+ * stack seen again at the same call site is stored only once, and streams refer to it by
+ * number. Function names are looked up with backtrace_symbols only when a report first
+ * prints the stack: filetrack_all_check prints the stack of every stream, and
+ * filetrack_site_report the stacks of the streams still open at each site. Link the
+ * program with -rdynamic to get the names of functions in the executable.
+ *
+ * To time the underlying fopen, tmpfile, freopen, fclose, popen and pclose calls, define
+ * FILETRACK_ENABLE_LATENCY_STATS both when building this library and before including
+ * this file (POSIX only). The durations are kept in a log-linear histogram for each call
+ * site and for each operation; their percentiles are within 12.5% of the true value.
+ *
+ * To record when each stream was opened, had its mode changed and was closed, define
+ * FILETRACK_ENABLE_LIFETIME_STATS when building this library (POSIX only). The reports
+ * then show the age of every open stream and the distribution of lifetimes for each call
+ * site, and point out streams held longer than 99% of their siblings.
+ *
+ * To also track raw file descriptors, define FILETRACK_ENABLE_FD_TRACKING both when
+ * building this library and before including this file (POSIX only). open, openat,
+ * close, dup, dup2, pipe, socket and mkstemp are then replaced by macros as well, and
+ * <fcntl.h>, <unistd.h> and <sys/socket.h> are included by this header. The descriptors
+ * are kept in a table indexed by their number, which also records the descriptor of
+ * every tracked stream, so the reports show which descriptor each stream uses. A stream
+ * made by fdopen from a mkstemp descriptor is reported with the name of that file.
+ *
+ * To track directory streams, define FILETRACK_ENABLE_DIR_TRACKING both when building
+ * this library and before including this file (POSIX only). opendir, fdopendir and
+ * closedir are then replaced by macros. Defining FILETRACK_ENABLE_READDIR_STATS as well
+ * replaces readdir, which then takes the global lock to count the entries read from
+ * each directory stream.
+ *
+ * To queue fopen and tmpfile instead of letting them fail at the descriptor limit,
+ * define FILETRACK_ENABLE_ADMISSION_CONTROL both when building this library and before
+ * including this file (POSIX only), and set a budget with filetrack_admission_set. A
+ * thread that waits for a slot holds no lock of this library, but it will wait forever
+ * without a timeout if it is itself holding the streams that must be closed.
+ *
+ * The number of open streams and its peaks are always counted and can be read with
+ * filetrack_watermark. To be warned before running out of descriptors, define
+ * FILETRACK_ENABLE_NOFILE_ALARM both when building this library and before including
+ * this file (POSIX only), and register a callback with filetrack_nofile_alarm_set. The
+ * tracked streams, descriptors and directories are compared with the soft
+ * RLIMIT_NOFILE, which is read again whenever usage approaches a threshold.
+ *
  * This library depends on the mhashtable library.
  */
 
@@ -77,6 +283,24 @@ MUTILS_CPP_C_BEGIN
 
 
 #include <stdio.h>
+#include <stdint.h>
+
+#if defined (__unix__) || defined (__linux__) || defined (__APPLE__)
+	#define FT_POPEN_SUPPORTED
+	#define FT_FDOPEN_SUPPORTED
+	#define FT_MEMSTREAM_SUPPORTED
+#endif
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+	#include <sys/types.h>
+	#include <sys/socket.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+	#include <dirent.h>
+#endif
 
 
 /*
@@ -103,7 +327,13 @@ MUTILS_CPP_C_BEGIN
 
 
 /*
- * Replaces fopen, tmpfile, freopen, fclose and remove with filetrack_ versions.
+ * Replaces fopen, tmpfile, freopen and fclose with filetrack_ versions, along
+ * with popen, pclose, fdopen, fmemopen and open_memstream where the platform
+ * provides them. remove is replaced with DEBUG or FILETRACK_ENABLE_STREAM_CACHE.
+ * The stdio I/O functions, the fd functions and the directory functions are
+ * replaced when FILETRACK_ENABLE_IO_STATS, FILETRACK_ENABLE_FD_TRACKING and
+ * FILETRACK_ENABLE_DIR_TRACKING (plus FILETRACK_ENABLE_READDIR_STATS for
+ * readdir) are defined.
  */
 #ifndef FILETRACK_DISABLE_REPLACE_STANDARD_FUNC
 	#define fopen(filename, mode) filetrack_fopen((filename), (mode), FT_FILENAME_LEN_MAX, __FILE__, __LINE__)
@@ -111,9 +341,57 @@ MUTILS_CPP_C_BEGIN
 	#define freopen(filename, mode, stream) filetrack_freopen((filename), (mode), (stream), FT_FILENAME_LEN_MAX, __FILE__, __LINE__)
 	#define fclose(stream) filetrack_fclose((stream), __FILE__, __LINE__)
 
-	#ifdef DEBUG
+	#ifdef FT_POPEN_SUPPORTED
+		#define popen(command, mode) filetrack_popen((command), (mode), __FILE__, __LINE__)
+		#define pclose(stream) filetrack_pclose((stream), __FILE__, __LINE__)
+	#endif
+
+	#ifdef FT_FDOPEN_SUPPORTED
+		#define fdopen(fd, mode) filetrack_fdopen((fd), (mode), __FILE__, __LINE__)
+	#endif
+
+	#ifdef FT_MEMSTREAM_SUPPORTED
+		#define fmemopen(buf, size, mode) filetrack_fmemopen((buf), (size), (mode), __FILE__, __LINE__)
+		#define open_memstream(ptr, sizeloc) filetrack_open_memstream((ptr), (sizeloc), __FILE__, __LINE__)
+	#endif
+
+	#if defined (DEBUG) || defined (FILETRACK_ENABLE_STREAM_CACHE)
 		#define remove(filename) filetrack_remove((filename), FT_FILENAME_LEN_MAX, __FILE__, __LINE__)
 	#endif
+
+	#ifdef FILETRACK_ENABLE_IO_STATS
+		#define fread(ptr, size, nmemb, stream) filetrack_fread((ptr), (size), (nmemb), (stream))
+		#define fwrite(ptr, size, nmemb, stream) filetrack_fwrite((ptr), (size), (nmemb), (stream))
+		#define fputs(str, stream) filetrack_fputs((str), (stream))
+		#define fprintf(stream, ...) filetrack_fprintf((stream), __VA_ARGS__)
+		#define fgets(str, size, stream) filetrack_fgets((str), (size), (stream))
+		#define fflush(stream) filetrack_fflush((stream))
+		#define fseek(stream, offset, whence) filetrack_fseek((stream), (offset), (whence))
+	#endif
+
+	#ifdef FILETRACK_ENABLE_FD_TRACKING
+		/* mode is optional, so it is expanded together with flags into two arguments */
+		#define FT_FD_FLAGS_MODE(flags, mode, ...) (flags), (mode_t)(mode)
+
+		#define open(path, ...) filetrack_open((path), FT_FD_FLAGS_MODE(__VA_ARGS__, 0, 0), __FILE__, __LINE__)
+		#define openat(dirfd, path, ...) filetrack_openat((dirfd), (path), FT_FD_FLAGS_MODE(__VA_ARGS__, 0, 0), __FILE__, __LINE__)
+		#define close(fd) filetrack_close((fd), __FILE__, __LINE__)
+		#define dup(fd) filetrack_dup((fd), __FILE__, __LINE__)
+		#define dup2(oldfd, newfd) filetrack_dup2((oldfd), (newfd), __FILE__, __LINE__)
+		#define pipe(fds) filetrack_pipe((fds), __FILE__, __LINE__)
+		#define socket(domain, type, protocol) filetrack_socket((domain), (type), (protocol), __FILE__, __LINE__)
+		#define mkstemp(tmpl) filetrack_mkstemp((tmpl), __FILE__, __LINE__)
+	#endif
+
+	#ifdef FILETRACK_ENABLE_DIR_TRACKING
+		#define opendir(path) filetrack_opendir((path), __FILE__, __LINE__)
+		#define fdopendir(fd) filetrack_fdopendir((fd), __FILE__, __LINE__)
+		#define closedir(dir) filetrack_closedir((dir), __FILE__, __LINE__)
+
+		#ifdef FILETRACK_ENABLE_READDIR_STATS
+			#define readdir(dir) filetrack_readdir((dir))
+		#endif
+	#endif
 #endif
 
 
@@ -158,7 +436,66 @@ extern FILE* filetrack_freopen (const char* filename, const char* mode, FILE* st
  */
 extern int filetrack_fclose (FILE* stream, const char* file, int line);
 
-#ifdef DEBUG
+#ifdef FT_POPEN_SUPPORTED
+/*
+ * filetrack_popen
+ * @param command: shell command to run
+ * @param mode: "r" to read the command's output or "w" to write to its input
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the pipe stream, or NULL on failure
+ */
+extern FILE* filetrack_popen (const char* command, const char* mode, const char* file, int line);
+
+/*
+ * filetrack_pclose
+ * @param stream: the pipe stream to close, which must have been opened with popen
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: the termination status of the command, or -1 on failure
+ * @note: other threads are not blocked while waiting for the command to exit
+ */
+extern int filetrack_pclose (FILE* stream, const char* file, int line);
+#endif
+
+#ifdef FT_FDOPEN_SUPPORTED
+/*
+ * filetrack_fdopen
+ * @param fd: the file descriptor to associate with the new stream
+ * @param mode: the mode of the stream, which must be compatible with the descriptor
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the opened file stream, or NULL on failure
+ * @note: with FILETRACK_ENABLE_FD_TRACKING, a descriptor created by mkstemp is recorded with the FILE_OPEN_MKSTEMP type and its file name
+ */
+extern FILE* filetrack_fdopen (int fd, const char* mode, const char* file, int line);
+#endif
+
+#ifdef FT_MEMSTREAM_SUPPORTED
+/*
+ * filetrack_fmemopen
+ * @param buf: the buffer to use, or NULL to let the stream allocate one of size bytes
+ * @param size: size of the buffer in bytes
+ * @param mode: the mode in which the stream is opened (e.g., "r", "w+")
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the memory stream, or NULL on failure
+ */
+extern FILE* filetrack_fmemopen (void* buf, size_t size, const char* mode, const char* file, int line);
+
+/*
+ * filetrack_open_memstream
+ * @param ptr: receives the address of the dynamically allocated buffer
+ * @param sizeloc: receives the size of the buffer
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the memory stream, or NULL on failure
+ * @note: the reports show *sizeloc as of the last fflush without flushing the stream, so sizeloc must stay valid while it is open
+ */
+extern FILE* filetrack_open_memstream (char** ptr, size_t* sizeloc, const char* file, int line);
+#endif
+
+#if defined (DEBUG) || defined (FILETRACK_ENABLE_STREAM_CACHE)
 /*
  * filetrack_remove
  * @param filename: name of the file to remove
@@ -170,6 +507,584 @@ extern int filetrack_fclose (FILE* stream, const char* file, int line);
 extern int filetrack_remove (const char* filename, size_t filename_len_max, const char* file, int line);
 #endif
 
+#ifdef FILETRACK_ENABLE_STREAM_CACHE
+#define fopen_cached(filename, mode) filetrack_fopen_cached((filename), (mode), FT_FILENAME_LEN_MAX, __FILE__, __LINE__)
+
+/*
+ * filetrack_fopen_cached
+ * @param filename: name of the file to open
+ * @param mode: the mode in which the file is opened; only read-only modes are cached
+ * @param filename_len_max: maximum length of the filename, usually specified with FT_FILENAME_LEN_MAX
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the opened file stream, or NULL on failure
+ * @note: a stream opened this way is kept open by fclose and handed out again, rewound, to the next call with the same filename and mode
+ */
+extern FILE* filetrack_fopen_cached (const char* filename, const char* mode, size_t filename_len_max, const char* file, int line);
+
+
+typedef struct {
+	uint64_t hits;           /* opens served from the cache */
+	uint64_t misses;         /* opens that had to call fopen */
+	uint64_t invalidations;  /* cached streams dropped because the file changed or was removed */
+	uint64_t evictions;      /* cached streams dropped to make room */
+	uint64_t cached_cnt;     /* streams currently held by the cache */
+} FileTrackStreamCacheStats;
+
+
+/*
+ * filetrack_stream_cache_stats
+ * @param stats: receives the counters of the stream cache
+ * @return: true on success, false if stats is NULL
+ */
+extern bool filetrack_stream_cache_stats (FileTrackStreamCacheStats* stats);
+#endif
+
+
+#if defined (FILETRACK_ENABLE_IO_STATS) || defined (FILETRACK_ENABLE_COOKIE_ENGINE)
+typedef struct {
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	uint64_t read_calls;
+	uint64_t write_calls;
+	uint64_t flush_calls;
+	uint64_t seek_calls;
+} FileTrackIoStats;
+#endif
+
+
+#ifdef FILETRACK_ENABLE_IO_STATS
+
+/*
+ * The following functions behave like their standard counterparts and additionally
+ * count the bytes and calls for the stream.
+ */
+extern size_t filetrack_fread (void* ptr, size_t size, size_t nmemb, FILE* stream);
+extern size_t filetrack_fwrite (const void* ptr, size_t size, size_t nmemb, FILE* stream);
+extern int filetrack_fputs (const char* str, FILE* stream);
+#if defined (__GNUC__) || defined (__clang__)
+	__attribute__((format(printf, 2, 3)))
+#endif
+extern int filetrack_fprintf (FILE* stream, const char* format, ...);
+extern char* filetrack_fgets (char* str, int size, FILE* stream);
+extern int filetrack_fflush (FILE* stream);
+extern int filetrack_fseek (FILE* stream, long offset, int whence);
+
+/*
+ * filetrack_io_stats
+ * @param stream: the tracked file stream to query
+ * @param stats: receives the counters accumulated since the stream was opened
+ * @return: true on success, false if the stream is not tracked
+ */
+extern bool filetrack_io_stats (FILE* stream, FileTrackIoStats* stats);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_FD_TRACKING
+/*
+ * The following functions behave like their standard counterparts and additionally
+ * record the returned descriptors, or forget the closed one.
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ */
+extern int filetrack_open (const char* path, int flags, mode_t mode, const char* file, int line);
+extern int filetrack_openat (int dirfd, const char* path, int flags, mode_t mode, const char* file, int line);
+extern int filetrack_close (int fd, const char* file, int line);
+extern int filetrack_dup (int fd, const char* file, int line);
+extern int filetrack_dup2 (int oldfd, int newfd, const char* file, int line);
+extern int filetrack_pipe (int fds[2], const char* file, int line);
+extern int filetrack_socket (int domain, int type, int protocol, const char* file, int line);
+extern int filetrack_mkstemp (char* tmpl, const char* file, int line);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_DIR_TRACKING
+/*
+ * filetrack_opendir, filetrack_fdopendir, filetrack_closedir
+ * These behave like their standard counterparts and additionally record or forget the
+ * directory stream.
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ */
+extern DIR* filetrack_opendir (const char* path, const char* file, int line);
+extern DIR* filetrack_fdopendir (int fd, const char* file, int line);
+extern int filetrack_closedir (DIR* dir, const char* file, int line);
+
+#ifdef FILETRACK_ENABLE_READDIR_STATS
+/*
+ * filetrack_readdir
+ * @note: behaves like readdir and counts the entries returned for the directory stream
+ */
+extern struct dirent* filetrack_readdir (DIR* dir);
+#endif
+#endif
+
+
+#ifdef FILETRACK_ENABLE_LATENCY_STATS
+typedef enum {
+	FT_LATENCY_FOPEN,
+	FT_LATENCY_TMPFILE,
+	FT_LATENCY_FREOPEN,
+	FT_LATENCY_FCLOSE,
+	FT_LATENCY_POPEN,
+	FT_LATENCY_PCLOSE,
+	FT_LATENCY_OP_COUNT
+} FileTrackLatencyOp;
+
+
+typedef struct {
+	uint64_t count;
+	uint64_t p50_ns;
+	uint64_t p99_ns;
+	uint64_t max_ns;
+} FileTrackLatency;
+
+
+/*
+ * filetrack_latency
+ * @param file: name of the calling file that performed the operation, as given by __FILE__
+ * @param line: line number of the call, as given by __LINE__
+ * @param op: the operation to query (e.g., FT_LATENCY_FOPEN, FT_LATENCY_FCLOSE)
+ * @param latency: receives the number of calls and the p50, p99 and maximum durations in nanoseconds
+ * @return: true on success, false if nothing has been recorded for the call site and operation
+ */
+extern bool filetrack_latency (const char* file, int line, FileTrackLatencyOp op, FileTrackLatency* latency);
+#endif
+
+
+typedef struct {
+	uint64_t open_cnt;           /* tracked streams currently open */
+	uint64_t peak_cnt;           /* highest open_cnt since the start of the process */
+	uint64_t interval_peak_cnt;  /* highest open_cnt since the interval was last reset */
+} FileTrackWatermark;
+
+
+/*
+ * filetrack_watermark
+ * @param watermark: receives the number of open streams and their all-time and interval peaks
+ * @param reset_interval: if true, the interval peak is reset to the current number of open streams after it is read
+ * @return: true on success, false if watermark is NULL
+ */
+extern bool filetrack_watermark (FileTrackWatermark* watermark, bool reset_interval);
+
+
+#ifdef FILETRACK_ENABLE_VIRTUAL_HANDLES
+/*
+ * filetrack_virtual_handles_set
+ * @param max_open: how many virtual handles may keep their underlying file open, or 0 to close them only when descriptors run out
+ */
+extern void filetrack_virtual_handles_set (size_t max_open);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_ADMISSION_CONTROL
+/*
+ * filetrack_admission_set
+ * @param budget: how many streams opened by fopen and tmpfile may be open at the same time, or 0 to disable admission control
+ * @param timeout_ms: how long fopen and tmpfile wait for a free slot before failing with EAGAIN, or a negative value to wait indefinitely
+ * @note: waiting callers are served in arrival order, and each fclose of an admitted stream frees one slot
+ */
+extern void filetrack_admission_set (uint64_t budget, int64_t timeout_ms);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_NEGATIVE_CACHE
+/*
+ * filetrack_negative_cache_ttl_set
+ * @param ttl_ms: how long a filename that fopen could not find is remembered, or 0 to disable the negative cache
+ */
+extern void filetrack_negative_cache_ttl_set (uint64_t ttl_ms);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_ASYNC_CLOSE
+#define fclose_async(stream) filetrack_fclose_async((stream), __FILE__, __LINE__)
+
+#define FT_ASYNC_CLOSE_ERRORS_MAX 32
+
+
+typedef struct {
+	FILE* stream;       /* only identifies the stream, which is already closed */
+	const char* file;   /* caller of fclose_async */
+	int line;
+	int result;         /* 0 on success, EOF on failure */
+	int error;          /* errno of the failed flush or close */
+	uint64_t queued_ns; /* time spent waiting for a worker */
+	uint64_t close_ns;  /* time spent flushing and closing */
+} FileTrackAsyncCloseResult;
+
+
+/* Called from a worker thread without any lock held; it must not call filetrack_fclose_async_drain. */
+typedef void (*FileTrackAsyncCloseCallback)(const FileTrackAsyncCloseResult* result, void* arg);
+
+
+/*
+ * filetrack_fclose_async
+ * @param stream: pointer to the file stream to close
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: 0 if the stream was queued, otherwise the result of closing it synchronously
+ * @note: streams that are not tracked, are already being closed or were opened with popen are handled by fclose on the calling thread
+ */
+extern int filetrack_fclose_async (FILE* stream, const char* file, int line);
+
+
+/*
+ * filetrack_fclose_async_drain
+ * Waits until every stream passed to filetrack_fclose_async has been closed.
+ */
+extern void filetrack_fclose_async_drain (void);
+
+
+/*
+ * filetrack_fclose_async_poll
+ * @param result: receives the oldest unread failure, may be NULL to discard it
+ * @param lost_cnt: receives how many failures were dropped because more than FT_ASYNC_CLOSE_ERRORS_MAX were unread, may be NULL
+ * @return: true if a failure was returned, false if there was none
+ */
+extern bool filetrack_fclose_async_poll (FileTrackAsyncCloseResult* result, uint64_t* lost_cnt);
+
+
+/*
+ * filetrack_fclose_async_callback_set
+ * @param callback: called after every asynchronous close, or NULL to stop calling it
+ * @param arg: passed to the callback as is
+ */
+extern void filetrack_fclose_async_callback_set (FileTrackAsyncCloseCallback callback, void* arg);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_IO_URING
+#define fopen_batch(filenames, modes, streams, count) filetrack_fopen_batch((filenames), (modes), (streams), (count), FT_FILENAME_LEN_MAX, __FILE__, __LINE__)
+#define fclose_batch(streams, count) filetrack_fclose_batch((streams), (count), __FILE__, __LINE__)
+
+
+/*
+ * filetrack_fopen_batch
+ * @param filenames: names of the files to open
+ * @param modes: the mode in which each file is opened
+ * @param streams: receives the opened streams, NULL for files that could not be opened
+ * @param count: number of files
+ * @param filename_len_max: maximum length of each filename, usually specified with FT_FILENAME_LEN_MAX
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: number of files opened
+ */
+extern size_t filetrack_fopen_batch (const char* const* filenames, const char* const* modes, FILE** streams, size_t count, size_t filename_len_max, const char* file, int line);
+
+
+/*
+ * filetrack_fclose_batch
+ * @param streams: the streams to close, NULL elements are skipped
+ * @param count: number of streams
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: 0 if every stream was closed successfully, EOF otherwise
+ */
+extern int filetrack_fclose_batch (FILE* const* streams, size_t count, const char* file, int line);
+
+
+typedef struct {
+	uint64_t batches;         /* calls of fopen_batch */
+	uint64_t uring_opens;     /* files opened (or that failed to open) through io_uring */
+	uint64_t fallback_opens;  /* files opened one by one with fopen */
+	bool uring_available;     /* io_uring has been set up */
+} FileTrackBatchStats;
+
+
+/*
+ * filetrack_batch_stats
+ * @param stats: receives the counters of fopen_batch
+ * @return: true on success, false if stats is NULL
+ */
+extern bool filetrack_batch_stats (FileTrackBatchStats* stats);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_GROUP_COMMIT
+#define fclose_durable(stream) filetrack_fclose_durable((stream), __FILE__, __LINE__)
+
+
+/*
+ * filetrack_fclose_durable
+ * @param stream: pointer to the file stream to close
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: 0 if the data reached storage and the stream was closed, EOF otherwise
+ * @note: the stream is closed even if syncing fails; streams that are not tracked, for example skipped by sampling, are synced as well, while streams opened with popen and streams that are not regular files are closed without syncing
+ */
+extern int filetrack_fclose_durable (FILE* stream, const char* file, int line);
+
+
+/*
+ * filetrack_fclose_durable_syncfs_min_set
+ * @param file_cnt: minimum number of files on one file system in a batch for which a single syncfs replaces their fsync calls, 0 to always use fsync (the default)
+ */
+extern void filetrack_fclose_durable_syncfs_min_set (size_t file_cnt);
+
+
+typedef struct {
+	uint64_t batches;        /* rounds of syncing */
+	uint64_t files;          /* streams closed with fclose_durable */
+	uint64_t sync_calls;     /* fsync and syncfs calls issued */
+	uint64_t largest_batch;
+	uint64_t p50_ns;         /* latency of a batch, from the first sync to the last close */
+	uint64_t p99_ns;
+	uint64_t max_ns;
+} FileTrackDurableStats;
+
+
+/*
+ * filetrack_durable_stats
+ * @param stats: receives the counters of fclose_durable
+ * @return: true on success, false if stats is NULL
+ */
+extern bool filetrack_durable_stats (FileTrackDurableStats* stats);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_BUFFER_POOL
+/*
+ * filetrack_buffer_size_set
+ * @param file: name of the file containing the fopen call, must stay valid (usually a __FILE__ literal)
+ * @param line: line number of the fopen call
+ * @param size: buffer size for streams opened there, rounded up to a power of two; 0 leaves the buffer to stdio
+ * @return: true on success, false if size exceeds 16 MiB or memory could not be allocated
+ */
+extern bool filetrack_buffer_size_set (const char* file, int line, size_t size);
+
+
+/*
+ * filetrack_buffer_size_default_set
+ * @param size: buffer size for call sites without their own setting; 0 leaves the buffer to stdio
+ * @return: true on success, false if size exceeds 16 MiB
+ */
+extern bool filetrack_buffer_size_default_set (size_t size);
+
+
+/*
+ * filetrack_buffer_pool_hugepages_set
+ * @param enable: whether buffers allocated from now on are backed by huge pages
+ * @return: true on success, false if huge pages are not supported on this platform
+ */
+extern bool filetrack_buffer_pool_hugepages_set (bool enable);
+
+
+typedef struct {
+	uint64_t hits;          /* buffers taken from the pool */
+	uint64_t misses;        /* buffers that had to be allocated */
+	uint64_t returned;      /* buffers returned to the pool on close */
+	size_t pooled_bytes;    /* memory held by free buffers */
+	size_t hugepage_bytes;  /* memory mapped for huge page backed buffers */
+} FileTrackBufferPoolStats;
+
+
+/*
+ * filetrack_buffer_pool_stats
+ * @param stats: receives the counters of the buffer pool
+ * @return: true on success, false if stats is NULL
+ */
+extern bool filetrack_buffer_pool_stats (FileTrackBufferPoolStats* stats);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_WRITE_ADVISOR
+/*
+ * filetrack_write_advisor_autotune_set
+ * @param enable: whether the suggested buffer size is applied to later opens at the same call site
+ * @return: true on success, false if enabling it without FILETRACK_ENABLE_BUFFER_POOL
+ */
+extern bool filetrack_write_advisor_autotune_set (bool enable);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_FADVISE
+/*
+ * filetrack_fadvise_readahead_set
+ * @param enable: whether files opened at call sites that read them through are read ahead (Linux only, enabled by default)
+ */
+extern void filetrack_fadvise_readahead_set (bool enable);
+
+
+typedef struct {
+	uint64_t sequential_hints;  /* opens given POSIX_FADV_SEQUENTIAL */
+	uint64_t random_hints;      /* opens given POSIX_FADV_RANDOM */
+	uint64_t noreuse_hints;     /* opens given POSIX_FADV_NOREUSE */
+	uint64_t readahead_bytes;   /* bytes requested with readahead */
+	uint64_t dontneed_calls;    /* write-once files dropped from the page cache on close */
+	uint64_t dontneed_bytes;    /* size of those files */
+	uint64_t pages_dropped;     /* pages that left the page cache, 0 unless cachestat is available */
+} FileTrackFadviseStats;
+
+
+/*
+ * filetrack_fadvise_stats
+ * @param stats: receives the counters of the hints given so far
+ * @return: true on success, false if stats is NULL
+ */
+extern bool filetrack_fadvise_stats (FileTrackFadviseStats* stats);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_PREFETCH
+/*
+ * filetrack_prefetch_set
+ * @param file: name of the file containing the fopen call, must stay valid (usually a __FILE__ literal)
+ * @param line: line number of the fopen call
+ * @param size: how many bytes from the start of files opened read-only there are prefetched; 0 disables it, including learned prefetching
+ * @return: true on success, false if memory could not be allocated
+ */
+extern bool filetrack_prefetch_set (const char* file, int line, size_t size);
+
+
+typedef struct {
+	uint64_t files;       /* streams whose prefetch was started */
+	uint64_t bytes;       /* bytes prefetched for streams that have been closed */
+	uint64_t used_bytes;  /* of those, bytes the streams went on to read */
+	uint64_t cancelled;   /* streams closed before their prefetch finished */
+	uint64_t overtaken;   /* of those, streams that had read past the prefetched bytes */
+} FileTrackPrefetchStats;
+
+
+/*
+ * filetrack_prefetch_stats
+ * @param stats: receives the counters of the prefetcher
+ * @return: true on success, false if stats is NULL
+ */
+extern bool filetrack_prefetch_stats (FileTrackPrefetchStats* stats);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+/*
+ * filetrack_sampling_set
+ * @param period: track about one in this many opens, or every open if 1
+ * @param adaptive: whether rarely used call sites are sampled more often, up to every open
+ * @return: true on success, false if period is 0
+ */
+extern bool filetrack_sampling_set (uint32_t period, bool adaptive);
+
+
+typedef struct {
+	uint64_t sampled;        /* opens that were tracked */
+	uint64_t skipped;        /* opens that were not tracked */
+	uint64_t live_estimate;  /* estimated number of open streams, tracked or not */
+	uint32_t period;
+	bool adaptive;
+} FileTrackSamplingStats;
+
+
+/*
+ * filetrack_sampling_stats
+ * @param stats: receives the sampling counters and the current settings
+ * @return: true on success, false if stats is NULL
+ */
+extern bool filetrack_sampling_stats (FileTrackSamplingStats* stats);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_BACKTRACE
+/*
+ * filetrack_backtrace_depth_set
+ * @param depth: how many return addresses to record when a stream is opened (at most 64), or 0 to stop recording
+ * @return: true on success, false if depth is too large
+ */
+extern bool filetrack_backtrace_depth_set (size_t depth);
+
+
+typedef struct {
+	uint64_t captured;  /* stacks recorded when streams were opened */
+	uint64_t unique;    /* distinct stacks kept in the table */
+	uint64_t bytes;     /* memory used by the distinct stacks */
+	size_t depth;
+} FileTrackBacktraceStats;
+
+
+/*
+ * filetrack_backtrace_stats
+ * @param stats: receives the counters of the stack table and the current depth
+ * @return: true on success, false if stats is NULL
+ */
+extern bool filetrack_backtrace_stats (FileTrackBacktraceStats* stats);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_MEMFD_TMPFILE
+/*
+ * filetrack_memfd_tmpfile_cap_set
+ * @param ram_max: how many bytes of memory the open memfd temporary files may use before tmpfile creates files on the disk again, or 0 to always use the disk
+ */
+extern void filetrack_memfd_tmpfile_cap_set (uint64_t ram_max);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_TMPFILE_POOL
+/*
+ * filetrack_tmpfile_pool_set
+ * @param ready_cnt: how many temporary files to keep ready (at most FT_TMPFILE_POOL_MAX), or 0 to stop the pool and close them
+ * @param recycle: if true, temporary files closed with fclose are emptied and returned to the pool while it is not full
+ * @return: true on success, false if the background thread could not be started
+ */
+extern bool filetrack_tmpfile_pool_set (size_t ready_cnt, bool recycle);
+
+
+typedef struct {
+	uint64_t hits;       /* tmpfile calls served from the pool */
+	uint64_t misses;     /* tmpfile calls that found the pool empty */
+	uint64_t recycled;   /* closed temporary files returned to the pool */
+	uint64_t ready_cnt;  /* temporary files currently waiting in the pool */
+} FileTrackTmpfilePoolStats;
+
+
+/*
+ * filetrack_tmpfile_pool_stats
+ * @param stats: receives the counters of the temporary file pool
+ * @return: true on success, false if stats is NULL
+ */
+extern bool filetrack_tmpfile_pool_stats (FileTrackTmpfilePoolStats* stats);
+#endif
+
+
+#ifdef FILETRACK_ENABLE_NOFILE_ALARM
+#define FT_NOFILE_THRESHOLDS_MAX 8
+#define FT_NOFILE_TOP_SITES 5
+
+
+typedef struct {
+	const char* file;
+	int line;
+	uint64_t open_cnt;  /* streams, descriptors and directories still open from this call site */
+} FileTrackSiteUsage;
+
+
+typedef struct {
+	uint64_t open_cnt;               /* tracked handles currently open */
+	uint64_t limit;                  /* soft RLIMIT_NOFILE */
+	unsigned int threshold_percent;  /* the highest threshold that has just been crossed */
+	size_t top_sites_cnt;
+	FileTrackSiteUsage top_sites[FT_NOFILE_TOP_SITES];  /* most open handles first */
+} FileTrackNofileAlarm;
+
+
+/*
+ * The callback is called from the thread whose open crossed the threshold, after that
+ * thread has released the global lock, so it may open, write and close files itself.
+ */
+typedef void (*FileTrackNofileAlarmFunc) (const FileTrackNofileAlarm* alarm, void* arg);
+
+
+/*
+ * filetrack_nofile_alarm_set
+ * @param func: function called when a threshold is crossed upwards, or NULL to disable the alarm
+ * @param arg: passed to func as is
+ * @param percents: thresholds in percent of the soft RLIMIT_NOFILE, or NULL for 80 and 95
+ * @param percents_cnt: number of thresholds, at most FT_NOFILE_THRESHOLDS_MAX
+ * @return: true on success, false if a threshold is out of the range 1 to 100
+ * @note: a threshold fires once and is re-armed after usage drops FT_NOFILE_HYSTERESIS_PERCENT (5 by default) points below it
+ */
+extern bool filetrack_nofile_alarm_set (FileTrackNofileAlarmFunc func, void* arg, const unsigned int* percents, size_t percents_cnt);
+#endif
+
 
 /*
  * filetrack_all_check
@@ -177,6 +1092,12 @@ extern int filetrack_remove (const char* filename, size_t filename_len_max, cons
  */
 extern void filetrack_all_check (void);
 
+/*
+ * filetrack_site_report
+ * @note: use the printf function to output statistics for every call site that opened a stream, or closed one when latencies are recorded
+ */
+extern void filetrack_site_report (void);
+
 
 MUTILS_CPP_C_END
 
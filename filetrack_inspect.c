@@ -0,0 +1,221 @@
+/*
+ * filetrack_inspect.c -- read-only viewer for filetrack's shared-memory live registry
+ * version 0.9.5, June 22, 2025
+ *
+ * License: zlib License
+ *
+ * Copyright (c) 2025 Kazushi Yamasaki
+ *
+ * This software is provided ‘as-is’, without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ * distribution.
+ *
+ *
+ *
+ * Usage: filetrack-inspect <pid>
+ *
+ * Attaches read-only to the registry of a process built with
+ * FILETRACK_ENABLE_SHM_REGISTRY and lists its open streams, their call sites and
+ * ages. The target process is neither stopped nor signaled.
+ */
+
+#include "ft_shm.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+	#error "This program requires C11 or higher."
+#endif
+
+
+#define SEQLOCK_TRIAL 1000
+
+
+static uint64_t clock_ns (void) {
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) return 0;
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+
+/* シーケンスロックで一貫したコピーを取得できた場合のみ true を返す */
+static bool record_read (const FileTrackShmRecord* record, FileTrackShmRecordData* out) {
+	for (int i = 0; i < SEQLOCK_TRIAL; i++) {
+		uint32_t seq_before = atomic_load_explicit(&record->seq, memory_order_acquire);
+		if (seq_before & 1u) {  /* 書き込み中 */
+			sched_yield();
+			continue;
+		}
+
+		memcpy(out, &record->data, sizeof(FileTrackShmRecordData));
+		atomic_thread_fence(memory_order_acquire);
+
+		uint32_t seq_after = atomic_load_explicit(&record->seq, memory_order_relaxed);
+		if (seq_before == seq_after) {
+			/* 書き込み側が壊れていてもヌル終端だけは保証する */
+			out->open_type[FT_SHM_TYPE_LEN - 1] = '\0';
+			out->mode[FT_SHM_MODE_LEN - 1] = '\0';
+			out->open_file[FT_SHM_SITE_LEN - 1] = '\0';
+			out->filename[FT_SHM_FILENAME_LEN - 1] = '\0';
+			return true;
+		}
+	}
+	return false;
+}
+
+
+static int compare_by_age (const void* a, const void* b) {
+	const FileTrackShmRecordData* ra = (const FileTrackShmRecordData*)a;
+	const FileTrackShmRecordData* rb = (const FileTrackShmRecordData*)b;
+	if (ra->open_ns != rb->open_ns) return (ra->open_ns < rb->open_ns) ? -1 : 1;  /* 古いものが先 */
+	return 0;
+}
+
+
+static int compare_by_site (const void* a, const void* b) {
+	const FileTrackShmRecordData* ra = (const FileTrackShmRecordData*)a;
+	const FileTrackShmRecordData* rb = (const FileTrackShmRecordData*)b;
+	int result = strcmp(ra->open_file, rb->open_file);
+	if (result != 0) return result;
+	if (ra->open_line != rb->open_line) return (ra->open_line < rb->open_line) ? -1 : 1;
+	return compare_by_age(a, b);
+}
+
+
+static double age_sec (uint64_t now_ns, uint64_t open_ns) {
+	if (now_ns < open_ns) return 0;
+	return (double)(now_ns - open_ns) / (double)1000000000u;
+}
+
+
+int main (int argc, char** argv) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <pid>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	char* end;
+	errno = 0;
+	long pid = strtol(argv[1], &end, 10);
+	if (errno != 0 || end == argv[1] || *end != '\0' || pid <= 0) {
+		fprintf(stderr, "Invalid pid '%s'.\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	char name[FT_SHM_NAME_LEN_MAX];
+	snprintf(name, sizeof(name), FT_SHM_NAME_PREFIX "%ld", pid);
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open the registry '%s': %s\nIs the process built with FILETRACK_ENABLE_SHM_REGISTRY?\n", name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FileTrackShmHeader)) {
+		fprintf(stderr, "The registry '%s' is too small or unreadable.\n", name);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	size_t size = (size_t)st.st_size;
+	void* addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		fprintf(stderr, "Failed to map the registry '%s': %s\n", name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	const FileTrackShmHeader* header = (const FileTrackShmHeader*)addr;
+	if (atomic_load_explicit(&header->magic, memory_order_acquire) != FT_SHM_MAGIC ||
+		header->version != FT_SHM_VERSION ||
+		header->record_size != sizeof(FileTrackShmRecord) ||
+		sizeof(FileTrackShmHeader) + (size_t)header->capacity * sizeof(FileTrackShmRecord) > size) {
+		fprintf(stderr, "The registry '%s' has an unknown layout.\n", name);
+		munmap(addr, size);
+		return EXIT_FAILURE;
+	}
+
+	FileTrackShmRecordData* records = malloc(sizeof(FileTrackShmRecordData) * ((header->capacity > 0) ? header->capacity : 1));
+	if (records == NULL) {
+		fprintf(stderr, "Failed to allocate memory.\n");
+		munmap(addr, size);
+		return EXIT_FAILURE;
+	}
+
+	size_t records_cnt = 0;
+	size_t torn_cnt = 0;
+	for (uint32_t i = 0; i < header->capacity; i++) {
+		FileTrackShmRecordData data;
+		if (!record_read(&header->records[i], &data)) {
+			torn_cnt++;
+			continue;
+		}
+		if (data.in_use) records[records_cnt++] = data;
+	}
+
+	uint64_t now_ns = clock_ns();
+
+	printf("Process: %lld   Open Streams: %llu   Peak: %llu   Total Opened: %llu   Not Mirrored: %llu\n",
+		(long long)header->pid,
+		(unsigned long long)atomic_load_explicit(&header->live_count, memory_order_relaxed),
+		(unsigned long long)atomic_load_explicit(&header->peak_count, memory_order_relaxed),
+		(unsigned long long)atomic_load_explicit(&header->total_count, memory_order_relaxed),
+		(unsigned long long)atomic_load_explicit(&header->dropped_count, memory_order_relaxed));
+	if (torn_cnt > 0)
+		printf("Records skipped while being written: %zu\n", torn_cnt);
+
+	qsort(records, records_cnt, sizeof(FileTrackShmRecordData), compare_by_age);
+
+	printf("\nOpen streams (oldest first):\n");
+	for (size_t i = 0; i < records_cnt; i++) {
+		printf("\nStream: 0x%llx   Mode: %s   Age: %.3f s\nFile Name: %s\nopen Type: %s\nopen File: %s   Line: %d\n",
+			(unsigned long long)records[i].stream, records[i].mode, age_sec(now_ns, records[i].open_ns),
+			records[i].filename, records[i].open_type, records[i].open_file, (int)records[i].open_line);
+	}
+
+	qsort(records, records_cnt, sizeof(FileTrackShmRecordData), compare_by_site);
+
+	printf("\n\nOpen streams by call site:\n");
+	for (size_t i = 0; i < records_cnt;) {
+		size_t j = i + 1;
+		while (j < records_cnt && records[j].open_line == records[i].open_line && strcmp(records[j].open_file, records[i].open_file) == 0)
+			j++;
+
+		/* 同じ呼び出し元の中では古い順に並んでいる */
+		printf("open File: %s   Line: %d   Open: %zu   Oldest Age: %.3f s\n",
+			records[i].open_file, (int)records[i].open_line, j - i, age_sec(now_ns, records[i].open_ns));
+		i = j;
+	}
+	printf("\n");
+
+	free(records);
+	munmap(addr, size);
+	return EXIT_SUCCESS;
+}
@@ -78,6 +78,11 @@ typedef enum {
 	FILE_OPEN_FOPEN,
 	FILE_OPEN_TMPFILE,
 	FILE_OPEN_FREOPEN,
+	FILE_OPEN_POPEN,
+	FILE_OPEN_FDOPEN,
+	FILE_OPEN_MKSTEMP,
+	FILE_OPEN_FMEMOPEN,
+	FILE_OPEN_OPEN_MEMSTREAM,
 	FILE_OPEN_UNKNOWN
 } FileOpenType;
 
@@ -86,6 +91,7 @@ typedef enum {
 	FILE_NOT_CLOSED,
 	FILE_CLOSED_FCLOSE,
 	FILE_CLOSED_FREOPEN,
+	FILE_CLOSED_PCLOSE,
 	FILE_CLOSED_UNKNOWN
 } FileClosedType;
 
@@ -93,13 +99,13 @@ typedef enum {
 /*
  * filetrack_entry_add
  * @param stream: the file stream to track
- * @param open_type: the type of file opening (e.g., FILE_OPEN_FOPEN, FILE_OPEN_TMPFILE, FILE_OPEN_FREOPEN)
+ * @param open_type: the type of file opening (e.g., FILE_OPEN_FOPEN, FILE_OPEN_TMPFILE, FILE_OPEN_FREOPEN, FILE_OPEN_POPEN, FILE_OPEN_FDOPEN)
  * @param filename: the name of the file being opened
  * @param mode: the mode in which the file is opened (e.g., "r", "w", "a")
  * @param filename_len_max: maximum length of the filename, usually specified with FT_FILENAME_LEN_MAX
  * @param file: name of the calling file, usually specified with __FILE__
  * @param line: line number of the caller, usually specified with __LINE__
- * @note: this function is called when a file is opened, such as with fopen, tmpfile, or freopen
+ * @note: this function is called when a file is opened, such as with fopen, tmpfile, freopen, popen, fdopen, fmemopen or open_memstream
  */
 extern void filetrack_entry_add (FILE* stream, FileOpenType open_type, const char* filename, const char* mode, size_t filename_len_max, const char* file, int line);
 
@@ -117,10 +123,10 @@ extern void filetrack_entry_update (FILE* stream, const char* filename, const ch
 /*
  * filetrack_entry_close
  * @param stream: the file stream to close
- * @param closed_type: the type of file closing (e.g., FILE_CLOSED_FCLOSE, FILE_CLOSED_FREOPEN)
+ * @param closed_type: the type of file closing (e.g., FILE_CLOSED_FCLOSE, FILE_CLOSED_FREOPEN, FILE_CLOSED_PCLOSE)
  * @param file: name of the calling file, usually specified with __FILE__
  * @param line: line number of the caller, usually specified with __LINE__
- * @note: this function is called when a file is closed, either by fclose or freopen
+ * @note: this function is called when a file is closed by fclose, freopen or pclose
  */
 extern void filetrack_entry_close (FILE* stream, FileClosedType closed_type, const char* file, int line);
 
@@ -0,0 +1,105 @@
+/*
+ * ft_shm.h -- layout of filetrack's shared-memory live registry
+ * version 0.9.5, June 22, 2025
+ *
+ * License: zlib License
+ *
+ * Copyright (c) 2025 Kazushi Yamasaki
+ *
+ * This software is provided ‘as-is’, without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ * distribution.
+ *
+ *
+ *
+ * This header is shared by the library (built with FILETRACK_ENABLE_SHM_REGISTRY)
+ * and the filetrack-inspect tool. It only describes the memory layout and does not
+ * depend on the rest of filetrack.
+ *
+ * The segment is named FT_SHM_NAME_PREFIX followed by the decimal pid of the tracked
+ * process. Every record is protected by its own sequence lock: the writer makes seq
+ * odd before touching the record and even again afterwards, so a reader only accepts
+ * a copy taken while seq was even and unchanged.
+ */
+
+#pragma once
+
+#ifndef FT_SHM_H
+#define FT_SHM_H
+
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define FT_SHM_NAME_PREFIX "/filetrack."
+#define FT_SHM_NAME_LEN_MAX 64
+
+#define FT_SHM_MAGIC 0x4b525446u  /* "FTRK" */
+#define FT_SHM_VERSION 1u
+
+#define FT_SHM_TYPE_LEN 16
+#define FT_SHM_MODE_LEN 16
+#define FT_SHM_SITE_LEN 128
+#define FT_SHM_FILENAME_LEN 256
+
+
+typedef struct {
+	uint64_t stream;
+	uint64_t open_ns;     /* CLOCK_MONOTONIC */
+	int32_t open_line;
+	uint32_t in_use;
+	char open_type[FT_SHM_TYPE_LEN];
+	char mode[FT_SHM_MODE_LEN];
+	char open_file[FT_SHM_SITE_LEN];
+	char filename[FT_SHM_FILENAME_LEN];
+} FileTrackShmRecordData;
+
+
+typedef struct {
+	_Atomic uint32_t seq;
+	uint32_t reserved;
+	FileTrackShmRecordData data;
+} FileTrackShmRecord;
+
+
+typedef struct {
+	_Atomic uint32_t magic;  /* 他の項目の初期化が終わってから書き込まれる */
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t capacity;
+	int64_t pid;
+	_Atomic uint64_t live_count;
+	_Atomic uint64_t peak_count;
+	_Atomic uint64_t total_count;
+	_Atomic uint64_t dropped_count;
+	FileTrackShmRecord records[];
+} FileTrackShmHeader;
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
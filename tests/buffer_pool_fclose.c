@@ -0,0 +1,61 @@
+/*
+ * プールから割り当てたバッファの中身が、fclose で書き出される前に壊されないことを確かめる回帰テスト
+ * FILETRACK_ENABLE_BUFFER_POOL を定義してビルドする
+ * 実行方法: make test
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "filetrack.h"
+
+
+#define TEST_PATH "filetrack_test_buffer_pool.txt"
+#define TEST_LINES 20000u  /* 最後のバッファが一杯にならない行数 */
+#define TEST_TIMEOUT_SEC 10u
+
+
+static int failures = 0;
+
+
+static void check (bool ok, const char* what) {
+	if (!ok) {
+		fprintf(stderr, "FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+
+int main (void) {
+	alarm(TEST_TIMEOUT_SEC);
+
+	FILE* stream = fopen(TEST_PATH, "w");
+	check(stream != NULL, "fopen for writing");
+	if (stream == NULL) return EXIT_FAILURE;
+
+	for (unsigned i = 0; i < TEST_LINES; i++)
+		fprintf(stream, "line %u\n", i);
+	check(fclose(stream) == 0, "fclose after writing");
+
+	stream = fopen(TEST_PATH, "r");
+	check(stream != NULL, "fopen for reading");
+	if (stream != NULL) {
+		unsigned lines = 0;
+		bool intact = true;
+		unsigned value;
+		while (fscanf(stream, "line %u\n", &value) == 1) {
+			if (value != lines) intact = false;
+			lines++;
+		}
+		check(intact && lines == TEST_LINES && feof(stream), "every line is written intact");
+		check(fclose(stream) == 0, "fclose after reading");
+	}
+
+	remove(TEST_PATH);
+
+	if (failures > 0) return EXIT_FAILURE;
+	puts("buffer_pool_fclose: OK");
+	return EXIT_SUCCESS;
+}
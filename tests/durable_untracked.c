@@ -0,0 +1,90 @@
+/*
+ * 追跡していないストリームも fclose_durable で同期されることを確かめる回帰テスト
+ * FILETRACK_ENABLE_GROUP_COMMIT を定義してビルドする
+ * FILETRACK_ENABLE_SAMPLING も定義すると、サンプリングで外れたストリームも確かめる
+ * 実行方法: make test
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "filetrack.h"
+
+
+#define TEST_PATH "filetrack_test_durable.txt"
+#define TEST_FILES 200u
+#define TEST_TIMEOUT_SEC 30u
+
+
+static int failures = 0;
+
+
+static void check (bool ok, const char* what) {
+	if (!ok) {
+		fprintf(stderr, "FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+
+static uint64_t sync_calls_get (void) {
+	FileTrackDurableStats stats;
+	check(filetrack_durable_stats(&stats), "filetrack_durable_stats");
+	return stats.sync_calls;
+}
+
+
+/* ヘッダーを使わずに開いたストリーム（括弧で囲んでマクロを避ける） */
+static void close_untracked (void) {
+	uint64_t before = sync_calls_get();
+
+	FILE* stream = (fopen)(TEST_PATH, "w");
+	check(stream != NULL, "fopen of an untracked stream");
+	if (stream == NULL) return;
+
+	check(fputs("untracked\n", stream) >= 0, "fputs to an untracked stream");
+	check(fclose_durable(stream) == 0, "fclose_durable of an untracked stream");
+	check(sync_calls_get() - before == 1, "an untracked stream is synced");
+}
+
+
+#ifdef FILETRACK_ENABLE_SAMPLING
+/* 周期を長くして、ほとんどのストリームをサンプリングで外す */
+static void close_sampled_out (void) {
+	check(filetrack_sampling_set(1000, false), "filetrack_sampling_set");
+	uint64_t before = sync_calls_get();
+
+	int failed = 0;
+	for (unsigned i = 0; i < TEST_FILES; i++) {
+		FILE* stream = fopen(TEST_PATH, "w");
+		if (stream == NULL) {
+			failed++;
+			continue;
+		}
+		if (fprintf(stream, "%u\n", i) < 0) failed++;
+		if (fclose_durable(stream) != 0) failed++;
+	}
+
+	check(failed == 0, "fclose_durable of sampled streams");
+	check(sync_calls_get() - before == TEST_FILES, "every sampled stream is synced");
+}
+#endif
+
+
+int main (void) {
+	alarm(TEST_TIMEOUT_SEC);
+
+	close_untracked();
+#ifdef FILETRACK_ENABLE_SAMPLING
+	close_sampled_out();
+#endif
+
+	remove(TEST_PATH);
+
+	if (failures > 0) return EXIT_FAILURE;
+	puts("durable_untracked: OK");
+	return EXIT_SUCCESS;
+}
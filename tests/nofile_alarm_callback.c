@@ -0,0 +1,90 @@
+/*
+ * 上限の通知のコールバックからファイルを開いて書き込めることを確かめる回帰テスト
+ * FILETRACK_ENABLE_NOFILE_ALARM を定義してビルドする
+ * 実行方法: make test
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "filetrack.h"
+
+
+#define TEST_PATH "filetrack_test_nofile.txt"
+#define TEST_LOG_PATH "filetrack_test_nofile.log"
+#define TEST_LIMIT 64u
+#define TEST_PERCENT 50u
+#define TEST_TIMEOUT_SEC 10u  /* コールバックでデッドロックした場合は SIGALRM で失敗させる */
+
+
+static int failures = 0;
+static int alarm_cnt = 0;
+
+
+static void check (bool ok, const char* what) {
+	if (!ok) {
+		fprintf(stderr, "FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+
+/* 通知を受けたらログファイルに書き残す */
+static void nofile_alarm (const FileTrackNofileAlarm* alarm, void* arg) {
+	(void)arg;
+	alarm_cnt++;
+
+	FILE* log = fopen(TEST_LOG_PATH, "w");
+	check(log != NULL, "fopen from the callback");
+	if (log == NULL) return;
+
+	check(fprintf(log, "%u%% %llu/%llu\n", alarm->threshold_percent, (unsigned long long)alarm->open_cnt, (unsigned long long)alarm->limit) > 0, "fprintf from the callback");
+	check(fclose(log) == 0, "fclose from the callback");
+}
+
+
+int main (void) {
+	alarm(TEST_TIMEOUT_SEC);
+
+	struct rlimit rlim;
+	if (getrlimit(RLIMIT_NOFILE, &rlim) != 0) {
+		fprintf(stderr, "FAILED: getrlimit\n");
+		return EXIT_FAILURE;
+	}
+	rlim.rlim_cur = TEST_LIMIT;
+	if (setrlimit(RLIMIT_NOFILE, &rlim) != 0) {
+		fprintf(stderr, "FAILED: setrlimit\n");
+		return EXIT_FAILURE;
+	}
+
+	static const unsigned int percents[] = { TEST_PERCENT };
+	check(filetrack_nofile_alarm_set(nofile_alarm, NULL, percents, 1), "filetrack_nofile_alarm_set");
+
+	FILE* streams[TEST_LIMIT * TEST_PERCENT / 100u];
+	size_t opened = 0;
+	for (; opened < sizeof(streams) / sizeof(streams[0]); opened++) {
+		streams[opened] = fopen(TEST_PATH, "w");
+		if (streams[opened] == NULL) break;
+	}
+	check(opened == sizeof(streams) / sizeof(streams[0]), "fopen up to the threshold");
+	check(alarm_cnt == 1, "the alarm fires once");
+
+	for (size_t i = 0; i < opened; i++)
+		fclose(streams[i]);
+
+	char buf[64];
+	FILE* log = fopen(TEST_LOG_PATH, "r");
+	check(log != NULL && fgets(buf, sizeof(buf), log) != NULL, "the callback wrote its log");
+	if (log != NULL) fclose(log);
+
+	filetrack_nofile_alarm_set(NULL, NULL, NULL, 0);
+	remove(TEST_PATH);
+	remove(TEST_LOG_PATH);
+
+	if (failures > 0) return EXIT_FAILURE;
+	puts("nofile_alarm_callback: OK");
+	return EXIT_SUCCESS;
+}
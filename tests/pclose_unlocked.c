@@ -0,0 +1,101 @@
+/*
+ * pclose が子プロセスを待つ間に他のスレッドを止めず、子プロセスの実行時間を記録することを確かめる回帰テスト
+ * 追加の機能は不要
+ * 実行方法: make test
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "filetrack.h"
+
+
+#define TEST_PATH "filetrack_test_pclose.txt"
+#define TEST_CHILD_SEC 1u
+#define TEST_OPEN_MAX_NS 500000000ull  /* 子プロセスを待っている間に開くのにかかってよい時間 */
+#define TEST_TIMEOUT_SEC 10u
+
+
+static int failures = 0;
+
+
+static void check (bool ok, const char* what) {
+	if (!ok) {
+		fprintf(stderr, "FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+
+static unsigned long long now_ns (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+
+
+static void* pclose_thread (void* arg) {
+	check(pclose((FILE*)arg) == 0, "pclose of the sleeping child");
+	return NULL;
+}
+
+
+/* レポートを一時ファイルへ書き出し、子プロセスの実行時間の平均を読む（レポート用のファイルは追跡させない） */
+static unsigned long long child_wall_avg_us (void) {
+	FILE* report = (tmpfile)();
+	if (report == NULL) return 0;
+
+	fflush(stdout);
+	int saved = (dup)(STDOUT_FILENO);
+	(dup2)(fileno(report), STDOUT_FILENO);
+	filetrack_site_report();
+	fflush(stdout);
+	(dup2)(saved, STDOUT_FILENO);
+	(close)(saved);
+
+	unsigned long long avg_us = 0;
+	char buf[512];
+	rewind(report);
+	while ((fgets)(buf, sizeof(buf), report) != NULL) {
+		const char* found = strstr(buf, "Wall Time Avg: ");
+		if (found != NULL) avg_us = strtoull(found + strlen("Wall Time Avg: "), NULL, 10);
+	}
+	(fclose)(report);
+	return avg_us;
+}
+
+
+int main (void) {
+	alarm(TEST_TIMEOUT_SEC);
+
+	FILE* child = popen("sleep 1", "r");
+	check(child != NULL, "popen");
+	if (child == NULL) return EXIT_FAILURE;
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, pclose_thread, child) != 0) {
+		fprintf(stderr, "FAILED: pthread_create\n");
+		return EXIT_FAILURE;
+	}
+	usleep(200000);  /* もう一方のスレッドが pclose で待ち始めるまで */
+
+	unsigned long long begin_ns = now_ns();
+	FILE* stream = fopen(TEST_PATH, "w");
+	check(stream != NULL, "fopen while pclose waits");
+	if (stream != NULL) check(fclose(stream) == 0, "fclose while pclose waits");
+	check(now_ns() - begin_ns < TEST_OPEN_MAX_NS, "fopen is not blocked by pclose");
+
+	pthread_join(thread, NULL);
+	remove(TEST_PATH);
+
+	check(child_wall_avg_us() >= TEST_CHILD_SEC * 1000000ull, "the wall time includes the child's runtime");
+
+	if (failures > 0) return EXIT_FAILURE;
+	puts("pclose_unlocked: OK");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+/*
+ * 先読み中の仮想ハンドルを閉じてもデッドロックしないことを確かめる回帰テスト
+ * FILETRACK_ENABLE_COOKIE_ENGINE、FILETRACK_ENABLE_VIRTUAL_HANDLES、FILETRACK_ENABLE_PREFETCH を定義してビルドする
+ * 実行方法: make test
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "filetrack.h"
+
+
+#define TEST_PATH "filetrack_test_prefetch.bin"
+#define TEST_SIZE ((size_t)1 << 20)
+#define TEST_TIMEOUT_SEC 10u  /* デッドロックした場合は SIGALRM で失敗させる */
+
+
+static int failures = 0;
+
+
+static void check (bool ok, const char* what) {
+	if (!ok) {
+		fprintf(stderr, "FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+
+static bool file_create (void) {
+	FILE* stream = fopen(TEST_PATH, "wb");
+	if (stream == NULL) return false;
+
+	static char buf[4096];
+	for (size_t written = 0; written < TEST_SIZE; written += sizeof(buf)) {
+		if (fwrite(buf, 1, sizeof(buf), stream) != sizeof(buf)) {
+			fclose(stream);
+			return false;
+		}
+	}
+	return fclose(stream) == 0;
+}
+
+
+/* 先読みは呼び出し元ごとに設定されるので、同じ行で設定して開く */
+static FILE* open_prefetched (void) {
+	return filetrack_prefetch_set(__FILE__, __LINE__, TEST_SIZE) ? fopen(TEST_PATH, "rb") : NULL;
+}
+
+
+/* 途中まで読んだ仮想ハンドルを、実ファイルを開いたまま閉じる */
+static void close_open_handle (void) {
+	FILE* stream = open_prefetched();
+	check(stream != NULL, "fopen of an open handle");
+	if (stream == NULL) return;
+
+	char buf[100];
+	check(fread(buf, 1, sizeof(buf), stream) == sizeof(buf), "fread of an open handle");
+	check(fclose(stream) == 0, "fclose of an open handle");
+}
+
+
+/* 途中まで読んだ仮想ハンドルを、休止させてから閉じる */
+static void close_parked_handle (void) {
+	FILE* stream = open_prefetched();
+	check(stream != NULL, "fopen of a parked handle");
+	if (stream == NULL) return;
+
+	char buf[100];
+	check(fread(buf, 1, sizeof(buf), stream) == sizeof(buf), "fread of a parked handle");
+
+	FILE* other = fopen(TEST_PATH, "rb");  /* 上限が 1 なので先に開いた方が休止する */
+	check(other != NULL, "fopen of the other handle");
+	if (other != NULL) {
+		check(fread(buf, 1, sizeof(buf), other) == sizeof(buf), "fread of the other handle");
+		check(fclose(other) == 0, "fclose of the other handle");
+	}
+
+	check(fclose(stream) == 0, "fclose of a parked handle");
+}
+
+
+int main (void) {
+	alarm(TEST_TIMEOUT_SEC);
+
+	if (!file_create()) {
+		fprintf(stderr, "FAILED: cannot create %s\n", TEST_PATH);
+		return EXIT_FAILURE;
+	}
+
+	filetrack_virtual_handles_set(1);
+
+	close_open_handle();
+	close_parked_handle();
+
+	FileTrackPrefetchStats stats;
+	check(filetrack_prefetch_stats(&stats), "filetrack_prefetch_stats");
+	check(stats.files == 2, "both streams are prefetched");
+
+	remove(TEST_PATH);
+
+	if (failures > 0) return EXIT_FAILURE;
+	puts("prefetch_virtual_close: OK");
+	return EXIT_SUCCESS;
+}